@@ -0,0 +1,149 @@
+/*
+ * arena.c -- Request-scoped memory
+ *
+ * Everything a request allocates with arenaAlloc (action, paths, versioned
+ * file names, lock paths) is released at once by arenaEnd, so error paths
+ * cannot leak it. Allocation bumps a pointer inside the calling thread's
+ * blocks; the first block (ARENA_BLOCK_SIZE) stays with the thread, so a
+ * typical request touches malloc only when it needs more than that.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+typedef struct arenaBlock
+{
+  struct arenaBlock *next;
+  size_t size; // usable bytes in data
+  size_t used;
+  char data[] __attribute__((aligned(ARENA_ALIGN)));
+} arenaBlock;
+
+static __thread arenaBlock *thread_arena = NULL;
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+// Helper function:
+// Free every block of an arena
+static void freeBlocks(arenaBlock *block)
+{
+  while (block != NULL)
+  {
+    arenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+// Helper function:
+// Release the blocks of an exiting thread
+static void releaseArena(void *arg)
+{
+  freeBlocks((arenaBlock *)arg);
+}
+
+static void createArenaKey(void)
+{
+  pthread_key_create(&arena_key, releaseArena);
+}
+
+// Helper function:
+// Allocate a block with room for at least size bytes
+static arenaBlock *newBlock(size_t size)
+{
+  size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+  arenaBlock *block = (arenaBlock *)malloc(sizeof(arenaBlock) + capacity);
+  if (block == NULL)
+  {
+    return NULL;
+  }
+  block->next = NULL;
+  block->size = capacity;
+  block->used = 0;
+  return block;
+}
+
+// Function: start the calling thread's request; memory of an unfinished one is dropped
+void arenaBegin(void)
+{
+  arenaEnd();
+}
+
+// Function: allocate from the current request, NULL when out of memory
+// The memory stays valid until arenaEnd and must not be passed to free.
+void *arenaAlloc(size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (thread_arena == NULL)
+  {
+    pthread_once(&arena_key_once, createArenaKey);
+    if ((thread_arena = newBlock(size)) == NULL)
+    {
+      return NULL;
+    }
+    pthread_setspecific(arena_key, thread_arena);
+  }
+
+  // The newest block is always at the head
+  arenaBlock *block = thread_arena;
+  if (block->size - block->used < size)
+  {
+    if ((block = newBlock(size)) == NULL)
+    {
+      return NULL;
+    }
+    block->next = thread_arena;
+    thread_arena = block;
+    pthread_setspecific(arena_key, thread_arena);
+  }
+  void *memory = block->data + block->used;
+  block->used += size;
+  return memory;
+}
+
+// Function: copy a string into the current request
+char *arenaStrdup(const char *str)
+{
+  size_t len = strlen(str) + 1;
+  char *copy = (char *)arenaAlloc(len);
+  if (copy != NULL)
+  {
+    memcpy(copy, str, len);
+  }
+  return copy;
+}
+
+// Function: release everything the current request allocated
+// The first block of the thread is kept for its next request.
+void arenaEnd(void)
+{
+  if (thread_arena == NULL)
+  {
+    return;
+  }
+  // The oldest block is the last one
+  arenaBlock *first = thread_arena;
+  while (first->next != NULL)
+  {
+    arenaBlock *next = first->next;
+    free(first);
+    first = next;
+  }
+
+  // Oversized first blocks are not worth keeping
+  if (first->size > ARENA_BLOCK_SIZE)
+  {
+    free(first);
+    first = NULL;
+  }
+  else
+  {
+    first->used = 0;
+  }
+  thread_arena = first;
+  pthread_setspecific(arena_key, thread_arena);
+}
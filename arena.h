@@ -0,0 +1,14 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// First block of every thread's arena, kept from one request to the next
+#define ARENA_BLOCK_SIZE 4096
+
+void arenaBegin(void);
+void *arenaAlloc(size_t size);
+char *arenaStrdup(const char *str);
+void arenaEnd(void);
+
+#endif
@@ -0,0 +1,558 @@
+/*
+ * bench.c -- Microbenchmarks for the helpers on every request
+ *
+ * Each case runs in-process (socketpairs, a temporary data folder). Its
+ * iteration count is grown until one run takes at least BENCH_MIN_NS, then
+ * the best of BENCH_REPEATS runs is kept to filter out noise. The harness reports
+ * ns/op, allocations/op and, for transfers, throughput. Allocations are
+ * counted by wrapping malloc, calloc, realloc and strdup at link time
+ * (-Wl,--wrap), so only calls made by rfs code are counted.
+ *
+ * Results are compared with a stored baseline: a case slower than the
+ * threshold, or allocating more than before, fails the run.
+ *
+ * Usage: ./rfsbench [-b baseline-file] [-t threshold-percent] [-s]
+ *   -s  store this run as the new baseline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "helper.h"
+#include "config.h"
+#include "catalog.h"
+#include "history.h"
+#include "arena.h"
+
+#define BENCH_MIN_NS 100000000.0
+#define BENCH_REPEATS 5
+#define BENCH_MAX_ITERS 100000000L
+#define BENCH_CATALOG_SIZE 1000
+#define BENCH_TRANSFER_SIZE (1024 * 1024)
+#define BENCH_CHECKSUM_SIZE 65536
+#define BENCH_NAME_SIZE 64
+#define DEFAULT_BASELINE "bench.baseline"
+#define DEFAULT_THRESHOLD 25
+
+// Allocation counter behind the --wrap'ed allocators
+static long alloc_count = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+
+void *__wrap_malloc(size_t size)
+{
+  __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+  __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str)
+{
+  __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_strdup(str);
+}
+
+// One benchmark: run(iters) performs iters operations
+typedef struct
+{
+  const char *name;
+  void (*setup)(void);
+  void (*run)(long iters);
+  void (*teardown)(void);
+  size_t bytes_per_op; // for throughput, 0 when not a transfer
+} benchCase;
+
+// Result of a case, and its baseline when one is stored
+typedef struct
+{
+  char name[BENCH_NAME_SIZE];
+  double ns_per_op;
+  double allocs_per_op;
+} benchResult;
+
+// Shared fixtures
+static int sock_pair[2] = {-1, -1};
+static FILE *transfer_file = NULL;
+static char *catalog_text = NULL;
+static long long history_middle = 0;
+static char checksum_data[BENCH_CHECKSUM_SIZE];
+static volatile unsigned long long sink = 0; // keeps results alive
+
+// Helper function:
+// Monotonic clock in nanoseconds
+static double nowNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// ---- Naming ----
+
+static void runCreateFileNameSuffix(long iters)
+{
+  char file_name[BENCH_NAME_SIZE];
+  for (long i = 0; i < iters; i++)
+  {
+    createFileName(file_name, "remote_files/report.txt", 7);
+    sink += (unsigned char)file_name[13];
+  }
+}
+
+static void runCreateFileNamePlain(long iters)
+{
+  char file_name[BENCH_NAME_SIZE];
+  for (long i = 0; i < iters; i++)
+  {
+    createFileName(file_name, "remote_files/README", 7);
+    sink += (unsigned char)file_name[13];
+  }
+}
+
+static void runPrefixSuffix(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    char *prefix = getFilePrefix("remote_files/report.txt", '.');
+    char *suffix = getFileSuffix("remote_files/report.txt", '.');
+    sink += (unsigned char)prefix[0] + (unsigned char)suffix[0];
+    free(prefix);
+    free(suffix);
+  }
+}
+
+// ---- Protocol codec ----
+
+static void setupSocketPair(void)
+{
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock_pair) < 0)
+  {
+    errorMsg("Fail to create socket pair");
+  }
+}
+
+static void teardownSocketPair(void)
+{
+  close(sock_pair[0]);
+  close(sock_pair[1]);
+}
+
+static void runTextRoundTrip(long iters)
+{
+  const char *text = "remote_files/benchmarks/configuration/service-settings.txt";
+  for (long i = 0; i < iters; i++)
+  {
+    char *received;
+    if (!sendText(sock_pair[0], text) || !receiveText(sock_pair[1], &received))
+    {
+      errorMsg("Text round trip failed");
+    }
+    sink += (unsigned char)received[0];
+    free(received);
+  }
+}
+
+static void setupTransfer(void)
+{
+  setupSocketPair();
+  transfer_file = tmpfile();
+  if (transfer_file == NULL)
+  {
+    errorMsg("Fail to create transfer file");
+  }
+  for (int i = 0; i < BENCH_TRANSFER_SIZE; i++)
+  {
+    fputc(i & 0xff, transfer_file);
+  }
+  fflush(transfer_file);
+}
+
+static void teardownTransfer(void)
+{
+  fclose(transfer_file);
+  teardownSocketPair();
+}
+
+// Receiving side of the transfer benchmark
+static void *transferReceiver(void *arg)
+{
+  long iters = *(long *)arg;
+  FILE *devNull = fopen("/dev/null", "w");
+  for (long i = 0; devNull != NULL && i < iters; i++)
+  {
+    if (receiveFileData(sock_pair[1], devNull) != BENCH_TRANSFER_SIZE)
+    {
+      errorMsg("File transfer failed");
+    }
+  }
+  if (devNull != NULL)
+  {
+    fclose(devNull);
+  }
+  return NULL;
+}
+
+static void runFileTransfer(long iters)
+{
+  pthread_t receiver_tid;
+  if (pthread_create(&receiver_tid, NULL, transferReceiver, &iters) != 0)
+  {
+    errorMsg("Fail to create receiver thread");
+  }
+  for (long i = 0; i < iters; i++)
+  {
+    rewind(transfer_file);
+    if (!sendFileData(sock_pair[0], transfer_file))
+    {
+      errorMsg("File transfer failed");
+    }
+  }
+  pthread_join(receiver_tid, NULL);
+}
+
+// ---- Catalog ----
+
+static void setupCatalog(void)
+{
+  FILE *filePointer = fopen(VERSION_PATH, "w");
+  if (filePointer == NULL)
+  {
+    errorMsg("Fail to create version info file");
+  }
+  for (int i = 0; i < BENCH_CATALOG_SIZE; i++)
+  {
+    fprintf(filePointer, "remote_files/file_%d.txt=%d\n", i, i % 10);
+  }
+  fclose(filePointer);
+  catalog_text = readCatalog();
+}
+
+static void teardownCatalog(void)
+{
+  free(catalog_text);
+  remove(VERSION_PATH);
+}
+
+static void runGetNewVer(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    sink += getNewVer("remote_files/file_500.txt");
+  }
+}
+
+static void runUpdateNewVer(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    updateNewVer("remote_files/file_500.txt", (int)(i % 10));
+  }
+}
+
+static void runCatalogLookup(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    sink += catalogLookup(catalog_text, "remote_files/file_500.txt");
+  }
+}
+
+static void setupHistory(void)
+{
+  char file_path[BENCH_NAME_SIZE];
+  for (int i = 0; i < BENCH_CATALOG_SIZE; i++)
+  {
+    sprintf(file_path, "remote_files/file_%d.txt", i % 10);
+    long long time = historyRecord(file_path, i / 10);
+    if (i == BENCH_CATALOG_SIZE / 2)
+    {
+      history_middle = time;
+    }
+  }
+}
+
+static void teardownHistory(void)
+{
+  remove(HISTORY_PATH);
+}
+
+static void runHistoryLookup(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    sink += historyLookup("remote_files/file_5.txt", history_middle);
+  }
+}
+
+// ---- Hashing ----
+
+// ---- Request memory ----
+
+// The allocations of a typical GET: action, path, checksum and versioned name
+static void runArenaRequest(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    arenaBegin();
+    char *action = arenaStrdup("GET");
+    char *path = arenaStrdup("remote_files/report.txt");
+    char *checksum = arenaStrdup(NO_CHECKSUM);
+    char *file_name = (char *)arenaAlloc(strlen(path) + VERSION_NAME_EXTRA);
+    createFileName(file_name, path, 7);
+    sink += (unsigned char)action[0] + (unsigned char)checksum[0] + (unsigned char)file_name[13];
+    arenaEnd();
+  }
+}
+
+static void runHashString(long iters)
+{
+  for (long i = 0; i < iters; i++)
+  {
+    sink += hashString("remote_files/benchmarks/configuration/service-settings.txt");
+  }
+}
+
+static void runDataChecksum(long iters)
+{
+  char checksum[CHECKSUM_SIZE];
+  for (long i = 0; i < iters; i++)
+  {
+    dataChecksum(checksum_data, sizeof(checksum_data), checksum);
+    sink += (unsigned char)checksum[0];
+  }
+}
+
+static const benchCase cases[] = {
+    {"createFileName/suffix", NULL, runCreateFileNameSuffix, NULL, 0},
+    {"createFileName/plain", NULL, runCreateFileNamePlain, NULL, 0},
+    {"getFilePrefix+getFileSuffix", NULL, runPrefixSuffix, NULL, 0},
+    {"sendText+receiveText", setupSocketPair, runTextRoundTrip, teardownSocketPair, 0},
+    {"sendFileData+receiveFileData/1MiB", setupTransfer, runFileTransfer, teardownTransfer, BENCH_TRANSFER_SIZE},
+    {"getNewVer/1000-paths", setupCatalog, runGetNewVer, teardownCatalog, 0},
+    {"catalogLookup/1000-paths", setupCatalog, runCatalogLookup, teardownCatalog, 0},
+    {"updateNewVer/1000-paths", setupCatalog, runUpdateNewVer, teardownCatalog, 0},
+    {"historyLookup/1000-commits", setupHistory, runHistoryLookup, teardownHistory, 0},
+    {"arenaAlloc/request", NULL, runArenaRequest, NULL, 0},
+    {"hashString", NULL, runHashString, NULL, 0},
+    {"dataChecksum/64KiB", NULL, runDataChecksum, NULL, BENCH_CHECKSUM_SIZE},
+};
+
+// Helper function:
+// Time iters operations of a case, counting their allocations
+static double timeRun(const benchCase *bench, long iters, long *allocs)
+{
+  long allocs_before = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+  double start = nowNs();
+  bench->run(iters);
+  double elapsed = nowNs() - start;
+  *allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - allocs_before;
+  return elapsed;
+}
+
+// Helper function:
+// Grow the iteration count until a run takes BENCH_MIN_NS, then keep the
+// fastest of BENCH_REPEATS runs
+static void measure(const benchCase *bench, benchResult *result)
+{
+  long allocs;
+  long iters = 1;
+  double elapsed = timeRun(bench, iters, &allocs); // also warms up
+  while (elapsed < BENCH_MIN_NS && iters < BENCH_MAX_ITERS)
+  {
+    // Aim straight for the target once the run is long enough to extrapolate
+    iters = elapsed < BENCH_MIN_NS / 100 ? iters * 10 : (long)(iters * 1.2 * BENCH_MIN_NS / elapsed) + 1;
+    elapsed = timeRun(bench, iters, &allocs);
+  }
+
+  double best = elapsed;
+  for (int r = 1; r < BENCH_REPEATS; r++)
+  {
+    elapsed = timeRun(bench, iters, &allocs);
+    best = elapsed < best ? elapsed : best;
+  }
+  snprintf(result->name, sizeof(result->name), "%s", bench->name);
+  result->ns_per_op = best / iters;
+  result->allocs_per_op = (double)allocs / iters;
+}
+
+// Helper function:
+// Load a stored baseline, returns the number of results read
+static int loadBaseline(const char *path, benchResult *baseline, int max_count)
+{
+  FILE *filePointer = fopen(path, "r");
+  if (filePointer == NULL)
+  {
+    return 0;
+  }
+  int count = 0;
+  char line[256];
+  while (count < max_count && fgets(line, sizeof(line), filePointer))
+  {
+    if (line[0] == '#')
+    {
+      continue;
+    }
+    benchResult *result = &baseline[count];
+    if (sscanf(line, "%63s %lf %lf", result->name, &result->ns_per_op, &result->allocs_per_op) == 3)
+    {
+      count++;
+    }
+  }
+  fclose(filePointer);
+  return count;
+}
+
+// Helper function:
+// Store results as the new baseline
+static void saveBaseline(const char *path, const benchResult *results, int count)
+{
+  FILE *filePointer = fopen(path, "w");
+  if (filePointer == NULL)
+  {
+    errorMsg("Fail to store benchmark baseline");
+  }
+  fprintf(filePointer, "# name ns/op allocs/op\n");
+  for (int i = 0; i < count; i++)
+  {
+    fprintf(filePointer, "%s %.1f %.3f\n", results[i].name, results[i].ns_per_op, results[i].allocs_per_op);
+  }
+  fclose(filePointer);
+}
+
+// Main function
+int main(int argc, char *argv[])
+{
+  const char *baseline_arg = DEFAULT_BASELINE;
+  int threshold = DEFAULT_THRESHOLD;
+  int save = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:t:s")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      baseline_arg = optarg;
+      break;
+    case 't':
+      threshold = atoi(optarg);
+      break;
+    case 's':
+      save = 1;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-b baseline-file] [-t threshold-percent] [-s]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // The baseline stays where we were started; fixtures live in a temporary folder
+  char baseline_path[PATH_MAX];
+  if (baseline_arg[0] == '/' || getcwd(baseline_path, sizeof(baseline_path)) == NULL)
+  {
+    snprintf(baseline_path, sizeof(baseline_path), "%s", baseline_arg);
+  }
+  else
+  {
+    size_t len = strlen(baseline_path);
+    snprintf(baseline_path + len, sizeof(baseline_path) - len, "/%s", baseline_arg);
+  }
+  getTunables();
+  char data_dir[] = "/tmp/rfsbench.XXXXXX";
+  if (mkdtemp(data_dir) == NULL || chdir(data_dir) != 0)
+  {
+    errorMsg("Fail to create benchmark folder");
+  }
+  for (size_t i = 0; i < sizeof(checksum_data); i++)
+  {
+    checksum_data[i] = (char)(i * 31);
+  }
+
+  int case_count = sizeof(cases) / sizeof(cases[0]);
+  benchResult results[case_count];
+  benchResult baseline[case_count];
+  int baseline_count = save ? 0 : loadBaseline(baseline_path, baseline, case_count);
+
+  printf("%-36s %14s %10s %10s %14s %8s\n", "benchmark", "ns/op", "allocs/op", "MB/s", "baseline ns/op", "change");
+  int regressions = 0;
+  for (int i = 0; i < case_count; i++)
+  {
+    const benchCase *bench = &cases[i];
+    if (bench->setup != NULL)
+    {
+      bench->setup();
+    }
+    measure(bench, &results[i]);
+    if (bench->teardown != NULL)
+    {
+      bench->teardown();
+    }
+
+    char throughput[32] = "-";
+    if (bench->bytes_per_op > 0)
+    {
+      snprintf(throughput, sizeof(throughput), "%.1f", bench->bytes_per_op / results[i].ns_per_op * 1e9 / (1024 * 1024));
+    }
+    printf("%-36s %14.1f %10.3f %10s", results[i].name, results[i].ns_per_op, results[i].allocs_per_op, throughput);
+
+    const benchResult *base = NULL;
+    for (int b = 0; b < baseline_count; b++)
+    {
+      if (strcmp(baseline[b].name, results[i].name) == 0)
+      {
+        base = &baseline[b];
+      }
+    }
+    if (base == NULL)
+    {
+      printf(" %14s %8s\n", "-", "new");
+      continue;
+    }
+    double change = (results[i].ns_per_op / base->ns_per_op - 1) * 100;
+    int slower = change > threshold;
+    int allocates_more = results[i].allocs_per_op > base->allocs_per_op + 0.01;
+    printf(" %14.1f %+7.1f%%%s\n", base->ns_per_op, change,
+           slower ? "  REGRESSION" : allocates_more ? "  MORE ALLOCATIONS" : "");
+    regressions += slower || allocates_more;
+  }
+
+  remove(".temp");
+  if (chdir("/") != 0 || rmdir(data_dir) != 0)
+  {
+    perror("Fail to remove benchmark folder");
+  }
+
+  if (save || baseline_count == 0)
+  {
+    saveBaseline(baseline_path, results, case_count);
+    printf("\nBaseline stored in %s\n", baseline_path);
+    return 0;
+  }
+  if (regressions > 0)
+  {
+    printf("\n%d benchmark(s) regressed beyond %d%% or allocate more than the baseline\n", regressions, threshold);
+    return 1;
+  }
+  printf("\nNo regression beyond %d%% against %s\n", threshold, baseline_path);
+  return 0;
+}
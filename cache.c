@@ -0,0 +1,432 @@
+/*
+ * cache.c -- Client-side version-aware file cache
+ *
+ * Every fetched version is kept under CACHE_DIR as
+ *   <hash of remote path>/v<version>@<checksum>
+ * so the client can tell the server what it already holds (conditional GET).
+ * A lookup only lists the folder of its own path, however large the cache.
+ * Two paths sharing a hash cannot mix up content: the server only answers
+ * "not modified" when the checksum matches the version it resolved.
+ *
+ * CACHE_BUDGET is kept with an index of the entries in least recently used
+ * order and their total size. It is read from disk once, at the first store
+ * of the process, and then kept up to date, so each eviction takes the
+ * oldest entry without walking the cache again. Entries another process
+ * adds meanwhile are counted from its next run on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "cache.h"
+
+#define CACHE_INDEX_BUCKETS 1024
+
+// Entry of the in-memory index, by path and in least recently used order
+typedef struct cacheItem
+{
+  char *path;
+  long size;
+  time_t used;
+  struct cacheItem *older;
+  struct cacheItem *newer;
+  struct cacheItem *next; // same bucket
+} cacheItem;
+
+static cacheItem *buckets[CACHE_INDEX_BUCKETS];
+static cacheItem *oldest_item = NULL;
+static cacheItem *newest_item = NULL;
+static long cache_total = 0;
+static int index_loaded = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Helper function:
+// Folder holding the cached versions of a remote path
+static void entryFolder(const char *remote_file, char *folder, size_t size)
+{
+  snprintf(folder, size, "%s/%016llx", CACHE_DIR, hashString(remote_file));
+}
+
+// Helper function:
+// Split a cache file name into its version and checksum
+static int parseEntryName(const char *entry_name, int *version, char *checksum)
+{
+  const char *at_sum = strrchr(entry_name, '@');
+  if (entry_name[0] != 'v' || at_sum == NULL || strlen(at_sum + 1) != CHECKSUM_SIZE - 1)
+  {
+    return 0;
+  }
+  *version = atoi(entry_name + 1);
+  strcpy(checksum, at_sum + 1);
+  return 1;
+}
+
+// Helper function:
+// Copy the content of one file into another
+static int copyFile(const char *src_file, const char *dest_file)
+{
+  FILE *src = fopen(src_file, "rb");
+  if (src == NULL)
+  {
+    return 0;
+  }
+  FILE *dest = fopen(dest_file, "wb");
+  if (dest == NULL)
+  {
+    fclose(src);
+    return 0;
+  }
+
+  char buffer[TRANSFER_CHUNK_SIZE];
+  size_t bytesRead;
+  int ok = 1;
+  while ((bytesRead = fread(buffer, 1, sizeof(buffer), src)) > 0)
+  {
+    if (fwrite(buffer, 1, bytesRead, dest) != bytesRead)
+    {
+      ok = 0;
+      break;
+    }
+  }
+  fclose(src);
+  if (fclose(dest) != 0)
+  {
+    ok = 0;
+  }
+  return ok;
+}
+
+// Function: find a cached copy of a remote file
+// With version >= 0 only that version matches, with -1 the newest cached version is chosen.
+int cacheLookup(const char *remote_file, int version, cacheEntry *entry)
+{
+  char folder[CACHE_PATH_SIZE];
+  entryFolder(remote_file, folder, sizeof(folder));
+  DIR *dir = opendir(folder);
+  if (dir == NULL)
+  {
+    return 0;
+  }
+
+  int found = 0;
+  struct dirent *dent;
+  while ((dent = readdir(dir)) != NULL)
+  {
+    int entry_version;
+    char checksum[CHECKSUM_SIZE];
+    if (!parseEntryName(dent->d_name, &entry_version, checksum))
+    {
+      continue;
+    }
+    if (version >= 0 ? entry_version != version : (found && entry_version <= entry->version))
+    {
+      continue;
+    }
+    entry->version = entry_version;
+    strcpy(entry->checksum, checksum);
+    snprintf(entry->path, sizeof(entry->path), "%s/%s", folder, dent->d_name);
+    found = 1;
+  }
+  closedir(dir);
+  return found;
+}
+
+// Helper function:
+// Find the index entry of a cache file; caller holds cache_lock
+static cacheItem **findItem(const char *entry_path)
+{
+  cacheItem **link = &buckets[hashString(entry_path) % CACHE_INDEX_BUCKETS];
+  while (*link != NULL && strcmp((*link)->path, entry_path) != 0)
+  {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+// Helper function:
+// Take an entry out of the least recently used order
+static void unlinkItem(cacheItem *item)
+{
+  *(item->older != NULL ? &item->older->newer : &oldest_item) = item->newer;
+  *(item->newer != NULL ? &item->newer->older : &newest_item) = item->older;
+  item->older = item->newer = NULL;
+}
+
+// Helper function:
+// Put an entry where its last use belongs, normally at the newest end
+static void linkItem(cacheItem *item)
+{
+  cacheItem *older = newest_item;
+  while (older != NULL && older->used > item->used)
+  {
+    older = older->older;
+  }
+  item->older = older;
+  item->newer = older != NULL ? older->newer : oldest_item;
+  *(item->older != NULL ? &item->older->newer : &oldest_item) = item;
+  *(item->newer != NULL ? &item->newer->older : &newest_item) = item;
+}
+
+// Helper function:
+// Record a cache file in the index, or its new size and use
+static void addItem(const char *entry_path, long size, time_t used)
+{
+  cacheItem **link = findItem(entry_path);
+  cacheItem *item = *link;
+  if (item == NULL)
+  {
+    item = (cacheItem *)calloc(1, sizeof(cacheItem));
+    if (item == NULL || (item->path = strdup(entry_path)) == NULL)
+    {
+      free(item);
+      return;
+    }
+    *link = item;
+  }
+  else
+  {
+    cache_total -= item->size;
+    unlinkItem(item);
+  }
+  item->size = size;
+  item->used = used;
+  cache_total += size;
+  linkItem(item);
+}
+
+// Helper function:
+// Drop a cache file from the index
+static void dropItem(const char *entry_path)
+{
+  cacheItem **link = findItem(entry_path);
+  cacheItem *item = *link;
+  if (item == NULL)
+  {
+    return;
+  }
+  *link = item->next;
+  unlinkItem(item);
+  cache_total -= item->size;
+  free(item->path);
+  free(item);
+}
+
+// Cache file found on disk while loading the index
+typedef struct
+{
+  char *path;
+  long size;
+  time_t used;
+} scannedEntry;
+
+typedef struct
+{
+  scannedEntry *entries;
+  int count;
+  int capacity;
+} scannedList;
+
+// Helper function:
+// Collect the entries below a cache folder
+static void scanEntries(const char *folder, scannedList *list)
+{
+  DIR *dir = opendir(folder);
+  if (dir == NULL)
+  {
+    return;
+  }
+  struct dirent *dent;
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if (dent->d_name[0] == '.')
+    {
+      continue;
+    }
+    char entry_path[CACHE_PATH_SIZE];
+    struct stat entry_stat;
+    snprintf(entry_path, sizeof(entry_path), "%s/%s", folder, dent->d_name);
+    if (stat(entry_path, &entry_stat) < 0)
+    {
+      continue;
+    }
+    if (S_ISDIR(entry_stat.st_mode))
+    {
+      scanEntries(entry_path, list);
+      continue;
+    }
+    if (list->count == list->capacity)
+    {
+      int capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+      scannedEntry *grown = (scannedEntry *)realloc(list->entries, capacity * sizeof(scannedEntry));
+      if (grown == NULL)
+      {
+        break;
+      }
+      list->entries = grown;
+      list->capacity = capacity;
+    }
+    scannedEntry *entry = &list->entries[list->count];
+    if ((entry->path = strdup(entry_path)) != NULL)
+    {
+      entry->size = (long)entry_stat.st_size;
+      entry->used = entry_stat.st_mtime;
+      list->count++;
+    }
+  }
+  closedir(dir);
+}
+
+// Helper function:
+// Order scanned entries by last use
+static int compareUse(const void *a, const void *b)
+{
+  time_t used_a = ((const scannedEntry *)a)->used;
+  time_t used_b = ((const scannedEntry *)b)->used;
+  return (used_a > used_b) - (used_a < used_b);
+}
+
+// Helper function:
+// Load the index from disk, oldest entries first so each one links in place;
+// caller holds cache_lock
+static void loadIndex(void)
+{
+  scannedList list = {NULL, 0, 0};
+  scanEntries(CACHE_DIR, &list);
+  if (list.count > 0)
+  {
+    qsort(list.entries, (size_t)list.count, sizeof(scannedEntry), compareUse);
+  }
+  for (int i = 0; i < list.count; i++)
+  {
+    addItem(list.entries[i].path, list.entries[i].size, list.entries[i].used);
+    free(list.entries[i].path);
+  }
+  free(list.entries);
+  index_loaded = 1;
+}
+
+// Helper function:
+// Evict least recently used entries until the cache fits in the CACHE_BUDGET
+// tunable; caller holds cache_lock
+static void cacheTrim(long budget)
+{
+  while (cache_total > budget && oldest_item != NULL)
+  {
+    char oldest[CACHE_PATH_SIZE];
+    snprintf(oldest, sizeof(oldest), "%s", oldest_item->path);
+    if (remove(oldest) != 0 && errno != ENOENT)
+    {
+      return;
+    }
+    dropItem(oldest);
+    // The folder of a path goes with its last entry
+    *strrchr(oldest, '/') = '\0';
+    rmdir(oldest);
+  }
+}
+
+// Helper function:
+// Account for a new cache file and trim the cache to its budget
+static void noteStored(const char *entry_path)
+{
+  long budget = getTunables()->cache_budget;
+  struct stat entry_stat;
+  if (budget <= 0 || stat(entry_path, &entry_stat) < 0)
+  {
+    return;
+  }
+  pthread_mutex_lock(&cache_lock);
+  if (!index_loaded)
+  {
+    loadIndex();
+  }
+  addItem(entry_path, (long)entry_stat.st_size, entry_stat.st_mtime);
+  cacheTrim(budget);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// Helper function:
+// Forget a cache file removed from disk
+static void noteRemoved(const char *entry_path)
+{
+  pthread_mutex_lock(&cache_lock);
+  dropItem(entry_path);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// Function: keep a copy of a fetched version in the cache
+// Any stale entry for the same (path, version) with another checksum is dropped.
+int cacheStore(const char *remote_file, int version, const char *checksum, const char *src_file)
+{
+  if (mkdir(CACHE_DIR, 0755) < 0 && errno != EEXIST)
+  {
+    perror("Fail to create cache directory");
+    return 0;
+  }
+
+  cacheEntry stale;
+  while (cacheLookup(remote_file, version, &stale) && strcmp(stale.checksum, checksum) != 0)
+  {
+    if (remove(stale.path) != 0)
+    {
+      break;
+    }
+    noteRemoved(stale.path);
+  }
+
+  char folder[CACHE_PATH_SIZE];
+  entryFolder(remote_file, folder, sizeof(folder));
+  if (mkdir(folder, 0755) < 0 && errno != EEXIST)
+  {
+    perror("Fail to create cache directory");
+    return 0;
+  }
+  char entry_path[CACHE_PATH_SIZE + 64];
+  snprintf(entry_path, sizeof(entry_path), "%s/v%d@%s", folder, version, checksum);
+  if (isValidFile(entry_path))
+  {
+    return 1;
+  }
+
+  // Fill a temporary file first so a crash never leaves a truncated entry
+  // behind; each store gets a name of its own, whatever process or thread runs it
+  char temp_path[CACHE_PATH_SIZE];
+  snprintf(temp_path, sizeof(temp_path), "%s/.tmp.XXXXXX", CACHE_DIR);
+  int temp_fd = mkstemp(temp_path);
+  if (temp_fd < 0)
+  {
+    perror("Fail to store file in cache");
+    return 0;
+  }
+  close(temp_fd);
+  if (!copyFile(src_file, temp_path) || rename(temp_path, entry_path) != 0)
+  {
+    perror("Fail to store file in cache");
+    remove(temp_path);
+    return 0;
+  }
+  noteStored(entry_path);
+  return 1;
+}
+
+// Function: materialize a cached version as a local file
+// The entry's modification time is refreshed so eviction is least recently used.
+int cacheCopy(const cacheEntry *entry, const char *dest_file)
+{
+  utime(entry->path, NULL);
+  pthread_mutex_lock(&cache_lock);
+  cacheItem *item = *findItem(entry->path);
+  if (item != NULL)
+  {
+    addItem(entry->path, item->size, time(NULL));
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return copyFile(entry->path, dest_file);
+}
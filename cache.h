@@ -0,0 +1,21 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "helper.h"
+
+#define CACHE_DIR ".rfs_cache"
+#define CACHE_PATH_SIZE 1024
+
+// Entry of the client-side cache, keyed by (remote path, version, checksum)
+typedef struct
+{
+  int version;
+  char checksum[CHECKSUM_SIZE];
+  char path[CACHE_PATH_SIZE];
+} cacheEntry;
+
+int cacheLookup(const char *remote_file, int version, cacheEntry *entry);
+int cacheStore(const char *remote_file, int version, const char *checksum, const char *src_file);
+int cacheCopy(const cacheEntry *entry, const char *dest_file);
+
+#endif
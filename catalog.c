@@ -0,0 +1,354 @@
+/*
+ * catalog.c -- The version info file: "<path>=<latest version>" lines, the last one of a path wins
+ *
+ * A commit appends one line instead of rewriting the file, and an index in
+ * memory answers lookups. Once the lines overridden by later ones outnumber
+ * the stored paths, the file is compacted from the index through a temporary
+ * copy renamed over the original; RM compacts right away to drop its paths.
+ * Callers serialize changes with the server's catalog lock.
+ *
+ * The file is shared with a predecessor or successor process during an
+ * upgrade: before every use the index picks up lines appended by the other
+ * process, and reloads when the file was rewritten. The file as this process
+ * last wrote it is remembered, so whoever caches its contents can notice a
+ * change made by the other process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "helper.h"
+#include "catalog.h"
+#include "trace.h"
+
+#define CATALOG_BUCKETS 4096
+
+typedef struct catalogEntry
+{
+  char *path;
+  int latest;
+  int slot; // position in entries
+  struct catalogEntry *next;
+} catalogEntry;
+
+static catalogEntry *buckets[CATALOG_BUCKETS];
+static catalogEntry **entries = NULL; // in the order of the file, NULL where a path was removed
+static int entry_count = 0;
+static int entry_capacity = 0;
+static int live_count = 0;  // paths in the index
+static int stale_lines = 0; // lines of the file overridden by a later one
+static off_t loaded_size = 0;
+static ino_t loaded_inode = 0;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct stat written; // the version info file as this process left it
+static int written_known = 0;
+static int changed_elsewhere = 0;
+
+// Helper function:
+// Note a rewrite of the version info file by another process since our last one
+static void noteOtherWriters(void)
+{
+  struct stat now;
+  if (written_known && (stat(VERSION_PATH, &now) != 0 || now.st_ino != written.st_ino ||
+                        now.st_size != written.st_size || now.st_mtim.tv_sec != written.st_mtim.tv_sec ||
+                        now.st_mtim.tv_nsec != written.st_mtim.tv_nsec))
+  {
+    changed_elsewhere = 1;
+  }
+}
+
+// Helper function:
+// Find the entry of a path, NULL when it is not stored
+static catalogEntry *findEntry(const char *file_name)
+{
+  for (catalogEntry *entry = buckets[hashString(file_name) % CATALOG_BUCKETS]; entry != NULL; entry = entry->next)
+  {
+    if (strcmp(entry->path, file_name) == 0)
+    {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Helper function:
+// Apply one line of the file: a new path, or a later version of a known one
+static void setEntry(const char *file_name, int versionNumber)
+{
+  catalogEntry *entry = findEntry(file_name);
+  if (entry != NULL)
+  {
+    entry->latest = versionNumber;
+    stale_lines++;
+    return;
+  }
+  if (entry_count == entry_capacity)
+  {
+    int capacity = entry_capacity == 0 ? 256 : entry_capacity * 2;
+    catalogEntry **grown = (catalogEntry **)realloc(entries, capacity * sizeof(catalogEntry *));
+    if (grown == NULL)
+    {
+      return;
+    }
+    entries = grown;
+    entry_capacity = capacity;
+  }
+  entry = (catalogEntry *)calloc(1, sizeof(catalogEntry));
+  if (entry == NULL || (entry->path = strdup(file_name)) == NULL)
+  {
+    free(entry);
+    return;
+  }
+  catalogEntry **bucket = &buckets[hashString(file_name) % CATALOG_BUCKETS];
+  entry->latest = versionNumber;
+  entry->slot = entry_count;
+  entry->next = *bucket;
+  *bucket = entry;
+  entries[entry_count++] = entry;
+  live_count++;
+}
+
+// Helper function:
+// Drop a path from the index
+static void dropEntry(catalogEntry *entry)
+{
+  catalogEntry **link = &buckets[hashString(entry->path) % CATALOG_BUCKETS];
+  while (*link != entry)
+  {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  entries[entry->slot] = NULL;
+  free(entry->path);
+  free(entry);
+  live_count--;
+}
+
+// Helper function:
+// Forget everything held in memory
+static void clearIndex(void)
+{
+  for (int i = 0; i < entry_count; i++)
+  {
+    if (entries[i] != NULL)
+    {
+      dropEntry(entries[i]);
+    }
+  }
+  entry_count = 0;
+  stale_lines = 0;
+  loaded_size = 0;
+}
+
+// Helper function:
+// Bring the index up to date with the version info file; caller holds index_lock
+// Returns 0 when the file does not exist.
+static int syncIndex(void)
+{
+  struct stat version_stat;
+  if (stat(VERSION_PATH, &version_stat) < 0)
+  {
+    clearIndex();
+    loaded_inode = 0;
+    return 0;
+  }
+  if (version_stat.st_ino != loaded_inode || version_stat.st_size < loaded_size)
+  {
+    // Compacted or removed by another process: start over
+    clearIndex();
+    loaded_inode = version_stat.st_ino;
+  }
+  if (version_stat.st_size == loaded_size)
+  {
+    return 1;
+  }
+
+  FILE *filePointer = fopen(VERSION_PATH, "r");
+  if (filePointer == NULL || fseeko(filePointer, loaded_size, SEEK_SET) != 0)
+  {
+    if (filePointer != NULL)
+    {
+      fclose(filePointer);
+    }
+    return 1;
+  }
+  // Paths have no length limit, so neither have the lines
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_size, filePointer)) > 0)
+  {
+    if (line[len - 1] != '\n')
+    {
+      break; // still being appended, pick it up next time
+    }
+    loaded_size += (off_t)len;
+    line[len - 1] = '\0';
+
+    // split the line by '=' to get file name and version number
+    char *equals = strchr(line, '=');
+    if (equals != NULL && equals != line)
+    {
+      *equals = '\0';
+      setEntry(line, atoi(equals + 1));
+    }
+  }
+  free(line);
+  fclose(filePointer);
+  return 1;
+}
+
+// Helper function:
+// Rewrite the version info file from the index, one line per path, and
+// install it through a temporary copy; caller holds index_lock
+static void compactCatalog(void)
+{
+  traceSpan span = traceStart("compact catalog");
+  FILE *temp = fopen(".temp", "w");
+  if (temp == NULL)
+  {
+    errorMsg("Fail to create temp file");
+  }
+  int kept = 0;
+  for (int i = 0; i < entry_count; i++)
+  {
+    if (entries[i] != NULL)
+    {
+      fprintf(temp, "%s=%d\n", entries[i]->path, entries[i]->latest);
+      entries[i]->slot = kept;
+      entries[kept++] = entries[i];
+    }
+  }
+  entry_count = kept;
+  stale_lines = 0;
+  fclose(temp);
+
+  noteOtherWriters();
+  if (rename(".temp", VERSION_PATH) != 0)
+  {
+    errorMsg("Fail to replace version info");
+  }
+  written_known = stat(VERSION_PATH, &written) == 0;
+  loaded_inode = written_known ? written.st_ino : 0;
+  loaded_size = written_known ? written.st_size : 0;
+  traceStop(span);
+}
+
+// Function: whether another process rewrote the version info file since this
+// one last wrote or asked; the first call only takes note of the current file
+int catalogChangedElsewhere(void)
+{
+  noteOtherWriters();
+  int changed = changed_elsewhere;
+  changed_elsewhere = 0;
+  struct stat now;
+  if (stat(VERSION_PATH, &now) == 0)
+  {
+    written = now;
+    written_known = 1;
+  }
+  return changed;
+}
+
+// Function: retreive the latest version number from file name
+int getNewVer(const char *file_name)
+{
+  traceSpan span = traceStart("getNewVer");
+  pthread_mutex_lock(&index_lock);
+  syncIndex();
+  catalogEntry *entry = findEntry(file_name);
+  int versionNumber = entry != NULL ? entry->latest : 0;
+  pthread_mutex_unlock(&index_lock);
+  traceStop(span);
+  return versionNumber;
+}
+
+// Function: update the latest version by file name
+// Appends a "<path>=<version>" line that overrides any earlier one of the path,
+// and compacts the file once overridden lines outnumber the stored paths.
+void updateNewVer(const char *file_name, int versionNumber)
+{
+  traceSpan span = traceStart("updateNewVer");
+  pthread_mutex_lock(&index_lock);
+  syncIndex();
+  noteOtherWriters();
+  FILE *filePointer = fopen(VERSION_PATH, "a");
+  if (filePointer == NULL)
+  {
+    errorMsg("Fail to open the version file");
+  }
+  fprintf(filePointer, "%s=%d\n", file_name, versionNumber);
+  fclose(filePointer);
+  written_known = stat(VERSION_PATH, &written) == 0;
+
+  // The index reads the new line back like any other appended one
+  syncIndex();
+  if (stale_lines > live_count)
+  {
+    compactCatalog();
+  }
+  pthread_mutex_unlock(&index_lock);
+  traceStop(span);
+}
+
+// Function: remove version info related to a file name
+// For a folder, the info of every file inside it goes as well.
+void removeVersionInfo(const char *file_name)
+{
+  pthread_mutex_lock(&index_lock);
+  if (!syncIndex())
+  {
+    errorMsg("Fail to open version file");
+  }
+
+  size_t name_len = strlen(file_name);
+  for (int i = 0; i < entry_count; i++)
+  {
+    // The file itself, or for a folder the files inside it
+    catalogEntry *entry = entries[i];
+    if (entry != NULL && strncmp(entry->path, file_name, name_len) == 0 &&
+        (entry->path[name_len] == '\0' || entry->path[name_len] == '/' ||
+         (name_len > 0 && file_name[name_len - 1] == '/')))
+    {
+      dropEntry(entry);
+    }
+  }
+
+  // Rewrite the file without them
+  compactCatalog();
+  pthread_mutex_unlock(&index_lock);
+}
+
+// Function: read the version info into a newly allocated "CATALOG\n<path>=<version>..." text,
+// one line per stored path
+char *readCatalog(void)
+{
+  pthread_mutex_lock(&index_lock);
+  if (!syncIndex())
+  {
+    pthread_mutex_unlock(&index_lock);
+    return NULL;
+  }
+  size_t size = 0;
+  char *catalog = NULL;
+  FILE *catalogStream = open_memstream(&catalog, &size);
+  if (catalogStream == NULL)
+  {
+    pthread_mutex_unlock(&index_lock);
+    return NULL;
+  }
+  fprintf(catalogStream, "CATALOG\n");
+  for (int i = 0; i < entry_count; i++)
+  {
+    if (entries[i] != NULL)
+    {
+      fprintf(catalogStream, "%s=%d\n", entries[i]->path, entries[i]->latest);
+    }
+  }
+  pthread_mutex_unlock(&index_lock);
+  fclose(catalogStream);
+  return catalog;
+}
@@ -0,0 +1,10 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+int getNewVer(const char *file_name);
+void updateNewVer(const char *file_name, int versionNumber);
+void removeVersionInfo(const char *file_name);
+char *readCatalog(void);
+int catalogChangedElsewhere(void);
+
+#endif
@@ -5,43 +5,109 @@
  *   https://www.educative.io/answers/how-to-implement-tcp-sockets-in-c
  */
 
+#define _GNU_SOURCE // strptime
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <time.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "helper.h"
+#include "config.h"
+#include "cache.h"
+#include "shard.h"
+#include "replica.h"
 
-#define PORT_NUMBER 1500
-#define MAX_BUFFER_SIZE 1024
+// Left by SYNC in the local folder: size, modification time and checksum of every file
+#define SYNC_MANIFEST ".rfs_manifest"
 
+// Set for point-in-time reads: replicas may not have caught up with a snapshot
+static int pin_primary = 0;
 
-// Function: create a socket and send action to server
-int socketGenerator(const char *action)
-{
-  int socket_desc;
-  struct sockaddr_in server_addr;
-  // Create socket:
-  socket_desc = socket(AF_INET, SOCK_STREAM, 0);
+// Set during a SYNC: MWRITE keeps the path of each file below this local folder
+static const char *sync_root = NULL;
 
-  if (socket_desc < 0)
+
+
+// Helper function:
+// Choose the server for an action on a remote path:
+//  - with SHARDS configured, the shard owning the path on the hash ring
+//  - otherwise the primary from IP_ADDRESS, or for GET, MGET, LS, LIST and DIFF any of
+//    the primary and the READ_REPLICAS endpoints at random (point-in-time
+//    reads always go to the primary)
+void chooseEndpoint(const char *action, const char *remote_path, char *ip, size_t size, int *port)
+{
+  const rfsConfig *tunables = getTunables();
+  const char *shards = getConfig("SHARDS");
+  if (shards != NULL && remote_path != NULL)
   {
-    errorMsg("Unable to create socket");
+    shardRing ring;
+    if (!shardRingLoad(&ring, shards, tunables->shard_vnodes, tunables->port))
+    {
+      errorMsg("Invalid SHARDS in .config");
+    }
+    shardEndpoint *owner = &ring.endpoints[shardLookup(&ring, remote_path)];
+    snprintf(ip, size, "%s", owner->ip);
+    *port = owner->port;
+    shardRingFree(&ring);
+    return;
   }
 
-  // Set port and IP the same as server-side:
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(PORT_NUMBER);
-  char *ip_address = getConfig("IP_ADDRESS");
-  if (ip_address == NULL)
+  if (tunables->ip_address[0] == '\0')
   {
     errorMsg("Unable to retrieve IP address from .config");
   }
-  server_addr.sin_addr.s_addr = inet_addr(ip_address);
+  snprintf(ip, size, "%s", tunables->ip_address);
+  *port = tunables->port;
+
+  const char *read_replicas = getConfig("READ_REPLICAS");
+  if (read_replicas == NULL || pin_primary ||
+      (strcmp(action, "GET") != 0 && strcmp(action, "MGET") != 0 && strcmp(action, "LS") != 0 &&
+       strcmp(action, "LIST") != 0 && strcmp(action, "DIFF") != 0))
+  {
+    return;
+  }
+  char replicas[strlen(read_replicas) + 1];
+  strcpy(replicas, read_replicas);
+
+  // Pick one of the n replicas, or the primary (index n)
+  int n = 1;
+  for (char *p = replicas; *p != '\0'; p++)
+  {
+    n += *p == ',';
+  }
+  srand((unsigned int)(time(NULL) ^ getpid()));
+  int pick = rand() % (n + 1);
+  char *save_ptr;
+  char *endpoint = strtok_r(replicas, ",", &save_ptr);
+  for (int i = 0; endpoint != NULL && i < pick; i++)
+  {
+    endpoint = strtok_r(NULL, ",", &save_ptr);
+  }
+  if (endpoint != NULL && !parseEndpoint(endpoint, ip, size, port, tunables->port))
+  {
+    errorMsg("Invalid endpoint in READ_REPLICAS");
+  }
+}
+
+// Function: create a socket and send action to server
+// remote_path routes the request to its shard; NULL addresses the primary
+int socketGenerator(const char *action, const char *remote_path)
+{
+  char ip_address[64];
+  int port;
+  chooseEndpoint(action, remote_path, ip_address, sizeof(ip_address), &port);
 
   // Send connection request to server:
-  if (connect(socket_desc, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+  int socket_desc = connectEndpoint(ip_address, port);
+  if (socket_desc < 0)
   {
     errorMsg("Unable to connect");
   }
@@ -83,24 +149,16 @@ void operateWrite(const char *local_file, const char *remote_file)
   }
 
   // Create a socket
-  int sockD = socketGenerator("WRITE");
+  int sockD = socketGenerator("WRITE", remote_file);
   if (!sendText(sockD, remote_file))
   {
     exit(EXIT_FAILURE);
   }
 
-  // Read from the local file and write to the remote file
-  char buffer[MAX_BUFFER_SIZE];
-  size_t bytesRead = fread(buffer, 1, sizeof(buffer), filePointer);
-  if (bytesRead == 0)
-  {
-    errorMsg("Error reading data from local file");
-  }
-
-  buffer[bytesRead] = '\0';
-  if (!sendText(sockD, buffer))
+  // Stream the local file to the remote file
+  if (!sendFileData(sockD, filePointer))
   {
-    exit(EXIT_FAILURE);
+    errorMsg("Error sending data to server");
   }
 
   // Display the response from the server
@@ -111,18 +169,47 @@ void operateWrite(const char *local_file, const char *remote_file)
   close(sockD);
 }
 
-// Function: get operation from the client side
-void operateGet(const char *local_file, const char *remote_file, int ver)
+// Function: APPEND or PATCH from the client side
+// Only the local file's bytes travel: the server adds them at the end of the
+// latest version (APPEND), or writes them over it from offset on (PATCH).
+void operateDelta(const char *action, const char *local_file, const char *remote_file, long long offset)
 {
-  // Open local file
-  FILE *filePointer = fopen(local_file, "w");
+  FILE *filePointer = fopen(local_file, "r");
   if (filePointer == NULL)
   {
-    errorMsg("Error opening local file for writing");
+    errorMsg("Error opening local file for reading");
+  }
+
+  int sockD = socketGenerator(action, remote_file);
+  if (!sendText(sockD, remote_file))
+  {
+    exit(EXIT_FAILURE);
+  }
+  if (strcmp(action, "PATCH") == 0 && !sendAll(sockD, &offset, sizeof(offset)))
+  {
+    errorMsg("Error sending patch offset to server");
+  }
+  if (!sendFileData(sockD, filePointer))
+  {
+    errorMsg("Error sending data to server");
   }
 
+  getResponse(sockD);
+  fclose(filePointer);
+  close(sockD);
+}
+
+// Function: get operation from the client side
+// The newest cached copy of the requested version is offered to the server,
+// which answers "not modified" or streams the new bytes.
+// With ver == GET_VERSION_AT_TIME the server picks the version current at time at.
+void operateGet(const char *local_file, const char *remote_file, int ver, long long at)
+{
+  cacheEntry cached;
+  int has_cached = cacheLookup(remote_file, ver, &cached);
+
   // Create a socket
-  int sockD = socketGenerator("GET");
+  int sockD = socketGenerator("GET", remote_file);
 
   // Send remote file path
   if (!sendText(sockD, remote_file))
@@ -131,40 +218,458 @@ void operateGet(const char *local_file, const char *remote_file, int ver)
   }
 
   // Send version number       
-  if (send(sockD, &ver, sizeof(ver), 0) < 0) 
+  if (!sendAll(sockD, &ver, sizeof(ver)))
   {
     errorMsg("Error sending version number");
   }
+  if (ver == GET_VERSION_AT_TIME && !sendAll(sockD, &at, sizeof(at)))
+  {
+    errorMsg("Error sending snapshot time");
+  }
+
+  // Send the checksum of what we already have
+  if (!sendText(sockD, has_cached ? cached.checksum : NO_CHECKSUM))
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  int status;
+  if (!recvAll(sockD, &status, sizeof(status)))
+  {
+    errorMsg("Error receiving GET status");
+  }
+  if (status == GET_STATUS_ERROR)
+  {
+    char *error;
+    if (receiveText(sockD, &error))
+    {
+      fprintf(stderr, "%s\n", error);
+    }
+    exit(EXIT_FAILURE);
+  }
+
+  // Version and checksum the server resolved the request to
+  int version;
+  char *checksum;
+  if (!recvAll(sockD, &version, sizeof(version)) || !receiveText(sockD, &checksum))
+  {
+    errorMsg("Error receiving version information");
+  }
 
-  // Receive data from the server to save
-  char *buffer;
-  int len = receiveText(sockD, &buffer);
-  if (len)
+  if (status == GET_STATUS_NOT_MODIFIED)
   {
-    if (strncmp(buffer, "Error", strlen("Error")) == 0)
+    // Serve from the cache, and remember it under the resolved version as well
+    if (!cacheCopy(&cached, local_file))
+    {
+      errorMsg("Error copying cached file");
+    }
+    if (cached.version != version)
     {
-      errorMsg(buffer);
+      cacheStore(remote_file, version, checksum, local_file);
     }
-    fwrite(buffer, 1, len, filePointer);
   }
   else
   {
-    exit(EXIT_FAILURE);
+    // Receive data from the server to save
+    FILE *filePointer = fopen(local_file, "w");
+    if (filePointer == NULL)
+    {
+      errorMsg("Error opening local file for writing");
+    }
+    if (receiveFileData(sockD, filePointer) < 0)
+    {
+      exit(EXIT_FAILURE);
+    }
+    fclose(filePointer);
+    cacheStore(remote_file, version, checksum, local_file);
   }
 
   // Display the response from the server
   getResponse(sockD);
 
-  // Close file and socket
-  fclose(filePointer);
+  // Close socket and free memory
+  free(checksum);
+  close(sockD);
+}
+
+// Runs one multi-file request against one server, returns the number of failed items
+typedef int (*multiRunner)(const char *ip, int port, const char *folder, char *items[], int count);
+
+// Helper function:
+// Run a multi-file action once per server: with SHARDS every shard gets the
+// items whose remote path (routes[i]) it owns, otherwise all of them go to
+// the endpoint chooseEndpoint picks. Returns the number of failed items.
+int runPerServer(const char *action, multiRunner runner, const char *folder, char *items[], char *routes[], int count)
+{
+  const rfsConfig *tunables = getTunables();
+  const char *shards = getConfig("SHARDS");
+  if (shards == NULL)
+  {
+    char ip_address[64];
+    int port;
+    chooseEndpoint(action, NULL, ip_address, sizeof(ip_address), &port);
+    return runner(ip_address, port, folder, items, count);
+  }
+
+  shardRing ring;
+  if (!shardRingLoad(&ring, shards, tunables->shard_vnodes, tunables->port))
+  {
+    errorMsg("Invalid SHARDS in .config");
+  }
+  char **subset = (char **)malloc((count + 1) * sizeof(char *));
+  if (subset == NULL)
+  {
+    errorMsg("Error allocating memory");
+  }
+  int failures = 0;
+  for (int e = 0; e < ring.endpoint_count; e++)
+  {
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+      if (shardLookup(&ring, routes[i]) == e)
+      {
+        subset[n++] = items[i];
+      }
+    }
+    if (n > 0)
+    {
+      failures += runner(ring.endpoints[e].ip, ring.endpoints[e].port, folder, subset, n);
+    }
+  }
+  free(subset);
+  shardRingFree(&ring);
+  return failures;
+}
+
+// Helper function:
+// Open a connection to ip:port and send the action, like socketGenerator
+int connectAction(const char *ip, int port, const char *action)
+{
+  int sockD = connectEndpoint(ip, port);
+  if (sockD < 0)
+  {
+    errorMsg("Unable to connect");
+  }
+  if (!sendText(sockD, action))
+  {
+    exit(EXIT_FAILURE);
+  }
+  return sockD;
+}
+
+// Helper function:
+// One MGET round trip: send every path with the checksum of its cached copy,
+// then save the replies into local_dir as they stream back
+int multiGetRound(const char *ip, int port, const char *local_dir, char *remote_paths[], int count)
+{
+  cacheEntry *cached = (cacheEntry *)calloc(count + 1, sizeof(cacheEntry));
+  int *has_cached = (int *)calloc(count + 1, sizeof(int));
+  if (cached == NULL || has_cached == NULL)
+  {
+    errorMsg("Error allocating memory");
+  }
+
+  int sockD = connectAction(ip, port, "MGET");
+  if (!sendAll(sockD, &count, sizeof(count)))
+  {
+    errorMsg("Error sending MGET request");
+  }
+  for (int i = 0; i < count; i++)
+  {
+    has_cached[i] = cacheLookup(remote_paths[i], -1, &cached[i]);
+    if (!sendText(sockD, remote_paths[i]) || !sendText(sockD, has_cached[i] ? cached[i].checksum : NO_CHECKSUM))
+    {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  int failures = 0;
+  for (int k = 0; k < count; k++)
+  {
+    int index, status;
+    if (!recvAll(sockD, &index, sizeof(index)) || !recvAll(sockD, &status, sizeof(status)) ||
+        index < 0 || index >= count)
+    {
+      errorMsg("Error receiving MGET reply");
+    }
+    const char *remote_file = remote_paths[index];
+    if (status == GET_STATUS_ERROR)
+    {
+      char *error;
+      if (!receiveText(sockD, &error))
+      {
+        exit(EXIT_FAILURE);
+      }
+      fprintf(stderr, "%s: %s\n", remote_file, error);
+      free(error);
+      failures++;
+      continue;
+    }
+
+    int version;
+    char *checksum;
+    if (!recvAll(sockD, &version, sizeof(version)) || !receiveText(sockD, &checksum))
+    {
+      errorMsg("Error receiving version information");
+    }
+    char local_file[strlen(local_dir) + strlen(remote_file) + 2];
+    sprintf(local_file, "%s/%s", local_dir, remote_file);
+    makeParentDirs(local_file);
+
+    if (status == GET_STATUS_NOT_MODIFIED)
+    {
+      if (!cacheCopy(&cached[index], local_file))
+      {
+        errorMsg("Error copying cached file");
+      }
+      if (cached[index].version != version)
+      {
+        cacheStore(remote_file, version, checksum, local_file);
+      }
+    }
+    else
+    {
+      FILE *filePointer = fopen(local_file, "w");
+      if (filePointer == NULL)
+      {
+        errorMsg("Error opening local file for writing");
+      }
+      if (receiveFileData(sockD, filePointer) < 0)
+      {
+        exit(EXIT_FAILURE);
+      }
+      fclose(filePointer);
+      cacheStore(remote_file, version, checksum, local_file);
+    }
+    printf("%s: v%d %s\n", remote_file, version, status == GET_STATUS_NOT_MODIFIED ? "from cache" : "received");
+    free(checksum);
+  }
+
+  getResponse(sockD);
   close(sockD);
+  free(cached);
+  free(has_cached);
+  return failures;
+}
+
+// Helper function:
+// The MGET round trips to one server, MGET_MAX paths at most each
+int runMultiGet(const char *ip, int port, const char *local_dir, char *remote_paths[], int count)
+{
+  int round_max = getTunables()->mget_max;
+  int failures = 0;
+  for (int start = 0; start < count; start += round_max)
+  {
+    int n = count - start < round_max ? count - start : round_max;
+    failures += multiGetRound(ip, port, local_dir, remote_paths + start, n);
+  }
+  return failures;
+}
+
+// Helper function:
+// Read newline-separated paths from stdin when none are given on the command line
+char **readPathList(int *count)
+{
+  char **paths = NULL;
+  int capacity = 0;
+  char line[CACHE_PATH_SIZE];
+  *count = 0;
+  while (fgets(line, sizeof(line), stdin))
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0')
+    {
+      continue;
+    }
+    if (*count == capacity)
+    {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      paths = (char **)realloc(paths, capacity * sizeof(char *));
+      if (paths == NULL)
+      {
+        errorMsg("Error allocating memory");
+      }
+    }
+    paths[(*count)++] = strdup(line);
+  }
+  return paths;
+}
+
+// Function: multi-get operation from the client side
+// Fetch the latest version of every remote path into local_dir, with one
+// round trip per server for up to MGET_MAX paths. Paths are read from stdin
+// when none are given.
+void operateMultiGet(const char *local_dir, char *remote_paths[], int count)
+{
+  if (count == 0)
+  {
+    remote_paths = readPathList(&count);
+  }
+  if (count == 0)
+  {
+    errorMsg("No remote file paths given");
+  }
+  int failures = runPerServer("MGET", runMultiGet, local_dir, remote_paths, remote_paths, count);
+  printf("Fetched %d of %d file(s) into '%s'\n", count - failures, count, local_dir);
+  if (failures > 0)
+  {
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Files of one MWRITE connection, streamed by a sender thread while the
+// main thread reads the per-item replies
+typedef struct
+{
+  int sockD;
+  const char *remote_dir;
+  char **local_files;
+  int count;
+} mwriteStream;
+
+// Helper function:
+// Remote path of a local file in an MWRITE: remote_dir/<file name>, or
+// remote_dir/<path below sync_root> during a SYNC
+void multiWriteTarget(char *remote_file, const char *remote_dir, const char *local_file)
+{
+  if (sync_root != NULL)
+  {
+    sprintf(remote_file, "%s/%s", remote_dir, local_file + strlen(sync_root) + 1);
+    return;
+  }
+  const char *slash = strrchr(local_file, '/');
+  sprintf(remote_file, "%s/%s", remote_dir, slash == NULL ? local_file : slash + 1);
+}
+
+// Functions: MWRITE sender thread
+void *multiWriteSender(void *arg)
+{
+  mwriteStream *stream = (mwriteStream *)arg;
+  if (!sendAll(stream->sockD, &stream->count, sizeof(stream->count)))
+  {
+    return NULL;
+  }
+  for (int i = 0; i < stream->count; i++)
+  {
+    char remote_file[strlen(stream->remote_dir) + strlen(stream->local_files[i]) + 2];
+    multiWriteTarget(remote_file, stream->remote_dir, stream->local_files[i]);
+    FILE *filePointer = fopen(stream->local_files[i], "r");
+    if (filePointer == NULL || !sendText(stream->sockD, remote_file) || !sendFileData(stream->sockD, filePointer))
+    {
+      perror("Error sending file to server");
+      if (filePointer != NULL)
+      {
+        fclose(filePointer);
+      }
+      shutdown(stream->sockD, SHUT_WR);
+      return NULL;
+    }
+    fclose(filePointer);
+  }
+  return NULL;
+}
+
+// Helper function:
+// One MWRITE round trip to one server
+int runMultiWrite(const char *ip, int port, const char *remote_dir, char *local_files[], int count)
+{
+  mwriteStream stream = {connectAction(ip, port, "MWRITE"), remote_dir, local_files, count};
+  pthread_t sender_tid;
+  if (pthread_create(&sender_tid, NULL, multiWriteSender, &stream) != 0)
+  {
+    errorMsg("Fail to create sender thread");
+  }
+
+  int failures = 0;
+  int replies = 0;
+  for (; replies < count; replies++)
+  {
+    int index, status;
+    char *message;
+    if (!recvAll(stream.sockD, &index, sizeof(index)) || !recvAll(stream.sockD, &status, sizeof(status)) ||
+        index < 0 || index >= count || !receiveText(stream.sockD, &message))
+    {
+      break;
+    }
+    if (status == MWRITE_STATUS_STORED)
+    {
+      printf("%s: %s\n", local_files[index], message);
+    }
+    else
+    {
+      fprintf(stderr, "%s: %s\n", local_files[index], message);
+      failures++;
+    }
+    free(message);
+  }
+  pthread_join(sender_tid, NULL);
+  if (replies < count)
+  {
+    fprintf(stderr, "Connection lost after %d of %d file(s)\n", replies, count);
+    failures += count - replies;
+  }
+  else
+  {
+    getResponse(stream.sockD);
+  }
+  close(stream.sockD);
+  return failures;
+}
+
+// Function: multi-write operation from the client side
+// Store every local file as remote_dir/<file name>, with one round trip per server.
+// Files are read from stdin when none are given.
+void operateMultiWrite(const char *remote_dir, char *local_files[], int count)
+{
+  if (count == 0)
+  {
+    local_files = readPathList(&count);
+  }
+  if (count == 0)
+  {
+    errorMsg("No local files given");
+  }
+
+  // Every file must be readable before the stream starts
+  char **routes = (char **)malloc(count * sizeof(char *));
+  if (routes == NULL)
+  {
+    errorMsg("Error allocating memory");
+  }
+  for (int i = 0; i < count; i++)
+  {
+    if (!isValidFile(local_files[i]))
+    {
+      fprintf(stderr, "%s: ", local_files[i]);
+      errorMsg("Error opening local file for reading");
+    }
+    routes[i] = (char *)malloc(strlen(remote_dir) + strlen(local_files[i]) + 2);
+    if (routes[i] == NULL)
+    {
+      errorMsg("Error allocating memory");
+    }
+    multiWriteTarget(routes[i], remote_dir, local_files[i]);
+  }
+
+  int failures = runPerServer("MWRITE", runMultiWrite, remote_dir, local_files, routes, count);
+  printf("Stored %d of %d file(s) in '%s'\n", count - failures, count, remote_dir);
+  for (int i = 0; i < count; i++)
+  {
+    free(routes[i]);
+  }
+  free(routes);
+  if (failures > 0)
+  {
+    exit(EXIT_FAILURE);
+  }
 }
 
 // Function: remove operation from the client side
 void operateRemove(const char *remote_path)
 {
   // Create a socket
-  int sockD = socketGenerator("RM");
+  int sockD = socketGenerator("RM", remote_path);
   if (!sendText(sockD, remote_path))
   {
     exit(EXIT_FAILURE);
@@ -181,7 +686,7 @@ void operateRemove(const char *remote_path)
 void operateList(const char *remote_file, const char *record_address)
 {
   // Create a socket
-  int sockD = socketGenerator("LS");
+  int sockD = socketGenerator("LS", remote_file);
   if (!sendText(sockD, remote_file))
   {
     exit(EXIT_FAILURE);
@@ -216,29 +721,1120 @@ void operateList(const char *remote_file, const char *record_address)
   close(sockD);
 }
 
-// Function: send a EXIT signal to the server
-void operateExit()
+// One line of a LIST reply: a stored file, or a folder with the sums below it
+typedef struct
 {
-  // Create a socket
-  int sockD = socketGenerator("EXIT");
-
-  // Receive a request response
-  getResponse(sockD);
+  char kind; // 'F', 'D', or 'M' for a file of a manifest
+  long files;
+  long versions;
+  long long bytes;
+  char *name;
+  char checksum[CHECKSUM_SIZE]; // of the latest version, manifests only
+} listEntry;
 
-  // Close socket
-  close(sockD);
-}
-
-int main(int argc, char *argv[])
+// Helper function:
+// Fetch the listing of one server and append its entries
+void fetchListing(const char *ip, int port, int mode, const char *prefix, listEntry **entries, int *count,
+                  int *capacity)
 {
-  // Validate arguments
-  if (argc < 2)
+  int sockD = connectAction(ip, port, "LIST");
+  int status;
+  size_t size;
+  if (!sendAll(sockD, &mode, sizeof(mode)) || !sendText(sockD, prefix) || !recvAll(sockD, &status, sizeof(status)))
   {
-    errorMsg("Insufficient arguments");
+    errorMsg("Error requesting the listing");
   }
-  char *action = argv[1];
+  if (status == GET_STATUS_ERROR)
+  {
+    getResponse(sockD);
+    close(sockD);
+    exit(EXIT_FAILURE);
+  }
+  char *listing = NULL;
+  if (!recvAll(sockD, &size, sizeof(size)) || (listing = (char *)malloc(size + 1)) == NULL ||
+      (size > 0 && !recvAll(sockD, listing, size)))
+  {
+    errorMsg("Error receiving the listing");
+  }
+  listing[size] = '\0';
+  close(sockD);
 
-  if (strcmp(action, "WRITE") == 0) // Question 1
+  char *save_ptr;
+  for (char *line = strtok_r(listing, "\n", &save_ptr); line != NULL; line = strtok_r(NULL, "\n", &save_ptr))
+  {
+    listEntry entry = {line[0], 1, 0, 0, NULL, NO_CHECKSUM};
+    int name_at = 0;
+    int parsed = entry.kind == 'F'   ? sscanf(line, "F %ld %lld %n", &entry.versions, &entry.bytes, &name_at) == 2
+                 : entry.kind == 'M' ? sscanf(line, "M %ld %lld %16s %n", &entry.versions, &entry.bytes,
+                                              entry.checksum, &name_at) == 3
+                                     : sscanf(line, "D %ld %ld %lld %n", &entry.files, &entry.versions,
+                                              &entry.bytes, &name_at) == 3;
+    if (!parsed || name_at == 0)
+    {
+      continue;
+    }
+    if (*count == *capacity)
+    {
+      *capacity = *capacity == 0 ? 64 : *capacity * 2;
+      *entries = (listEntry *)realloc(*entries, *capacity * sizeof(listEntry));
+      if (*entries == NULL)
+      {
+        errorMsg("Error allocating memory");
+      }
+    }
+    entry.name = strdup(line + name_at);
+    (*entries)[(*count)++] = entry;
+  }
+  free(listing);
+}
+
+// Helper function:
+// Order listing entries by name, for qsort
+int compareListEntries(const void *a, const void *b)
+{
+  return strcmp(((const listEntry *)a)->name, ((const listEntry *)b)->name);
+}
+
+// Helper function:
+// Fetch a listing from the server, or from every shard with SHARDS, sorted by name
+listEntry *fetchAllListings(int mode, const char *prefix, int *count)
+{
+  listEntry *entries = NULL;
+  int capacity = 0;
+  *count = 0;
+  const char *shards = getConfig("SHARDS");
+  if (shards == NULL)
+  {
+    char ip_address[64];
+    int port;
+    chooseEndpoint("LIST", NULL, ip_address, sizeof(ip_address), &port);
+    fetchListing(ip_address, port, mode, prefix, &entries, count, &capacity);
+  }
+  else
+  {
+    shardRing ring;
+    if (!shardRingLoad(&ring, shards, getTunables()->shard_vnodes, getTunables()->port))
+    {
+      errorMsg("Invalid SHARDS in .config");
+    }
+    for (int e = 0; e < ring.endpoint_count; e++)
+    {
+      fetchListing(ring.endpoints[e].ip, ring.endpoints[e].port, mode, prefix, &entries, count, &capacity);
+    }
+    shardRingFree(&ring);
+  }
+  qsort(entries, *count, sizeof(listEntry), compareListEntries);
+  return entries;
+}
+
+// Function: list a remote folder (LIST_MODE_FOLDER, "/" for the top) or every
+// remote path with a prefix (LIST_MODE_PREFIX), with version counts and sizes
+// With SHARDS every shard is asked, and a folder spread over several shards is
+// reported once with the sums of all of them.
+void operateListing(int mode, const char *prefix)
+{
+  int count;
+  listEntry *entries = fetchAllListings(mode, prefix, &count);
+
+  // Merge what several shards reported under the same name
+  int merged = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (merged > 0 && strcmp(entries[merged - 1].name, entries[i].name) == 0)
+    {
+      entries[merged - 1].files += entries[i].files;
+      entries[merged - 1].versions += entries[i].versions;
+      entries[merged - 1].bytes += entries[i].bytes;
+      free(entries[i].name);
+      continue;
+    }
+    entries[merged++] = entries[i];
+  }
+
+  printf("%s %s:\n", mode == LIST_MODE_FOLDER ? "Folder" : "Paths starting with", prefix);
+  long files = 0, versions = 0;
+  long long bytes = 0;
+  for (int i = 0; i < merged; i++)
+  {
+    if (entries[i].kind == 'D')
+    {
+      printf("  %-40s %ld file(s), %ld version(s), %lld byte(s)\n", entries[i].name, entries[i].files,
+             entries[i].versions, entries[i].bytes);
+    }
+    else
+    {
+      printf("  %-40s %ld version(s), %lld byte(s)\n", entries[i].name, entries[i].versions, entries[i].bytes);
+    }
+    files += entries[i].files;
+    versions += entries[i].versions;
+    bytes += entries[i].bytes;
+    free(entries[i].name);
+  }
+  printf("Total: %ld file(s), %ld version(s), %lld byte(s)\n", files, versions, bytes);
+  free(entries);
+}
+
+// One local file of a SYNC, with what was last seen of it
+typedef struct
+{
+  char *path; // below the local folder
+  long long size;
+  long long mtime_ns;
+  char checksum[CHECKSUM_SIZE];
+} syncEntry;
+
+// Helper function:
+// Order SYNC entries by path, for qsort and bsearch
+int compareSyncEntries(const void *a, const void *b)
+{
+  return strcmp(((const syncEntry *)a)->path, ((const syncEntry *)b)->path);
+}
+
+// Helper function:
+// Append an entry to a growing array of SYNC entries
+void addSyncEntry(syncEntry **entries, int *count, int *capacity, const syncEntry *entry)
+{
+  if (*count == *capacity)
+  {
+    *capacity = *capacity == 0 ? 256 : *capacity * 2;
+    *entries = (syncEntry *)realloc(*entries, *capacity * sizeof(syncEntry));
+    if (*entries == NULL)
+    {
+      errorMsg("Error allocating memory");
+    }
+  }
+  (*entries)[(*count)++] = *entry;
+}
+
+// Helper function:
+// Collect the regular files below root/relative ("" for root itself)
+void collectSyncFiles(const char *root, const char *relative, syncEntry **entries, int *count, int *capacity)
+{
+  char folder[strlen(root) + strlen(relative) + 2];
+  sprintf(folder, relative[0] == '\0' ? "%s" : "%s/%s", root, relative);
+  DIR *dir = opendir(folder);
+  if (dir == NULL)
+  {
+    perror(folder);
+    return;
+  }
+  struct dirent *item;
+  while ((item = readdir(dir)) != NULL)
+  {
+    if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0 ||
+        (relative[0] == '\0' && strcmp(item->d_name, SYNC_MANIFEST) == 0))
+    {
+      continue;
+    }
+    char path[strlen(relative) + strlen(item->d_name) + 2];
+    sprintf(path, relative[0] == '\0' ? "%s%s" : "%s/%s", relative, item->d_name);
+    char local_file[strlen(root) + sizeof(path) + 1];
+    sprintf(local_file, "%s/%s", root, path);
+    struct stat file_stat;
+    if (lstat(local_file, &file_stat) != 0)
+    {
+      continue;
+    }
+    if (S_ISDIR(file_stat.st_mode))
+    {
+      collectSyncFiles(root, path, entries, count, capacity);
+    }
+    else if (S_ISREG(file_stat.st_mode))
+    {
+      syncEntry entry = {strdup(path), file_stat.st_size,
+                         file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec, NO_CHECKSUM};
+      if (entry.path == NULL)
+      {
+        errorMsg("Error allocating memory");
+      }
+      addSyncEntry(entries, count, capacity, &entry);
+    }
+  }
+  closedir(dir);
+}
+
+// Helper function:
+// Load the manifest the last SYNC of a local folder left in it, sorted by path
+// Lines are "<size> <mtime ns> <checksum> <path>".
+syncEntry *loadSyncManifest(const char *root, int *count)
+{
+  syncEntry *entries = NULL;
+  int capacity = 0;
+  *count = 0;
+  char manifest[strlen(root) + sizeof(SYNC_MANIFEST) + 1];
+  sprintf(manifest, "%s/%s", root, SYNC_MANIFEST);
+  FILE *filePointer = fopen(manifest, "r");
+  if (filePointer == NULL)
+  {
+    return NULL;
+  }
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_size, filePointer)) > 0)
+  {
+    if (line[len - 1] == '\n')
+    {
+      line[len - 1] = '\0';
+    }
+    syncEntry entry;
+    int path_at = 0;
+    if (sscanf(line, "%lld %lld %16s %n", &entry.size, &entry.mtime_ns, entry.checksum, &path_at) != 3 ||
+        path_at == 0 || (entry.path = strdup(line + path_at)) == NULL)
+    {
+      continue;
+    }
+    addSyncEntry(&entries, count, &capacity, &entry);
+  }
+  free(line);
+  fclose(filePointer);
+  qsort(entries, *count, sizeof(syncEntry), compareSyncEntries);
+  return entries;
+}
+
+// Helper function:
+// Replace the manifest of a local folder with the files just synced
+void saveSyncManifest(const char *root, const syncEntry *entries, int count)
+{
+  char manifest[strlen(root) + sizeof(SYNC_MANIFEST) + 1];
+  char temp_name[sizeof(manifest) + 4];
+  sprintf(manifest, "%s/%s", root, SYNC_MANIFEST);
+  sprintf(temp_name, "%s.tmp", manifest);
+  FILE *filePointer = fopen(temp_name, "w");
+  if (filePointer == NULL)
+  {
+    perror("Error writing the sync manifest");
+    return;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    fprintf(filePointer, "%lld %lld %s %s\n", entries[i].size, entries[i].mtime_ns, entries[i].checksum,
+            entries[i].path);
+  }
+  if (fclose(filePointer) != 0 || rename(temp_name, manifest) != 0)
+  {
+    perror("Error writing the sync manifest");
+    remove(temp_name);
+  }
+}
+
+// Helper function:
+// Length of the folder part of a path, up to its last '/'
+size_t folderLength(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  return slash == NULL ? 0 : (size_t)(slash - path);
+}
+
+// Helper function:
+// Order local files by their folder first, so each folder's files are contiguous
+int compareByFolder(const void *a, const void *b)
+{
+  const char *first = *(char *const *)a, *second = *(char *const *)b;
+  size_t first_len = folderLength(first), second_len = folderLength(second);
+  int order = strncmp(first, second, first_len < second_len ? first_len : second_len);
+  if (order != 0 || first_len == second_len)
+  {
+    return order != 0 ? order : strcmp(first, second);
+  }
+  return first_len < second_len ? -1 : 1;
+}
+
+// One MWRITE connection of a SYNC upload
+typedef struct
+{
+  const char *ip;
+  int port;
+  const char *remote_dir;
+  char **local_files;
+  int count;
+  int failures;
+} syncStream;
+
+// Functions: SYNC upload thread
+void *syncUploader(void *arg)
+{
+  syncStream *stream = (syncStream *)arg;
+  stream->failures = runMultiWrite(stream->ip, stream->port, stream->remote_dir, stream->local_files, stream->count);
+  return NULL;
+}
+
+// Helper function:
+// Upload files to one server over SYNC_STREAMS parallel MWRITE connections
+// The server locks a whole folder while it writes into it, so all files of a
+// folder go through the same connection; folders are spread by file count.
+int runSyncUploads(const char *ip, int port, const char *remote_dir, char *local_files[], int count)
+{
+  int streams = getTunables()->sync_streams < count ? getTunables()->sync_streams : count;
+  syncStream *stream = (syncStream *)calloc(streams, sizeof(syncStream));
+  pthread_t *tids = (pthread_t *)calloc(streams, sizeof(pthread_t));
+  char **ordered = (char **)malloc(count * sizeof(char *));
+  if (stream == NULL || tids == NULL || ordered == NULL)
+  {
+    errorMsg("Error allocating memory");
+  }
+  qsort(local_files, count, sizeof(char *), compareByFolder);
+
+  // Hand each folder to the connection with the fewest files so far, then
+  // lay the files out connection by connection
+  int *owner = (int *)malloc(count * sizeof(int));
+  if (owner == NULL)
+  {
+    errorMsg("Error allocating memory");
+  }
+  for (int i = 0; i < count;)
+  {
+    size_t len = folderLength(local_files[i]);
+    int end = i + 1;
+    while (end < count && folderLength(local_files[end]) == len && strncmp(local_files[end], local_files[i], len) == 0)
+    {
+      end++;
+    }
+    int least = 0;
+    for (int s = 1; s < streams; s++)
+    {
+      least = stream[s].count < stream[least].count ? s : least;
+    }
+    stream[least].count += end - i;
+    for (; i < end; i++)
+    {
+      owner[i] = least;
+    }
+  }
+  int placed = 0;
+  for (int s = 0; s < streams; s++)
+  {
+    stream[s] = (syncStream){ip, port, remote_dir, ordered + placed, 0, 0};
+    for (int i = 0; i < count; i++)
+    {
+      if (owner[i] == s)
+      {
+        ordered[placed + stream[s].count++] = local_files[i];
+      }
+    }
+    placed += stream[s].count;
+  }
+  free(owner);
+
+  int failures = 0;
+  int started = 0;
+  for (; started < streams && stream[started].count > 0; started++)
+  {
+    if (pthread_create(&tids[started], NULL, syncUploader, &stream[started]) != 0)
+    {
+      errorMsg("Fail to create upload thread");
+    }
+  }
+  for (int s = 0; s < started; s++)
+  {
+    pthread_join(tids[s], NULL);
+    failures += stream[s].failures;
+  }
+  free(ordered);
+  free(tids);
+  free(stream);
+  return failures;
+}
+
+// Function: sync operation from the client side
+// Mirror a local folder below a remote folder, uploading only the files whose
+// size or checksum differs from the latest version the server holds. Checksums
+// of files unchanged since the last SYNC (same size and modification time) are
+// taken from the manifest it left in the local folder. Remote files missing
+// locally are kept.
+void operateSync(const char *local_dir, const char *remote_dir)
+{
+  // Local files, with the checksums of unchanged ones reused
+  char root[strlen(local_dir) + 1];
+  strcpy(root, local_dir);
+  for (size_t len = strlen(root); len > 1 && root[len - 1] == '/'; len--)
+  {
+    root[len - 1] = '\0';
+  }
+  syncEntry *local = NULL;
+  int local_count = 0, capacity = 0;
+  collectSyncFiles(root, "", &local, &local_count, &capacity);
+  qsort(local, local_count, sizeof(syncEntry), compareSyncEntries);
+  int known_count;
+  syncEntry *known = loadSyncManifest(root, &known_count);
+  int hashed = 0;
+  for (int i = 0; i < local_count; i++)
+  {
+    syncEntry *seen = known_count == 0 ? NULL
+                                       : (syncEntry *)bsearch(&local[i], known, known_count, sizeof(syncEntry),
+                                                              compareSyncEntries);
+    if (seen != NULL && seen->size == local[i].size && seen->mtime_ns == local[i].mtime_ns)
+    {
+      strcpy(local[i].checksum, seen->checksum);
+      continue;
+    }
+    char local_file[strlen(root) + strlen(local[i].path) + 2];
+    sprintf(local_file, "%s/%s", root, local[i].path);
+    if (!fileChecksum(local_file, local[i].checksum))
+    {
+      strcpy(local[i].checksum, NO_CHECKSUM);
+    }
+    hashed++;
+  }
+  for (int i = 0; i < known_count; i++)
+  {
+    free(known[i].path);
+  }
+  free(known);
+
+  // What the server holds below the remote folder, in one exchange (per shard);
+  // replicas may trail, so the primary is asked
+  pin_primary = 1;
+  size_t remote_len = strlen(remote_dir);
+  while (remote_len > 1 && remote_dir[remote_len - 1] == '/')
+  {
+    remote_len--;
+  }
+  char prefix[remote_len + 2];
+  sprintf(prefix, "%.*s/", (int)remote_len, remote_dir);
+  int remote_count;
+  listEntry *remote = fetchAllListings(LIST_MODE_MANIFEST, prefix, &remote_count);
+
+  // Upload whatever is missing or differs
+  char **uploads = (char **)malloc((local_count + 1) * sizeof(char *));
+  char **routes = (char **)malloc((local_count + 1) * sizeof(char *));
+  if (uploads == NULL || routes == NULL)
+  {
+    errorMsg("Error allocating memory");
+  }
+  int changed = 0;
+  for (int i = 0; i < local_count; i++)
+  {
+    char remote_file[strlen(prefix) + strlen(local[i].path) + 1];
+    sprintf(remote_file, "%s%s", prefix, local[i].path);
+    listEntry key = {'M', 0, 0, 0, remote_file, NO_CHECKSUM};
+    listEntry *stored = remote_count == 0 ? NULL
+                                          : (listEntry *)bsearch(&key, remote, remote_count, sizeof(listEntry),
+                                                                 compareListEntries);
+    if (stored != NULL && stored->bytes == local[i].size && strcmp(stored->checksum, local[i].checksum) == 0 &&
+        strcmp(stored->checksum, NO_CHECKSUM) != 0)
+    {
+      continue;
+    }
+    uploads[changed] = (char *)malloc(strlen(root) + strlen(local[i].path) + 2);
+    routes[changed] = strdup(remote_file);
+    if (uploads[changed] == NULL || routes[changed] == NULL)
+    {
+      errorMsg("Error allocating memory");
+    }
+    sprintf(uploads[changed], "%s/%s", root, local[i].path);
+    changed++;
+  }
+  for (int i = 0; i < remote_count; i++)
+  {
+    free(remote[i].name);
+  }
+  free(remote);
+
+  int failures = 0;
+  prefix[remote_len] = '\0';
+  if (changed > 0)
+  {
+    sync_root = root;
+    failures = runPerServer("MWRITE", runSyncUploads, prefix, uploads, routes, changed);
+    sync_root = NULL;
+  }
+  printf("Synced '%s' to '%s': %d of %d changed file(s) stored, %d unchanged, %d checksum(s) computed\n", root,
+         prefix, changed - failures, changed, local_count - changed, hashed);
+
+  saveSyncManifest(root, local, local_count);
+  for (int i = 0; i < changed; i++)
+  {
+    free(uploads[i]);
+    free(routes[i]);
+  }
+  free(uploads);
+  free(routes);
+  for (int i = 0; i < local_count; i++)
+  {
+    free(local[i].path);
+  }
+  free(local);
+  if (failures > 0)
+  {
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Function: delta between two versions of a remote file, computed by the server
+// A line diff or binary delta (mode DIFF_MODE_*) is written to local_file, or to stdout.
+void operateDiff(const char *remote_file, int from, int to, int mode, const char *local_file)
+{
+  int sockD = socketGenerator("DIFF", remote_file);
+  int versions[2] = {from, to};
+  if (!sendText(sockD, remote_file) || !sendAll(sockD, versions, sizeof(versions)) ||
+      !sendAll(sockD, &mode, sizeof(mode)))
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  int status, binary;
+  if (!recvAll(sockD, &status, sizeof(status)))
+  {
+    errorMsg("Error receiving diff status");
+  }
+  if (status == GET_STATUS_ERROR)
+  {
+    getResponse(sockD);
+    close(sockD);
+    exit(EXIT_FAILURE);
+  }
+  size_t len;
+  if (!recvAll(sockD, &binary, sizeof(binary)) || !recvAll(sockD, &len, sizeof(len)))
+  {
+    errorMsg("Error receiving diff");
+  }
+
+  // Only the delta travels; copy it out chunk by chunk
+  FILE *filePointer = local_file == NULL ? stdout : fopen(local_file, "w");
+  if (filePointer == NULL)
+  {
+    errorMsg("Error opening local file for writing");
+  }
+  char buffer[TRANSFER_CHUNK_SIZE];
+  while (len > 0)
+  {
+    size_t want = len < sizeof(buffer) ? len : sizeof(buffer);
+    if (!recvAll(sockD, buffer, want) || fwrite(buffer, 1, want, filePointer) != want)
+    {
+      errorMsg("Error receiving diff");
+    }
+    len -= want;
+  }
+  if (local_file != NULL)
+  {
+    fclose(filePointer);
+    getResponse(sockD);
+  }
+  else
+  {
+    // Keep stdout for the diff itself
+    char *response;
+    if (receiveText(sockD, &response))
+    {
+      fprintf(stderr, "%s\n", response);
+      free(response);
+    }
+  }
+  close(sockD);
+}
+
+// Helper function:
+// Parse a DIFF version: a number, optionally written v3 or -v3, or "latest"
+int parseDiffVersion(const char *text)
+{
+  if (strcmp(text, "latest") == 0)
+  {
+    return -1;
+  }
+  const char *digits = text[0] == '-' && text[1] == 'v' ? text + 2 : text[0] == 'v' ? text + 1 : text;
+  char *end;
+  long version = strtol(digits, &end, 10);
+  if (end == digits || *end != '\0' || version < 0)
+  {
+    errorMsg("Invalid version, expected a number, v<number> or latest");
+  }
+  return (int)version;
+}
+
+// Function: send a EXIT signal to the server
+void operateExit()
+{
+  // Create a socket
+  int sockD = socketGenerator("EXIT", NULL);
+
+  // Receive a request response
+  getResponse(sockD);
+
+  // Close socket
+  close(sockD);
+}
+
+// Function: switch the server's request tracing on or off, or save its
+// recorded spans as Chrome trace JSON into local_file (command "dump")
+void operateTrace(const char *command, const char *local_file)
+{
+  int sockD = socketGenerator("TRACE", NULL);
+  if (!sendText(sockD, command))
+  {
+    close(sockD);
+    exit(EXIT_FAILURE);
+  }
+
+  if (strcmp(command, "dump") == 0)
+  {
+    int ready;
+    if (!recvAll(sockD, &ready, sizeof(ready)))
+    {
+      close(sockD);
+      errorMsg("Error receiving trace dump");
+    }
+    if (ready)
+    {
+      FILE *filePointer = fopen(local_file, "w");
+      if (filePointer == NULL)
+      {
+        close(sockD);
+        errorMsg("Error opening local file for the trace dump");
+      }
+      long len = receiveFileData(sockD, filePointer);
+      fclose(filePointer);
+      if (len < 0)
+      {
+        close(sockD);
+        errorMsg("Error receiving trace dump");
+      }
+    }
+  }
+
+  getResponse(sockD);
+  close(sockD);
+}
+
+// Helper function:
+// Receive one batch of a WATCH subscription and print its events, one line each
+// Returns the number of events, -1 once the server closed the subscription.
+int receiveWatchBatch(int sockD, unsigned long *next)
+{
+  int count;
+  if (!recvAll(sockD, &count, sizeof(count)) || !recvAll(sockD, next, sizeof(*next)))
+  {
+    return -1;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    unsigned long seq;
+    int op, version;
+    char *path;
+    if (!recvAll(sockD, &seq, sizeof(seq)) || !recvAll(sockD, &op, sizeof(op)) ||
+        !recvAll(sockD, &version, sizeof(version)) || !receiveText(sockD, &path))
+    {
+      return -1;
+    }
+    if (op == WATCH_OP_WRITE)
+    {
+      printf("%lu WRITE %s v%d\n", seq, path, version);
+    }
+    else if (op == WATCH_OP_RM)
+    {
+      printf("%lu RM %s\n", seq, path);
+    }
+    else
+    {
+      printf("%lu RESET %s\n", seq, path);
+    }
+    free(path);
+  }
+  fflush(stdout);
+  return count;
+}
+
+// Function: follow the commits on a remote path, a folder (ending in '/') or a
+// prefix (ending in '*'), printing one line per event until limit events came
+// (0 = no limit) or the server ends the subscription
+// from resumes at a sequence number (the last one printed + 1), 0 starts from now.
+void operateWatch(const char *filter, unsigned long from, long limit)
+{
+  size_t len = strlen(filter);
+  int prefix = len > 0 && (filter[len - 1] == '/' || filter[len - 1] == '*');
+  const char *shards = getConfig("SHARDS");
+  struct pollfd *subscriptions;
+  int count = 1;
+  if (shards != NULL && prefix)
+  {
+    // A prefix spans every shard, and each shard numbers its own events
+    shardRing ring;
+    if (!shardRingLoad(&ring, shards, getTunables()->shard_vnodes, getTunables()->port))
+    {
+      errorMsg("Invalid SHARDS in .config");
+    }
+    count = ring.endpoint_count;
+    if (from != 0 && count > 1)
+    {
+      errorMsg("Resuming a prefix WATCH needs a single server");
+    }
+    subscriptions = (struct pollfd *)malloc(count * sizeof(struct pollfd));
+    if (subscriptions == NULL)
+    {
+      errorMsg("Error allocating memory");
+    }
+    for (int i = 0; i < count; i++)
+    {
+      subscriptions[i].fd = connectAction(ring.endpoints[i].ip, ring.endpoints[i].port, "WATCH");
+    }
+    shardRingFree(&ring);
+  }
+  else
+  {
+    subscriptions = (struct pollfd *)malloc(sizeof(struct pollfd));
+    if (subscriptions == NULL)
+    {
+      errorMsg("Error allocating memory");
+    }
+    subscriptions[0].fd = socketGenerator("WATCH", filter);
+  }
+
+  unsigned long next = 0;
+  for (int i = 0; i < count; i++)
+  {
+    subscriptions[i].events = POLLIN;
+    if (!sendText(subscriptions[i].fd, filter) || !sendAll(subscriptions[i].fd, &from, sizeof(from)) ||
+        !recvAll(subscriptions[i].fd, &next, sizeof(next)))
+    {
+      errorMsg("Error starting the watch");
+    }
+    char *reason;
+    if (next == 0 && receiveText(subscriptions[i].fd, &reason))
+    {
+      // Turned down by the server
+      fprintf(stderr, "%s\n", reason);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (count == 1)
+  {
+    printf("Watching %s from sequence %lu\n", filter, next);
+  }
+  else
+  {
+    printf("Watching %s on %d shards\n", filter, count);
+  }
+  fflush(stdout);
+
+  long seen = 0;
+  while (limit == 0 || seen < limit)
+  {
+    if (poll(subscriptions, count, -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      errorMsg("Error waiting for watch events");
+    }
+    for (int i = 0; i < count; i++)
+    {
+      if (subscriptions[i].revents == 0)
+      {
+        continue;
+      }
+      int events = receiveWatchBatch(subscriptions[i].fd, &next);
+      if (events < 0)
+      {
+        if (count == 1)
+        {
+          fprintf(stderr, "Watch ended by the server, resume with -s %lu\n", next);
+        }
+        else
+        {
+          fprintf(stderr, "Watch ended by the server\n");
+        }
+        exit(EXIT_FAILURE);
+      }
+      seen += events;
+    }
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    close(subscriptions[i].fd);
+  }
+  free(subscriptions);
+}
+
+// Helper function:
+// Parse a snapshot time, either "<seconds>[.<fraction>]" since the epoch (as
+// printed by SNAPSHOT) or a local "YYYY-MM-DDTHH:MM:SS" / "YYYY-MM-DD HH:MM:SS".
+// Returns microseconds since the epoch, -1 when invalid.
+long long parseSnapshotTime(const char *text)
+{
+  struct tm when;
+  memset(&when, 0, sizeof(when));
+  const char *end = strptime(text, "%Y-%m-%dT%H:%M:%S", &when);
+  if (end == NULL)
+  {
+    memset(&when, 0, sizeof(when));
+    end = strptime(text, "%Y-%m-%d %H:%M:%S", &when);
+  }
+  if (end != NULL && *end == '\0')
+  {
+    when.tm_isdst = -1;
+    time_t seconds = mktime(&when);
+    return seconds < 0 ? -1 : (long long)seconds * 1000000;
+  }
+
+  char *rest;
+  long long seconds = strtoll(text, &rest, 10);
+  if (rest == text || seconds < 0)
+  {
+    return -1;
+  }
+  long long micros = 0;
+  if (*rest == '.')
+  {
+    int digits = 0;
+    for (rest++; isdigit((unsigned char)*rest); rest++, digits++)
+    {
+      if (digits < 6)
+      {
+        micros = micros * 10 + (*rest - '0');
+      }
+    }
+    for (; digits < 6; digits++)
+    {
+      micros *= 10;
+    }
+  }
+  return *rest == '\0' ? seconds * 1000000 + micros : -1;
+}
+
+// Function: snapshot operation from the client side
+// Without arguments, print a snapshot time from the primary. With a time (or
+// "now") and remote paths, download every path as it was at that time into
+// local_dir, so the files form one consistent state of the store.
+void operateSnapshot(const char *time_text, const char *local_dir, char *remote_paths[], int count)
+{
+  long long at;
+  if (time_text == NULL || strcmp(time_text, "now") == 0)
+  {
+    int sockD = socketGenerator("SNAPSHOT", NULL);
+    char *snapshot;
+    if (!receiveText(sockD, &snapshot))
+    {
+      exit(EXIT_FAILURE);
+    }
+    close(sockD);
+    if (time_text == NULL)
+    {
+      printf("%s\n", snapshot);
+      free(snapshot);
+      return;
+    }
+    at = parseSnapshotTime(snapshot);
+    free(snapshot);
+  }
+  else
+  {
+    at = parseSnapshotTime(time_text);
+  }
+  if (at < 0)
+  {
+    errorMsg("Invalid snapshot time");
+  }
+
+  pin_primary = 1;
+  for (int i = 0; i < count; i++)
+  {
+    char local_file[strlen(local_dir) + strlen(remote_paths[i]) + 2];
+    sprintf(local_file, "%s/%s", local_dir, remote_paths[i]);
+    makeParentDirs(local_file);
+    operateGet(local_file, remote_paths[i], GET_VERSION_AT_TIME, at);
+  }
+  printf("Snapshot %lld.%06lld of %d file(s) saved in '%s'\n", at / 1000000, at % 1000000, count, local_dir);
+}
+
+// Helper function:
+// Download one version of a remote file from a given server into fp
+// Returns 0 when that version does not exist there.
+int fetchVersion(const shardEndpoint *source, const char *remote_file, int ver, FILE *fp)
+{
+  int sockD = connectEndpoint(source->ip, source->port);
+  if (sockD < 0)
+  {
+    errorMsg("Unable to connect to source shard");
+  }
+  int status;
+  if (!sendText(sockD, "GET") || !sendText(sockD, remote_file) ||
+      !sendAll(sockD, &ver, sizeof(ver)) || !sendText(sockD, NO_CHECKSUM) ||
+      !recvAll(sockD, &status, sizeof(status)))
+  {
+    errorMsg("Error requesting version from source shard");
+  }
+
+  int found = status == GET_STATUS_DATA;
+  char *text = NULL;
+  if (found)
+  {
+    int version;
+    if (!recvAll(sockD, &version, sizeof(version)) || !receiveText(sockD, &text))
+    {
+      errorMsg("Error receiving version information");
+    }
+    free(text);
+    if (receiveFileData(sockD, fp) < 0)
+    {
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (receiveText(sockD, &text))
+  {
+    free(text);
+  }
+  close(sockD);
+  return found;
+}
+
+// Helper function:
+// Move every version of a remote file from one shard to another, then
+// remove it from the source. The target installs the versions under their
+// original numbers through the REPLICATE stream.
+int moveVersionSet(const shardEndpoint *source, const shardEndpoint *target, const char *remote_file, int latest)
+{
+  int sockD = connectEndpoint(target->ip, target->port);
+  if (sockD < 0)
+  {
+    errorMsg("Unable to connect to target shard");
+  }
+  char *target_catalog;
+  if (!sendText(sockD, "REPLICATE") || !receiveText(sockD, &target_catalog))
+  {
+    errorMsg("Error starting transfer to target shard");
+  }
+
+  // Never merge two version histories of the same path
+  int moved = catalogLookup(target_catalog, remote_file) < 0;
+  free(target_catalog);
+  if (!moved)
+  {
+    fprintf(stderr, "Skip '%s': already stored on %s:%d\n", remote_file, target->ip, target->port);
+  }
+
+  for (int v = 0; moved && v <= latest; v++)
+  {
+    FILE *temp = tmpfile();
+    if (temp == NULL)
+    {
+      errorMsg("Error creating temporary file");
+    }
+    if (fetchVersion(source, remote_file, v, temp))
+    {
+      rewind(temp);
+      int op = REPL_OP_WRITE, ack = 0;
+      if (!sendAll(sockD, &op, sizeof(op)) || !sendText(sockD, remote_file) ||
+          !sendAll(sockD, &v, sizeof(v)) || !sendFileData(sockD, temp) ||
+          !recvAll(sockD, &ack, sizeof(ack)) || ack != 1)
+      {
+        fprintf(stderr, "Fail to move version %d of '%s'\n", v, remote_file);
+        moved = 0;
+      }
+    }
+    fclose(temp);
+  }
+
+  int op = REPL_OP_END;
+  sendAll(sockD, &op, sizeof(op));
+  close(sockD);
+  if (!moved)
+  {
+    return 0;
+  }
+
+  // Drop the source copy only once the target holds every version
+  sockD = connectEndpoint(source->ip, source->port);
+  char *response;
+  if (sockD < 0 || !sendText(sockD, "RM") || !sendText(sockD, remote_file) || !receiveText(sockD, &response))
+  {
+    errorMsg("Error removing moved file from source shard");
+  }
+  free(response);
+  close(sockD);
+  return 1;
+}
+
+// Function: move every file to the shard owning it on the current ring
+// Servers listed in drained (e.g. shards being retired) are emptied as well.
+void operateRebalance(char *drained[], int drained_count)
+{
+  const rfsConfig *tunables = getTunables();
+  const char *shards = getConfig("SHARDS");
+  if (shards == NULL)
+  {
+    errorMsg("No SHARDS in .config to rebalance");
+  }
+  shardRing ring;
+  if (!shardRingLoad(&ring, shards, tunables->shard_vnodes, tunables->port))
+  {
+    errorMsg("Invalid SHARDS in .config");
+  }
+
+  // Every shard of the ring plus the drained ones may hold misplaced files
+  int source_count = ring.endpoint_count + drained_count;
+  shardEndpoint sources[source_count];
+  memcpy(sources, ring.endpoints, ring.endpoint_count * sizeof(shardEndpoint));
+  for (int i = 0; i < drained_count; i++)
+  {
+    shardEndpoint *e = &sources[ring.endpoint_count + i];
+    if (!parseEndpoint(drained[i], e->ip, sizeof(e->ip), &e->port, tunables->port))
+    {
+      errorMsg("Usage: ./rfs REBALANCE [<ip:port> ...]");
+    }
+  }
+
+  int moved = 0, skipped = 0;
+  for (int i = 0; i < source_count; i++)
+  {
+    int sockD = connectEndpoint(sources[i].ip, sources[i].port);
+    char *catalog;
+    if (sockD < 0 || !sendText(sockD, "CATALOG") || !receiveText(sockD, &catalog))
+    {
+      fprintf(stderr, "Skip unreachable shard %s:%d\n", sources[i].ip, sources[i].port);
+      if (sockD >= 0)
+      {
+        close(sockD);
+      }
+      continue;
+    }
+    close(sockD);
+
+    // Catalog lines are "<path>=<latest version>"
+    int self = shardFind(&ring, sources[i].ip, sources[i].port);
+    char *save_ptr;
+    for (char *line = strtok_r(catalog, "\n", &save_ptr); line != NULL; line = strtok_r(NULL, "\n", &save_ptr))
+    {
+      char *equals = strchr(line, '=');
+      if (equals == NULL)
+      {
+        continue;
+      }
+      *equals = '\0';
+      int owner = shardLookup(&ring, line);
+      if (owner == self)
+      {
+        continue;
+      }
+      if (moveVersionSet(&sources[i], &ring.endpoints[owner], line, atoi(equals + 1)))
+      {
+        printf("Moved '%s' from %s:%d to %s:%d\n", line, sources[i].ip, sources[i].port,
+               ring.endpoints[owner].ip, ring.endpoints[owner].port);
+        moved++;
+      }
+      else
+      {
+        skipped++;
+      }
+    }
+    free(catalog);
+  }
+
+  printf("Rebalance done: %d file(s) moved, %d skipped\n", moved, skipped);
+  shardRingFree(&ring);
+}
+
+int main(int argc, char *argv[])
+{
+  // Validate arguments
+  if (argc < 2)
+  {
+    errorMsg("Insufficient arguments");
+  }
+  char *action = argv[1];
+
+  if (strcmp(action, "WRITE") == 0) // Question 1
   { 
     if (argc == 4)
     {
@@ -255,16 +1851,26 @@ int main(int argc, char *argv[])
   }
   else if (strcmp(action, "GET") == 0) // Question 2
   { 
-    if (strncmp(argv[2], "-v", 2) == 0)
+    if (argc >= 5 && strcmp(argv[2], "--at") == 0)
+    { // Point-in-time read
+      long long at = parseSnapshotTime(argv[3]);
+      if (at < 0 || argc > 6)
+      {
+        errorMsg("Usage: ./rfs GET --at <time> <remote-file-path> <local-file-path>");
+      }
+      pin_primary = 1;
+      operateGet(argc == 6 ? argv[5] : argv[4], argv[4], GET_VERSION_AT_TIME, at);
+    }
+    else if (strncmp(argv[2], "-v", 2) == 0)
     {
       int v = atoi(argv[2] + 2);
       if (argc == 5)
       {
-        operateGet(argv[4], argv[3], v);
+        operateGet(argv[4], argv[3], v, 0);
       }
       else if (argc == 4)
       {
-        operateGet(argv[3], argv[3], v);
+        operateGet(argv[3], argv[3], v, 0);
       }
       else
       {
@@ -275,11 +1881,11 @@ int main(int argc, char *argv[])
     {
       if (argc == 4)
       {
-        operateGet(argv[3], argv[2], -1);
+        operateGet(argv[3], argv[2], -1, 0);
       }
       else if (argc == 3)
       { // Missing local file name defaults to remote file name
-        operateGet(argv[2], argv[2], -1);
+        operateGet(argv[2], argv[2], -1, 0);
       }
       else
       {
@@ -287,6 +1893,64 @@ int main(int argc, char *argv[])
       }
     }
   }
+  else if (strcmp(action, "MGET") == 0)
+  { // Many files in one round trip per server
+    if (argc < 3)
+    {
+      errorMsg("Usage: ./rfs MGET <local-folder> [<remote-file-path>...]");
+    }
+    operateMultiGet(argv[2], argv + 3, argc - 3);
+  }
+  else if (strcmp(action, "MWRITE") == 0)
+  { // Many files in one round trip per server
+    if (argc < 3)
+    {
+      errorMsg("Usage: ./rfs MWRITE <remote-folder> [<local-file-path>...]");
+    }
+    operateMultiWrite(argv[2], argv + 3, argc - 3);
+  }
+  else if (strcmp(action, "SYNC") == 0)
+  { // Upload the files of a local folder that changed since the server's copy
+    if (argc != 4)
+    {
+      errorMsg("Usage: ./rfs SYNC <local-folder> <remote-folder>");
+    }
+    operateSync(argv[2], argv[3]);
+  }
+  else if (strcmp(action, "APPEND") == 0)
+  { // New version = latest version + the local file's bytes
+    if (argc != 4)
+    {
+      errorMsg("Usage: ./rfs APPEND <local-file-path> <remote-file-path>");
+    }
+    operateDelta(action, argv[2], argv[3], 0);
+  }
+  else if (strcmp(action, "PATCH") == 0)
+  { // New version = latest version with a byte range replaced
+    char *end = NULL;
+    long long offset = argc == 5 ? strtoll(argv[4], &end, 10) : -1;
+    if (argc != 5 || *end != '\0' || offset < 0)
+    {
+      errorMsg("Usage: ./rfs PATCH <local-file-path> <remote-file-path> <offset>");
+    }
+    operateDelta(action, argv[2], argv[3], offset);
+  }
+  else if (strcmp(action, "DIFF") == 0)
+  { // What changed between two versions, computed on the server
+    int mode = DIFF_MODE_AUTO;
+    int first = 2;
+    if (argc > 2 && (strcmp(argv[2], "-b") == 0 || strcmp(argv[2], "-l") == 0))
+    {
+      mode = strcmp(argv[2], "-b") == 0 ? DIFF_MODE_BINARY : DIFF_MODE_LINES;
+      first = 3;
+    }
+    if (argc - first != 3 && argc - first != 4)
+    {
+      errorMsg("Usage: ./rfs DIFF [-b|-l] <remote-file-path> <version> <version> [<local-file-path>]");
+    }
+    operateDiff(argv[first], parseDiffVersion(argv[first + 1]), parseDiffVersion(argv[first + 2]), mode,
+                argc - first == 4 ? argv[first + 3] : NULL);
+  }
   else if (strcmp(action, "RM") == 0) // Question 3
   { 
     if (argc != 3)
@@ -297,7 +1961,15 @@ int main(int argc, char *argv[])
   }
   else if (strcmp(action, "LS") == 0) 
   { 
-    if (argc == 3)
+    if (argc >= 3 && argc <= 4 && strcmp(argv[2], "-d") == 0)
+    { // Folder listing from the server's index of stored paths
+      operateListing(LIST_MODE_FOLDER, argc == 4 ? argv[3] : "/");
+    }
+    else if (argc == 4 && strcmp(argv[2], "-p") == 0)
+    { // Every stored path with a prefix
+      operateListing(LIST_MODE_PREFIX, argv[3]);
+    }
+    else if (argc == 3)
     {
       operateList(argv[2], NULL);
     }
@@ -311,8 +1983,71 @@ int main(int argc, char *argv[])
     }
     else
     {
-      errorMsg("Usage: ./rfs LS <remote-file-path>");
+      errorMsg("Usage: ./rfs LS <remote-file-path>, ./rfs LS -d [<remote-folder>] or ./rfs LS -p <prefix>");
+    }
+  }
+  else if (strcmp(action, "SNAPSHOT") == 0)
+  { // Pin or download a consistent point-in-time state
+    if (argc == 2)
+    {
+      operateSnapshot(NULL, NULL, NULL, 0);
+    }
+    else if (argc >= 5)
+    {
+      operateSnapshot(argv[2], argv[3], argv + 4, argc - 4);
+    }
+    else
+    {
+      errorMsg("Usage: ./rfs SNAPSHOT [<time>|now <local-folder> <remote-file-path>...]");
+    }
+  }
+  else if (strcmp(action, "REBALANCE") == 0)
+  { // Move files to the shard owning them after SHARDS changed
+    operateRebalance(argv + 2, argc - 2);
+  }
+  else if (strcmp(action, "TRACE") == 0)
+  { // Request phase tracing on the server
+    if (argc == 3 && (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0))
+    {
+      operateTrace(argv[2], NULL);
+    }
+    else if (argc == 4 && strcmp(argv[2], "dump") == 0)
+    {
+      operateTrace(argv[2], argv[3]);
+    }
+    else
+    {
+      errorMsg("Usage: ./rfs TRACE on|off, or ./rfs TRACE dump <local-file-path>");
+    }
+  }
+  else if (strcmp(action, "WATCH") == 0)
+  { // Commits pushed by the server as they happen
+    unsigned long from = 0;
+    long limit = 0;
+    int next = 2;
+    while (next + 1 < argc && (strcmp(argv[next], "-s") == 0 || strcmp(argv[next], "-n") == 0))
+    {
+      char *end;
+      long value = strtol(argv[next + 1], &end, 10);
+      if (*end != '\0' || value < 0)
+      {
+        errorMsg("Usage: ./rfs WATCH [-s <sequence>] [-n <events>] [<remote-path>|<folder>/|<prefix>*]");
+      }
+      if (argv[next][1] == 's')
+      {
+        from = (unsigned long)value;
+      }
+      else
+      {
+        limit = value;
+      }
+      next += 2;
+    }
+    if (argc - next > 1)
+    {
+      errorMsg("Usage: ./rfs WATCH [-s <sequence>] [-n <events>] [<remote-path>|<folder>/|<prefix>*]");
     }
+    operateWatch(next < argc ? argv[next] : "*", from, limit);
   }
   else if (strcmp(action, "EXIT") == 0)
   { // Turn off the server
@@ -0,0 +1,179 @@
+/*
+ * config.c -- .config parsed once into a key/value table and typed tunables
+ *
+ * The first lookup loads CONFIG_PATH from the current folder unless
+ * loadConfig was called explicitly (the server does so after entering its
+ * data folder). Returned strings stay valid for the life of the process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "config.h"
+
+typedef struct
+{
+  char *key;
+  char *value;
+} configEntry;
+
+static configEntry *entries = NULL;
+static int entry_count = 0;
+static rfsConfig tunables;
+static int loaded = 0;
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Helper function:
+// Find a parsed value without triggering a load
+static const char *lookup(const char *target)
+{
+  for (int i = entry_count - 1; i >= 0; i--)
+  {
+    if (strcmp(entries[i].key, target) == 0)
+    {
+      return entries[i].value;
+    }
+  }
+  return NULL;
+}
+
+// Helper function:
+// Read a positive integer tunable, falling back to its default
+static long readNumber(const char *key, long fallback, long minimum)
+{
+  const char *value = lookup(key);
+  if (value == NULL)
+  {
+    return fallback;
+  }
+  char *end;
+  long number = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || number < minimum)
+  {
+    fprintf(stderr, "Invalid %s '%s' in %s, using %ld\n", key, value, CONFIG_PATH, fallback);
+    return fallback;
+  }
+  return number;
+}
+
+// Helper function:
+// Parse "KEY=value" lines; later duplicates override earlier ones
+static int parseFile(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    perror("Error opening .config file");
+    return 0;
+  }
+
+  char line[BUFSIZ];
+  while (fgets(line, sizeof(line), file))
+  {
+    // parse the input line by '=' to read key and value
+    char *equals = strchr(line, '=');
+    if (equals == NULL || line[0] == '#')
+    {
+      continue;
+    }
+    *equals = '\0';
+    char *value = equals + 1;
+    value[strcspn(value, "\r\n")] = '\0';
+
+    configEntry *grown = (configEntry *)realloc(entries, (entry_count + 1) * sizeof(configEntry));
+    if (grown == NULL)
+    {
+      fclose(file);
+      return 0;
+    }
+    entries = grown;
+    entries[entry_count].key = strdup(line);
+    entries[entry_count].value = strdup(value);
+    entry_count++;
+  }
+  fclose(file);
+  return 1;
+}
+
+// Function: parse a config file once and derive the tunables
+// Returns 0 when the file cannot be read (every tunable keeps its default).
+int loadConfig(const char *path)
+{
+  pthread_mutex_lock(&config_lock);
+  if (loaded)
+  {
+    pthread_mutex_unlock(&config_lock);
+    return 1;
+  }
+  int ok = parseFile(path);
+
+  const char *ip_address = lookup("IP_ADDRESS");
+  snprintf(tunables.ip_address, sizeof(tunables.ip_address), "%s", ip_address == NULL ? "" : ip_address);
+  tunables.port = (int)readNumber("PORT", DEFAULT_PORT, 1);
+  tunables.backlog = (int)readNumber("BACKLOG", DEFAULT_BACKLOG, 1);
+  tunables.acceptors = (int)readNumber("ACCEPTORS", DEFAULT_ACCEPTORS, 1);
+  tunables.workers = (int)readNumber("WORKERS", DEFAULT_WORKERS, 0);
+  tunables.io_buffer_size = (int)readNumber("IO_BUFFER_SIZE", DEFAULT_IO_BUFFER_SIZE, 512);
+  tunables.io_buffer_pool = (int)readNumber("IO_BUFFER_POOL", DEFAULT_IO_BUFFER_POOL, 0);
+  tunables.cache_budget = readNumber("CACHE_BUDGET", DEFAULT_CACHE_BUDGET, 0);
+  tunables.replica_max_lag = (int)readNumber("REPLICA_MAX_LAG", DEFAULT_REPLICA_MAX_LAG, 1);
+  tunables.replica_lag_timeout = (int)readNumber("REPLICA_LAG_TIMEOUT", DEFAULT_REPLICA_LAG_TIMEOUT, 1);
+  tunables.shard_vnodes = (int)readNumber("SHARD_VNODES", DEFAULT_SHARD_VNODES, 1);
+  tunables.drain_timeout = (int)readNumber("DRAIN_TIMEOUT", DEFAULT_DRAIN_TIMEOUT, 0);
+  const char *handoff_socket = lookup("HANDOFF_SOCKET");
+  snprintf(tunables.handoff_socket, sizeof(tunables.handoff_socket), "%s",
+           handoff_socket == NULL ? DEFAULT_HANDOFF_SOCKET : handoff_socket);
+  tunables.client_rate = readNumber("CLIENT_RATE", DEFAULT_CLIENT_RATE, 0);
+  tunables.bulk_rate = readNumber("BULK_RATE", DEFAULT_BULK_RATE, 0);
+  tunables.bulk_slots = (int)readNumber("BULK_SLOTS", DEFAULT_BULK_SLOTS, 0);
+  if (tunables.workers > 1 && tunables.bulk_slots >= tunables.workers)
+  {
+    // Running bulk transfers hold workers: keep at least one for metadata
+    tunables.bulk_slots = tunables.workers - 1;
+  }
+  tunables.mget_readers = (int)readNumber("MGET_READERS", DEFAULT_MGET_READERS, 1);
+  tunables.mget_prefetch_size = readNumber("MGET_PREFETCH_SIZE", DEFAULT_MGET_PREFETCH_SIZE, 0);
+  tunables.mget_max = (int)readNumber("MGET_MAX", DEFAULT_MGET_MAX, 1);
+  tunables.trace = (int)readNumber("TRACE", DEFAULT_TRACE, 0);
+  tunables.trace_events = (int)readNumber("TRACE_EVENTS", DEFAULT_TRACE_EVENTS, 16);
+  tunables.diff_cache_budget = readNumber("DIFF_CACHE_BUDGET", DEFAULT_DIFF_CACHE_BUDGET, 0);
+  tunables.diff_max_cost = (int)readNumber("DIFF_MAX_COST", DEFAULT_DIFF_MAX_COST, 0);
+  tunables.diff_max_size = readNumber("DIFF_MAX_SIZE", DEFAULT_DIFF_MAX_SIZE, 0);
+  tunables.watch_events = (int)readNumber("WATCH_EVENTS", DEFAULT_WATCH_EVENTS, 16);
+  tunables.watch_coalesce_ms = (int)readNumber("WATCH_COALESCE_MS", DEFAULT_WATCH_COALESCE_MS, 0);
+  tunables.watch_max = (int)readNumber("WATCH_MAX", DEFAULT_WATCH_MAX, 1);
+  tunables.tier_after = (int)readNumber("TIER_AFTER", DEFAULT_TIER_AFTER, 0);
+  tunables.tier_interval = (int)readNumber("TIER_INTERVAL", DEFAULT_TIER_INTERVAL, 1);
+  const char *tier_dir = lookup("TIER_DIR");
+  snprintf(tunables.tier_dir, sizeof(tunables.tier_dir), "%s", tier_dir == NULL ? DEFAULT_TIER_DIR : tier_dir);
+  tunables.sync_streams = (int)readNumber("SYNC_STREAMS", DEFAULT_SYNC_STREAMS, 1);
+  tunables.idle_timeout = (int)readNumber("IDLE_TIMEOUT", DEFAULT_IDLE_TIMEOUT, 0);
+  tunables.read_timeout = (int)readNumber("READ_TIMEOUT", DEFAULT_READ_TIMEOUT, 0);
+  tunables.write_timeout = (int)readNumber("WRITE_TIMEOUT", DEFAULT_WRITE_TIMEOUT, 0);
+  tunables.min_transfer_rate = readNumber("MIN_TRANSFER_RATE", DEFAULT_MIN_TRANSFER_RATE, 0);
+  tunables.min_rate_grace = (int)readNumber("MIN_RATE_GRACE", DEFAULT_MIN_RATE_GRACE, 0);
+  loaded = 1;
+  pthread_mutex_unlock(&config_lock);
+  return ok;
+}
+
+// Function: get a value from .config by key, NULL when absent
+const char *getConfig(const char *target)
+{
+  if (!loaded)
+  {
+    loadConfig(CONFIG_PATH);
+  }
+  return lookup(target);
+}
+
+// Function: the parsed tunables
+const rfsConfig *getTunables(void)
+{
+  if (!loaded)
+  {
+    loadConfig(CONFIG_PATH);
+  }
+  return &tunables;
+}
@@ -0,0 +1,92 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CONFIG_PATH ".config"
+#define CONFIG_VALUE_SIZE 64
+
+// Defaults used when a key is missing from .config
+#define DEFAULT_PORT 1500
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_ACCEPTORS 1
+#define DEFAULT_WORKERS 0
+#define DEFAULT_IO_BUFFER_SIZE 65536
+#define DEFAULT_IO_BUFFER_POOL 64
+#define DEFAULT_CACHE_BUDGET (256L * 1024 * 1024)
+#define DEFAULT_REPLICA_MAX_LAG 1024
+#define DEFAULT_REPLICA_LAG_TIMEOUT 5
+#define DEFAULT_SHARD_VNODES 64
+#define DEFAULT_DRAIN_TIMEOUT 30
+#define DEFAULT_HANDOFF_SOCKET ".rfserver.sock"
+#define DEFAULT_CLIENT_RATE 0
+#define DEFAULT_BULK_RATE 0
+#define DEFAULT_BULK_SLOTS 0
+#define DEFAULT_MGET_READERS 8
+#define DEFAULT_MGET_PREFETCH_SIZE (1024L * 1024)
+#define DEFAULT_MGET_MAX 4096
+#define DEFAULT_TRACE 0
+#define DEFAULT_TRACE_EVENTS 4096
+#define DEFAULT_DIFF_CACHE_BUDGET (16L * 1024 * 1024)
+#define DEFAULT_DIFF_MAX_COST 4096
+#define DEFAULT_DIFF_MAX_SIZE (64L * 1024 * 1024)
+#define DEFAULT_WATCH_EVENTS 4096
+#define DEFAULT_WATCH_COALESCE_MS 20
+#define DEFAULT_WATCH_MAX 256
+#define DEFAULT_TIER_AFTER (7 * 24 * 3600)
+#define DEFAULT_TIER_INTERVAL 300
+#define DEFAULT_TIER_DIR ".cold"
+#define DEFAULT_SYNC_STREAMS 4
+#define DEFAULT_IDLE_TIMEOUT 10
+#define DEFAULT_READ_TIMEOUT 30
+#define DEFAULT_WRITE_TIMEOUT 30
+#define DEFAULT_MIN_TRANSFER_RATE 1024
+#define DEFAULT_MIN_RATE_GRACE 10
+
+// Hosts allowed to send REPLICATE when REPLICATE_FROM is missing from .config
+#define DEFAULT_REPLICATE_FROM "127.0.0.1"
+
+// Performance tunables, parsed once from .config
+typedef struct
+{
+  char ip_address[CONFIG_VALUE_SIZE]; // IP_ADDRESS
+  int port;                           // PORT
+  int backlog;                        // BACKLOG: pending connections per listener
+  int acceptors;                      // ACCEPTORS: SO_REUSEPORT listeners, one thread each
+  int workers;                        // WORKERS: request threads, 0 = one thread per connection
+  int io_buffer_size;                 // IO_BUFFER_SIZE: chunk size of file transfers
+  int io_buffer_pool;                 // IO_BUFFER_POOL: idle transfer buffers kept for reuse
+  long cache_budget;                  // CACHE_BUDGET: bytes kept in the client cache, 0 = unlimited
+  int replica_max_lag;                // REPLICA_MAX_LAG: log entries a replica may trail
+  int replica_lag_timeout;            // REPLICA_LAG_TIMEOUT: seconds before a lagging replica is detached
+  int shard_vnodes;                   // SHARD_VNODES: ring points per shard
+  int drain_timeout;                  // DRAIN_TIMEOUT: seconds in-flight requests get on shutdown
+  char handoff_socket[CONFIG_VALUE_SIZE]; // HANDOFF_SOCKET: Unix socket passing listeners on upgrade
+  long client_rate;                   // CLIENT_RATE: bulk bytes/s per client, 0 = unlimited
+  long bulk_rate;                     // BULK_RATE: bulk bytes/s shared by all clients, 0 = unlimited
+  int bulk_slots;                     // BULK_SLOTS: concurrent bulk transfers, 0 = unlimited, below WORKERS
+  int mget_readers;                   // MGET_READERS: files of one MGET read from disk in parallel
+  long mget_prefetch_size;            // MGET_PREFETCH_SIZE: larger MGET files are streamed instead of read ahead
+  int mget_max;                       // MGET_MAX: paths in one MGET request, clients split longer lists
+  int trace;                          // TRACE: record request phases from startup (1) or not (0)
+  int trace_events;                   // TRACE_EVENTS: spans kept per thread
+  long diff_cache_budget;             // DIFF_CACHE_BUDGET: bytes of recent DIFF results kept, 0 = no cache
+  int diff_max_cost;                  // DIFF_MAX_COST: edits a line diff searches per split before reporting it replaced, 0 = no limit
+  long diff_max_size;                 // DIFF_MAX_SIZE: versions larger than this are not diffed, 0 = no limit
+  int watch_events;                   // WATCH_EVENTS: committed changes kept for WATCH subscribers to resume from
+  int watch_coalesce_ms;              // WATCH_COALESCE_MS: wait for the rest of a burst before notifying
+  int watch_max;                      // WATCH_MAX: subscriptions served at once, each on a thread of its own
+  int tier_after;                     // TIER_AFTER: seconds unused before an old version is compressed, 0 = never
+  int tier_interval;                  // TIER_INTERVAL: seconds between scans for idle versions
+  char tier_dir[CONFIG_VALUE_SIZE];   // TIER_DIR: folder of the compressed copies
+  int sync_streams;                   // SYNC_STREAMS: parallel MWRITE connections of a SYNC, per server
+  int idle_timeout;                   // IDLE_TIMEOUT: seconds a connection may take to start its request, 0 = forever
+  int read_timeout;                   // READ_TIMEOUT: seconds one receive may block, 0 = forever
+  int write_timeout;                  // WRITE_TIMEOUT: seconds one send may block, 0 = forever
+  long min_transfer_rate;             // MIN_TRANSFER_RATE: bytes/s a client has to keep up, 0 = no minimum
+  int min_rate_grace;                 // MIN_RATE_GRACE: seconds a client may fall behind MIN_TRANSFER_RATE
+} rfsConfig;
+
+int loadConfig(const char *path);
+const char *getConfig(const char *target);
+const rfsConfig *getTunables(void);
+
+#endif
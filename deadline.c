@@ -0,0 +1,153 @@
+/*
+ * deadline.c -- Per-connection deadlines and eviction of slow clients
+ *
+ * A stalled or trickling client could otherwise hold a server thread, and
+ * during a WRITE the lock of its folder, for as long as it likes. Every
+ * accepted connection gets:
+ *   - an idle deadline: its request has to start arriving within
+ *     IDLE_TIMEOUT seconds of the accept (time queued for a worker counts);
+ *   - read and write deadlines: no single receive or send may block for more
+ *     than READ_TIMEOUT or WRITE_TIMEOUT seconds (SO_RCVTIMEO, SO_SNDTIMEO);
+ *   - a minimum transfer rate: the time spent blocked on the client may
+ *     exceed MIN_RATE_GRACE seconds only by the time MIN_TRANSFER_RATE
+ *     allows for the bytes moved so far. This catches a client that sends a
+ *     byte just before every read deadline.
+ *
+ * Only the time blocked in recv and send is charged, so a client never pays
+ * for the server's own disk work or for bulk pacing. A violator is evicted:
+ * its socket is shut down, so the request unwinds through its usual error
+ * path, which releases the folder lock and drops a partly received version.
+ * A long-lived REPLICATE stream is held to the same deadlines one operation
+ * at a time: each has to start within the idle deadline, the primary pinging
+ * the stream while it has nothing to ship.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "config.h"
+#include "deadline.h"
+
+// Deadlines of the connection the calling thread serves
+typedef struct
+{
+  int sockD;           // -1 when the thread serves no guarded connection
+  long long waited_ns; // blocked in recv and send so far
+  long long bytes;     // moved so far
+} connectionDeadline;
+
+static __thread connectionDeadline current = {-1, 0, 0};
+static unsigned long evictions = 0;
+
+// Helper function:
+// Bound how long one receive (SO_RCVTIMEO) or send (SO_SNDTIMEO) may block; 0 = forever
+static void setTimeout(int sockD, int option, long long ns)
+{
+  struct timeval timeout = {0, 0};
+  if (ns > 0)
+  {
+    ns = ns < 1000 ? 1000 : ns;
+    timeout.tv_sec = ns / 1000000000LL;
+    timeout.tv_usec = (ns % 1000000000LL) / 1000;
+  }
+  setsockopt(sockD, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+// Helper function:
+// Drop the connection of the calling thread, once
+static void evict(const char *reason)
+{
+  struct sockaddr_in peer;
+  socklen_t peer_len = sizeof(peer);
+  char ip[INET_ADDRSTRLEN] = "?";
+  int port = 0;
+  if (getpeername(current.sockD, (struct sockaddr *)&peer, &peer_len) == 0)
+  {
+    inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+    port = ntohs(peer.sin_port);
+  }
+  unsigned long count = __atomic_add_fetch(&evictions, 1, __ATOMIC_RELAXED);
+  printf("Evicted client %s:%d (%s), %lu so far\n", ip, port, reason, count);
+  fflush(stdout);
+  shutdown(current.sockD, SHUT_RDWR);
+  current.sockD = -1;
+}
+
+// Function: guard a newly accepted connection; queued_ns is how long it waited for a worker
+void deadlineBegin(int sockD, long long queued_ns)
+{
+  const rfsConfig *tunables = getTunables();
+  current = (connectionDeadline){sockD, 0, 0};
+  long long idle_ns = (long long)tunables->idle_timeout * 1000000000LL;
+  if (idle_ns > 0)
+  {
+    // A connection that idled in the queue has the rest of its deadline left
+    idle_ns = idle_ns > queued_ns ? idle_ns - queued_ns : 1;
+  }
+  setTimeout(sockD, SO_RCVTIMEO, idle_ns);
+  setTimeout(sockD, SO_SNDTIMEO, (long long)tunables->write_timeout * 1000000000LL);
+}
+
+// Function: the request started arriving; the read deadline applies from now on
+void deadlineRequest(void)
+{
+  if (current.sockD >= 0)
+  {
+    setTimeout(current.sockD, SO_RCVTIMEO, (long long)getTunables()->read_timeout * 1000000000LL);
+  }
+}
+
+// Function: a long-lived stream waits for its next operation, which has to
+// start within IDLE_TIMEOUT but no sooner than min_idle seconds; the
+// transfer rate is accounted per operation
+void deadlineNext(int min_idle)
+{
+  if (current.sockD >= 0)
+  {
+    int idle = getTunables()->idle_timeout;
+    idle = idle > 0 && idle < min_idle ? min_idle : idle;
+    current.waited_ns = 0;
+    current.bytes = 0;
+    setTimeout(current.sockD, SO_RCVTIMEO, (long long)idle * 1000000000LL);
+  }
+}
+
+// Function: the request is over
+void deadlineEnd(void)
+{
+  current.sockD = -1;
+}
+
+// Function: transfer guard (setTransferGuard): account one receive or send on
+// sockD that returned bytes after blocking waited_ns; 0 evicts the client
+int deadlineGuard(int sockD, long bytes, long long waited_ns)
+{
+  if (current.sockD < 0 || sockD != current.sockD)
+  {
+    return 1;
+  }
+  if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+  {
+    evict("missed a deadline");
+    return 0;
+  }
+  current.waited_ns += waited_ns;
+  current.bytes += bytes > 0 ? bytes : 0;
+
+  const rfsConfig *tunables = getTunables();
+  if (tunables->min_transfer_rate > 0)
+  {
+    long long allowed_ns = (long long)tunables->min_rate_grace * 1000000000LL +
+                           (long long)((double)current.bytes * 1e9 / (double)tunables->min_transfer_rate);
+    if (current.waited_ns > allowed_ns)
+    {
+      evict("below MIN_TRANSFER_RATE");
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,10 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+void deadlineBegin(int sockD, long long queued_ns);
+void deadlineRequest(void);
+void deadlineNext(int min_idle);
+void deadlineEnd(void);
+int deadlineGuard(int sockD, long bytes, long long waited_ns);
+
+#endif
@@ -0,0 +1,767 @@
+/*
+ * diff.c -- Deltas between two stored versions (DIFF)
+ *
+ * Text is compared line by line with Myers' O(ND) algorithm in its
+ * linear-space form: the middle snake of the edit graph splits the problem
+ * in two, so memory stays proportional to the number of lines however many
+ * edits there are. The result is a unified diff with DIFF_CONTEXT lines of
+ * context. As in GNU diff, the search gives up on a split needing more than
+ * DIFF_MAX_COST edits: that region is reported replaced as a whole, which
+ * is still a correct diff, only not a minimal one. Versions larger than
+ * DIFF_MAX_SIZE are not loaded at all.
+ *
+ * Binary content gets a copy/insert delta against the old version. Blocks
+ * of DIFF_BLOCK_SIZE bytes of the old version are indexed by hash, and a
+ * rolling hash over the new version finds where they reappear:
+ *
+ *   "RFSDELTA" | old length (8) | new length (8) | ops...
+ *   'C' offset (8) length (8)   copy bytes of the old version
+ *   'I' length (8) bytes        insert new bytes
+ *
+ * Recent results are kept in an LRU cache of DIFF_CACHE_BUDGET bytes. Its
+ * key includes the identity of both version files (inode, size, mtime), so
+ * a version number reused after RM never hits a stale entry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "helper.h"
+#include "store.h"
+#include "trace.h"
+#include "diff.h"
+
+#define DIFF_BUCKETS 256
+#define DIFF_KEY_SIZE 1280
+#define DIFF_BINARY_PROBE 8000
+#define DIFF_MAGIC "RFSDELTA"
+
+typedef struct
+{
+  const char *text;
+  size_t len; // without the newline
+  int terminated; // ends with a newline (only the last line may not)
+  unsigned long long hash;
+} diffLine;
+
+// State of one line comparison
+typedef struct
+{
+  const diffLine *a, *b;
+  char *changed_a, *changed_b;
+  long *forward, *backward; // furthest reaching x per diagonal, centred on index 0
+  long max_cost;            // edits searched per split, 0 = no limit
+} diffContext;
+
+// Growable output of a diff
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t capacity;
+  int failed;
+} diffBuffer;
+
+typedef struct diffEntry
+{
+  char *key;
+  diffResult result;
+  struct diffEntry *next; // bucket chain
+  struct diffEntry *newer, *older;
+} diffEntry;
+
+static diffEntry *buckets[DIFF_BUCKETS];
+static diffEntry *newest = NULL, *oldest = NULL;
+static size_t cache_bytes = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// ---- Output buffer ----
+
+static void bufferAppend(diffBuffer *buffer, const void *data, size_t len)
+{
+  if (buffer->failed)
+  {
+    return;
+  }
+  if (buffer->len + len > buffer->capacity)
+  {
+    size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+    while (capacity < buffer->len + len)
+    {
+      capacity *= 2;
+    }
+    char *grown = (char *)realloc(buffer->data, capacity);
+    if (grown == NULL)
+    {
+      buffer->failed = 1;
+      return;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->len, data, len);
+  buffer->len += len;
+}
+
+static void bufferPrintf(diffBuffer *buffer, const char *format, ...)
+{
+  char text[DIFF_KEY_SIZE];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  bufferAppend(buffer, text, len < (int)sizeof(text) ? (size_t)len : sizeof(text) - 1);
+}
+
+// Helper function:
+// Hand the buffer over as a result, 0 when it ran out of memory
+static int bufferFinish(diffBuffer *buffer, int binary, diffResult *result)
+{
+  if (buffer->failed)
+  {
+    free(buffer->data);
+    return 0;
+  }
+  result->data = buffer->data;
+  result->len = buffer->len;
+  result->binary = binary;
+  result->cached = 0;
+  return 1;
+}
+
+// ---- Line diff ----
+
+// Helper function:
+// Split text into lines, hashing each one for quick comparison
+static diffLine *splitLines(const char *data, size_t len, long *count)
+{
+  long lines = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    lines += data[i] == '\n';
+  }
+  lines += len > 0 && data[len - 1] != '\n';
+
+  diffLine *result = (diffLine *)malloc((lines + 1) * sizeof(diffLine));
+  if (result == NULL)
+  {
+    return NULL;
+  }
+  const char *line = data;
+  const char *end = data + len;
+  for (long n = 0; n < lines; n++)
+  {
+    const char *newline = (const char *)memchr(line, '\n', end - line);
+    size_t line_len = newline == NULL ? (size_t)(end - line) : (size_t)(newline - line);
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < line_len; i++)
+    {
+      hash = (hash ^ (unsigned char)line[i]) * 1099511628211ULL;
+    }
+    result[n].text = line;
+    result[n].len = line_len;
+    result[n].terminated = newline != NULL;
+    result[n].hash = hash;
+    line += line_len + 1;
+  }
+  *count = lines;
+  return result;
+}
+
+static int sameLine(const diffLine *x, const diffLine *y)
+{
+  return x->hash == y->hash && x->len == y->len && x->terminated == y->terminated &&
+         memcmp(x->text, y->text, x->len) == 0;
+}
+
+// Helper function:
+// Find a point on a shortest edit path through a[a0, a1) x b[b0, b1) (the middle snake)
+// Returns 0 when that path is longer than the context's max_cost.
+static int middleSnake(diffContext *ctx, long a0, long a1, long b0, long b1, long *x_mid, long *y_mid)
+{
+  long n = a1 - a0, m = b1 - b0, delta = n - m;
+  int odd = (delta & 1) != 0;
+  long *forward = ctx->forward, *backward = ctx->backward;
+  forward[1] = 0;
+  backward[1] = 0;
+  for (long d = 0;; d++)
+  {
+    if (ctx->max_cost > 0 && d > ctx->max_cost)
+    {
+      return 0;
+    }
+    // Forward paths from the top left corner
+    for (long k = -d; k <= d; k += 2)
+    {
+      long x = (k == -d || (k != d && forward[k - 1] < forward[k + 1])) ? forward[k + 1] : forward[k - 1] + 1;
+      long y = x - k;
+      while (x < n && y < m && sameLine(&ctx->a[a0 + x], &ctx->b[b0 + y]))
+      {
+        x++;
+        y++;
+      }
+      forward[k] = x;
+      if (odd && k >= delta - (d - 1) && k <= delta + (d - 1) && x + backward[delta - k] >= n)
+      {
+        *x_mid = a0 + x;
+        *y_mid = b0 + y;
+        return 1;
+      }
+    }
+    // Backward paths from the bottom right corner (x counts lines from the end)
+    for (long k = -d; k <= d; k += 2)
+    {
+      long x = (k == -d || (k != d && backward[k - 1] < backward[k + 1])) ? backward[k + 1] : backward[k - 1] + 1;
+      long y = x - k;
+      while (x < n && y < m && sameLine(&ctx->a[a1 - 1 - x], &ctx->b[b1 - 1 - y]))
+      {
+        x++;
+        y++;
+      }
+      backward[k] = x;
+      if (!odd && delta - k >= -d && delta - k <= d && x + forward[delta - k] >= n)
+      {
+        *x_mid = a1 - x;
+        *y_mid = b1 - y;
+        return 1;
+      }
+    }
+  }
+}
+
+// Helper function:
+// Mark the lines of a[a0, a1) and b[b0, b1) that are not in their longest common subsequence
+static void compareRange(diffContext *ctx, long a0, long a1, long b0, long b1)
+{
+  // Common lines at both ends are never part of the edit
+  while (a0 < a1 && b0 < b1 && sameLine(&ctx->a[a0], &ctx->b[b0]))
+  {
+    a0++;
+    b0++;
+  }
+  while (a0 < a1 && b0 < b1 && sameLine(&ctx->a[a1 - 1], &ctx->b[b1 - 1]))
+  {
+    a1--;
+    b1--;
+  }
+  if (a0 == a1)
+  {
+    memset(ctx->changed_b + b0, 1, b1 - b0);
+    return;
+  }
+  if (b0 == b1)
+  {
+    memset(ctx->changed_a + a0, 1, a1 - a0);
+    return;
+  }
+
+  // Both ends differ, so at least two edits remain and each half has one.
+  // Too costly to split: the whole range is replaced.
+  long x_mid, y_mid;
+  if (!middleSnake(ctx, a0, a1, b0, b1, &x_mid, &y_mid))
+  {
+    memset(ctx->changed_a + a0, 1, a1 - a0);
+    memset(ctx->changed_b + b0, 1, b1 - b0);
+    return;
+  }
+  compareRange(ctx, a0, x_mid, b0, y_mid);
+  compareRange(ctx, x_mid, a1, y_mid, b1);
+}
+
+// Helper function:
+// Write one line of a hunk, noting a missing newline at the end of the file
+static void emitLine(diffBuffer *out, char tag, const diffLine *line)
+{
+  bufferAppend(out, &tag, 1);
+  bufferAppend(out, line->text, line->len);
+  bufferAppend(out, "\n", 1);
+  if (!line->terminated)
+  {
+    bufferPrintf(out, "\\ No newline at end of file\n");
+  }
+}
+
+// Function: unified diff of two texts
+int diffLines(const char *old_data, size_t old_len, const char *new_data, size_t new_len,
+              const char *old_label, const char *new_label, diffResult *result)
+{
+  long n = 0, m = 0;
+  diffLine *a = splitLines(old_data, old_len, &n);
+  diffLine *b = splitLines(new_data, new_len, &m);
+  diffContext ctx = {a, b, NULL, NULL, NULL, NULL, getTunables()->diff_max_cost};
+  long diagonals = n + m + 3;
+  long *forward = NULL, *backward = NULL;
+  if (a != NULL && b != NULL)
+  {
+    ctx.changed_a = (char *)calloc(n + 1, 1);
+    ctx.changed_b = (char *)calloc(m + 1, 1);
+    forward = (long *)malloc((2 * diagonals + 1) * sizeof(long));
+    backward = (long *)malloc((2 * diagonals + 1) * sizeof(long));
+  }
+  if (ctx.changed_a == NULL || ctx.changed_b == NULL || forward == NULL || backward == NULL)
+  {
+    free(a);
+    free(b);
+    free(ctx.changed_a);
+    free(ctx.changed_b);
+    free(forward);
+    free(backward);
+    return 0;
+  }
+  ctx.forward = forward + diagonals;
+  ctx.backward = backward + diagonals;
+  compareRange(&ctx, 0, n, 0, m);
+
+  diffBuffer out = {NULL, 0, 0, 0};
+  long i = 0, j = 0;
+  while (1)
+  {
+    // Skip to the next change
+    while (i < n && j < m && !ctx.changed_a[i] && !ctx.changed_b[j])
+    {
+      i++;
+      j++;
+    }
+    if ((i == n || !ctx.changed_a[i]) && (j == m || !ctx.changed_b[j]))
+    {
+      break;
+    }
+
+    // Grow the hunk over changes closer than twice the context
+    long start = i < DIFF_CONTEXT ? 0 : i - DIFF_CONTEXT;
+    long start_a = start, start_b = j - (i - start);
+    long end_a, end_b;
+    while (1)
+    {
+      while (i < n && ctx.changed_a[i])
+      {
+        i++;
+      }
+      while (j < m && ctx.changed_b[j])
+      {
+        j++;
+      }
+      long run = 0;
+      while (i + run < n && j + run < m && !ctx.changed_a[i + run] && !ctx.changed_b[j + run])
+      {
+        run++;
+      }
+      int more = (i + run < n && ctx.changed_a[i + run]) || (j + run < m && ctx.changed_b[j + run]);
+      if (!more || run > 2 * DIFF_CONTEXT)
+      {
+        long context = run < DIFF_CONTEXT ? run : DIFF_CONTEXT;
+        end_a = i + context;
+        end_b = j + context;
+        break;
+      }
+      i += run;
+      j += run;
+    }
+
+    // Identical inputs produce no output at all, like diff(1)
+    if (out.len == 0)
+    {
+      bufferPrintf(&out, "--- %s\n+++ %s\n", old_label, new_label);
+    }
+
+    // Line numbers are 1-based; an empty range names the line before it
+    long count_a = end_a - start_a, count_b = end_b - start_b;
+    bufferPrintf(&out, "@@ -%ld,%ld +%ld,%ld @@\n", count_a > 0 ? start_a + 1 : start_a, count_a,
+                 count_b > 0 ? start_b + 1 : start_b, count_b);
+    long x = start_a, y = start_b;
+    while (x < end_a || y < end_b)
+    {
+      if (x < end_a && ctx.changed_a[x])
+      {
+        emitLine(&out, '-', &a[x]);
+        x++;
+      }
+      else if (y < end_b && ctx.changed_b[y])
+      {
+        emitLine(&out, '+', &b[y]);
+        y++;
+      }
+      else
+      {
+        emitLine(&out, ' ', &a[x]);
+        x++;
+        y++;
+      }
+    }
+    i = end_a;
+    j = end_b;
+  }
+
+  free(a);
+  free(b);
+  free(ctx.changed_a);
+  free(ctx.changed_b);
+  free(forward);
+  free(backward);
+  return bufferFinish(&out, 0, result);
+}
+
+// ---- Binary delta ----
+
+#define DIFF_HASH_BASE 257ULL
+
+static unsigned long long blockHash(const unsigned char *data)
+{
+  unsigned long long hash = 0;
+  for (int i = 0; i < DIFF_BLOCK_SIZE; i++)
+  {
+    hash = hash * DIFF_HASH_BASE + data[i];
+  }
+  return hash;
+}
+
+static void emitInsert(diffBuffer *out, const char *data, size_t len)
+{
+  if (len == 0)
+  {
+    return;
+  }
+  uint64_t length = len;
+  bufferAppend(out, "I", 1);
+  bufferAppend(out, &length, sizeof(length));
+  bufferAppend(out, data, len);
+}
+
+// Function: copy/insert delta turning old_data into new_data
+int diffBinary(const char *old_data, size_t old_len, const char *new_data, size_t new_len, diffResult *result)
+{
+  const unsigned char *old_bytes = (const unsigned char *)old_data;
+  const unsigned char *new_bytes = (const unsigned char *)new_data;
+
+  // Index the old version by block
+  size_t slots = 1;
+  while (slots < old_len / DIFF_BLOCK_SIZE * 2 + 1)
+  {
+    slots *= 2;
+  }
+  long *table = (long *)malloc(slots * sizeof(long));
+  if (table == NULL)
+  {
+    return 0;
+  }
+  memset(table, 0xff, slots * sizeof(long));
+  for (size_t p = 0; p + DIFF_BLOCK_SIZE <= old_len; p += DIFF_BLOCK_SIZE)
+  {
+    table[blockHash(old_bytes + p) & (slots - 1)] = (long)p;
+  }
+
+  // Weight of the byte leaving the rolling window
+  unsigned long long top = 1;
+  for (int i = 1; i < DIFF_BLOCK_SIZE; i++)
+  {
+    top *= DIFF_HASH_BASE;
+  }
+
+  diffBuffer out = {NULL, 0, 0, 0};
+  uint64_t lengths[2] = {old_len, new_len};
+  bufferAppend(&out, DIFF_MAGIC, strlen(DIFF_MAGIC));
+  bufferAppend(&out, lengths, sizeof(lengths));
+
+  size_t literal = 0; // start of the bytes not covered by a copy yet
+  size_t i = 0;
+  unsigned long long hash = new_len >= DIFF_BLOCK_SIZE ? blockHash(new_bytes) : 0;
+  while (i + DIFF_BLOCK_SIZE <= new_len)
+  {
+    long candidate = table[hash & (slots - 1)];
+    if (candidate >= 0 && memcmp(old_bytes + candidate, new_bytes + i, DIFF_BLOCK_SIZE) == 0)
+    {
+      // Extend the match both ways, then copy it
+      size_t from = (size_t)candidate, start = i, len = DIFF_BLOCK_SIZE;
+      while (start > literal && from > 0 && old_bytes[from - 1] == new_bytes[start - 1])
+      {
+        from--;
+        start--;
+        len++;
+      }
+      while (start + len < new_len && from + len < old_len && old_bytes[from + len] == new_bytes[start + len])
+      {
+        len++;
+      }
+      emitInsert(&out, new_data + literal, start - literal);
+      uint64_t copy[2] = {from, len};
+      bufferAppend(&out, "C", 1);
+      bufferAppend(&out, copy, sizeof(copy));
+      i = start + len;
+      literal = i;
+      if (i + DIFF_BLOCK_SIZE <= new_len)
+      {
+        hash = blockHash(new_bytes + i);
+      }
+      continue;
+    }
+    if (i + DIFF_BLOCK_SIZE < new_len)
+    {
+      hash = (hash - new_bytes[i] * top) * DIFF_HASH_BASE + new_bytes[i + DIFF_BLOCK_SIZE];
+    }
+    i++;
+  }
+  emitInsert(&out, new_data + literal, new_len - literal);
+  free(table);
+  return bufferFinish(&out, 1, result);
+}
+
+// ---- Versions and the result cache ----
+
+// Helper function:
+// Read a whole version into memory
+static char *loadVersion(const char *file_path, int version, size_t *len)
+{
+  FILE *fp = storeOpen(file_path, version);
+  if (fp == NULL)
+  {
+    return NULL;
+  }
+  long long length = fileLength(fp);
+  char *data = length < 0 ? NULL : (char *)malloc((size_t)length + 1);
+  if (data != NULL && fread(data, 1, (size_t)length, fp) != (size_t)length)
+  {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  *len = data == NULL ? 0 : (size_t)length;
+  return data;
+}
+
+// Helper function:
+// Cache key of a diff: the request and the identity of both version files
+// Returns 1 with the key, 0 when it does not fit (not cached), -1 when a version is missing.
+static int diffKey(const char *file_path, int from, int to, int mode, char *key, size_t size)
+{
+  struct stat stats[2];
+  int versions[2] = {from, to};
+  for (int i = 0; i < 2; i++)
+  {
+    char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+    createFileName(file_name, file_path, versions[i]);
+    if (stat(file_name, &stats[i]) < 0)
+    {
+      return -1;
+    }
+  }
+  int len = snprintf(key, size, "%s|%d|%d|%d|%lu:%lld:%ld.%09ld|%lu:%lld:%ld.%09ld", file_path, from, to, mode,
+                     (unsigned long)stats[0].st_ino, (long long)stats[0].st_size, (long)stats[0].st_mtim.tv_sec,
+                     stats[0].st_mtim.tv_nsec, (unsigned long)stats[1].st_ino, (long long)stats[1].st_size,
+                     (long)stats[1].st_mtim.tv_sec, stats[1].st_mtim.tv_nsec);
+  return len > 0 && (size_t)len < size ? 1 : 0;
+}
+
+// Helper function:
+// Unlink an entry from the recency list; caller holds cache_lock
+static void unlinkEntry(diffEntry *entry)
+{
+  if (entry->newer != NULL)
+  {
+    entry->newer->older = entry->older;
+  }
+  else
+  {
+    newest = entry->older;
+  }
+  if (entry->older != NULL)
+  {
+    entry->older->newer = entry->newer;
+  }
+  else
+  {
+    oldest = entry->newer;
+  }
+  entry->newer = entry->older = NULL;
+}
+
+// Helper function:
+// Make an entry the most recently used one; caller holds cache_lock
+static void pushNewest(diffEntry *entry)
+{
+  entry->older = newest;
+  entry->newer = NULL;
+  if (newest != NULL)
+  {
+    newest->newer = entry;
+  }
+  newest = entry;
+  if (oldest == NULL)
+  {
+    oldest = entry;
+  }
+}
+
+// Helper function:
+// Copy a cached result for the caller, 0 when not cached
+static int cacheGet(const char *key, diffResult *result)
+{
+  int found = 0;
+  pthread_mutex_lock(&cache_lock);
+  for (diffEntry *entry = buckets[hashString(key) % DIFF_BUCKETS]; entry != NULL; entry = entry->next)
+  {
+    if (strcmp(entry->key, key) == 0)
+    {
+      result->data = (char *)malloc(entry->result.len + 1);
+      if (result->data != NULL)
+      {
+        memcpy(result->data, entry->result.data, entry->result.len);
+        result->len = entry->result.len;
+        result->binary = entry->result.binary;
+        result->cached = 1;
+        unlinkEntry(entry);
+        pushNewest(entry);
+        found = 1;
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return found;
+}
+
+// Helper function:
+// Drop the least recently used entry; caller holds cache_lock
+static void evictOldest(void)
+{
+  diffEntry *victim = oldest;
+  unlinkEntry(victim);
+  diffEntry **link = &buckets[hashString(victim->key) % DIFF_BUCKETS];
+  while (*link != victim)
+  {
+    link = &(*link)->next;
+  }
+  *link = victim->next;
+  cache_bytes -= victim->result.len;
+  free(victim->key);
+  free(victim->result.data);
+  free(victim);
+}
+
+// Helper function:
+// Keep a copy of a result, evicting the least recently used ones over budget
+static void cachePut(const char *key, const diffResult *result)
+{
+  size_t budget = (size_t)getTunables()->diff_cache_budget;
+  if (result->len > budget)
+  {
+    return;
+  }
+  diffEntry *entry = (diffEntry *)calloc(1, sizeof(diffEntry));
+  if (entry == NULL || (entry->key = strdup(key)) == NULL ||
+      (entry->result.data = (char *)malloc(result->len + 1)) == NULL)
+  {
+    if (entry != NULL)
+    {
+      free(entry->key);
+      free(entry);
+    }
+    return;
+  }
+  memcpy(entry->result.data, result->data, result->len);
+  entry->result.len = result->len;
+  entry->result.binary = result->binary;
+
+  pthread_mutex_lock(&cache_lock);
+  diffEntry **bucket = &buckets[hashString(key) % DIFF_BUCKETS];
+  for (diffEntry *existing = *bucket; existing != NULL; existing = existing->next)
+  {
+    if (strcmp(existing->key, key) == 0)
+    {
+      // Computed concurrently by another request
+      pthread_mutex_unlock(&cache_lock);
+      free(entry->key);
+      free(entry->result.data);
+      free(entry);
+      return;
+    }
+  }
+  while (oldest != NULL && cache_bytes + result->len > budget)
+  {
+    evictOldest();
+  }
+  entry->next = *bucket;
+  *bucket = entry;
+  pushNewest(entry);
+  cache_bytes += result->len;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// Function: delta from version from to version to of a stored file
+// mode is one of DIFF_MODE_*; returns 0 when a version is missing or memory runs out,
+// -1 when a version is larger than DIFF_MAX_SIZE.
+int diffVersions(const char *file_path, int from, int to, int mode, diffResult *result)
+{
+  char key[DIFF_KEY_SIZE];
+  int keyed = diffKey(file_path, from, to, mode, key, sizeof(key));
+  if (keyed < 0)
+  {
+    return 0;
+  }
+  if (keyed && cacheGet(key, result))
+  {
+    return 1;
+  }
+
+  // Both versions are held in memory, so their size is bounded
+  long max_size = getTunables()->diff_max_size;
+  if (max_size > 0 && (storeLength(file_path, from) > max_size || storeLength(file_path, to) > max_size))
+  {
+    return -1;
+  }
+
+  traceSpan load_span = traceStart("load versions");
+  size_t old_len, new_len;
+  char *old_data = loadVersion(file_path, from, &old_len);
+  char *new_data = loadVersion(file_path, to, &new_len);
+  traceStop(load_span);
+  if (old_data == NULL || new_data == NULL)
+  {
+    free(old_data);
+    free(new_data);
+    return 0;
+  }
+
+  // Text unless either side has a NUL byte near its start, as git decides
+  int binary = mode == DIFF_MODE_BINARY;
+  if (mode == DIFF_MODE_AUTO)
+  {
+    binary = memchr(old_data, '\0', old_len < DIFF_BINARY_PROBE ? old_len : DIFF_BINARY_PROBE) != NULL ||
+             memchr(new_data, '\0', new_len < DIFF_BINARY_PROBE ? new_len : DIFF_BINARY_PROBE) != NULL;
+  }
+
+  traceSpan diff_span = traceStart(binary ? "binary delta" : "line diff");
+  int ok;
+  if (binary)
+  {
+    ok = diffBinary(old_data, old_len, new_data, new_len, result);
+  }
+  else
+  {
+    char old_label[DIFF_KEY_SIZE / 2], new_label[DIFF_KEY_SIZE / 2];
+    snprintf(old_label, sizeof(old_label), "%s (v%d)", file_path, from);
+    snprintf(new_label, sizeof(new_label), "%s (v%d)", file_path, to);
+    ok = diffLines(old_data, old_len, new_data, new_len, old_label, new_label, result);
+  }
+  traceStop(diff_span);
+  free(old_data);
+  free(new_data);
+
+  if (ok && keyed && getTunables()->diff_cache_budget > 0)
+  {
+    cachePut(key, result);
+  }
+  return ok;
+}
+
+// Function: release a result
+void diffFree(diffResult *result)
+{
+  free(result->data);
+  result->data = NULL;
+  result->len = 0;
+}
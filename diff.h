@@ -0,0 +1,27 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+
+// Lines of unchanged context around each hunk of a line diff
+#define DIFF_CONTEXT 3
+
+// Bytes a binary delta must match at least to copy from the old version
+#define DIFF_BLOCK_SIZE 16
+
+// Delta between two versions, owned by the caller (diffFree)
+typedef struct
+{
+  char *data;
+  size_t len;
+  int binary; // binary delta (1) or unified line diff (0)
+  int cached; // served from the result cache
+} diffResult;
+
+int diffLines(const char *old_data, size_t old_len, const char *new_data, size_t new_len,
+              const char *old_label, const char *new_label, diffResult *result);
+int diffBinary(const char *old_data, size_t old_len, const char *new_data, size_t new_len, diffResult *result);
+int diffVersions(const char *file_path, int from, int to, int mode, diffResult *result);
+void diffFree(diffResult *result);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * handoff.c -- Passing listening sockets to a successor rfserver
+ *
+ * The running server listens on a Unix domain socket. A new process started
+ * in upgrade mode connects to it and receives duplicates of every listening
+ * socket (SCM_RIGHTS), starts accepting on them and acknowledges. Only then
+ * does the old process stop accepting, so the port never stops listening.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "handoff.h"
+
+#define HANDOFF_MAX_FDS 64
+
+// Helper function:
+// Fill a Unix socket address, refusing paths that do not fit
+static int handoffAddress(const char *path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+  {
+    return 0;
+  }
+  strcpy(addr->sun_path, path);
+  return 1;
+}
+
+// Function: listen for a successor on a Unix socket, replacing any stale one
+int handoffListen(const char *path)
+{
+  struct sockaddr_un addr;
+  if (!handoffAddress(path, &addr))
+  {
+    return -1;
+  }
+  int handoff_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (handoff_desc < 0)
+  {
+    return -1;
+  }
+  unlink(path);
+  if (bind(handoff_desc, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(handoff_desc, 1) < 0)
+  {
+    close(handoff_desc);
+    return -1;
+  }
+  return handoff_desc;
+}
+
+// Function: wait for a successor and pass it the listening sockets
+// Returns once the successor acknowledged that it is accepting, 0 on failure.
+int handoffSend(int handoff_desc, const int *fds, int count)
+{
+  if (count <= 0 || count > HANDOFF_MAX_FDS)
+  {
+    return 0;
+  }
+  int sockD = accept(handoff_desc, NULL, NULL);
+  if (sockD < 0)
+  {
+    return 0;
+  }
+
+  // The count travels as data, the descriptors as ancillary data
+  char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+  memset(control, 0, sizeof(control));
+  struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+  char ack = 0;
+  int ok = sendmsg(sockD, &msg, 0) == (ssize_t)sizeof(count) &&
+           recv(sockD, &ack, sizeof(ack), MSG_WAITALL) == 1 && ack == 1;
+  close(sockD);
+  return ok;
+}
+
+// Helper function:
+// Close every descriptor a refused handoff message carried
+static void closeReceived(struct msghdr *msg)
+{
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+      continue;
+    }
+    int received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    for (int i = 0; i < received; i++)
+    {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      close(fd);
+    }
+  }
+}
+
+// Function: take over the listening sockets of the running server
+// Returns the number of sockets received (0 on failure); sockD stays open
+// for handoffAck once the caller accepts on them.
+int handoffReceive(const char *path, int *fds, int max_count, int *sockD)
+{
+  struct sockaddr_un addr;
+  if (!handoffAddress(path, &addr))
+  {
+    return 0;
+  }
+  *sockD = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (*sockD < 0)
+  {
+    return 0;
+  }
+  if (connect(*sockD, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(*sockD);
+    return 0;
+  }
+
+  int count = 0;
+  char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+  struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t len = recvmsg(*sockD, &msg, 0);
+  if (len != (ssize_t)sizeof(count))
+  {
+    if (len >= 0)
+    {
+      closeReceived(&msg);
+    }
+    close(*sockD);
+    return 0;
+  }
+
+  // Descriptors of a message we refuse are ours all the same: close them
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+  {
+    closeReceived(&msg);
+    close(*sockD);
+    return 0;
+  }
+  int received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+  if (received != count || count > max_count)
+  {
+    closeReceived(&msg);
+    close(*sockD);
+    return 0;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+  return count;
+}
+
+// Function: tell the old server we are accepting, so it can stop and drain
+int handoffAck(int sockD)
+{
+  char ack = 1;
+  int ok = send(sockD, &ack, sizeof(ack), 0) == 1;
+  close(sockD);
+  return ok;
+}
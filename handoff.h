@@ -0,0 +1,13 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+// Pause after a failed handoff, doubled on every further failure up to the maximum
+#define HANDOFF_RETRY_MIN_MS 100
+#define HANDOFF_RETRY_MAX_MS 5000
+
+int handoffListen(const char *path);
+int handoffSend(int handoff_desc, const int *fds, int count);
+int handoffReceive(const char *path, int *fds, int max_count, int *sockD);
+int handoffAck(int sockD);
+
+#endif
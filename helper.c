@@ -1,81 +1,429 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "helper.h"
+#include "config.h"
+#include "trace.h"
+#include "iopool.h"
 
 
-// Get IP Address
-char *getConfig(const char *target)
+// Split "ip:port" into its parts, using default_port when the port is omitted
+int parseEndpoint(const char *endpoint, char *ip, size_t size, int *port, int default_port)
 {
-  // Open .config and locate global variables
-  FILE *file = fopen(".config", "r");
-  if (file == NULL)
+  const char *colon = strchr(endpoint, ':');
+  size_t len = colon == NULL ? strlen(endpoint) : (size_t)(colon - endpoint);
+  if (len == 0 || len >= size)
   {
-    perror("Error opening .config file");
-    return NULL;
+    return 0;
+  }
+  memcpy(ip, endpoint, len);
+  ip[len] = '\0';
+  *port = colon == NULL ? default_port : atoi(colon + 1);
+  return *port > 0;
+}
+
+// Open a TCP connection to ip:port, returns the socket or -1
+int connectEndpoint(const char *ip, int port)
+{
+  int sockD = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockD < 0)
+  {
+    return -1;
   }
-  char line[BUFSIZ];
-  while (fgets(line, BUFSIZ, file))
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  server_addr.sin_addr.s_addr = inet_addr(ip);
+  if (connect(sockD, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
   {
-    // parse the input line by '=' to read key and value
-    char *equals = strchr(line, '=');
-    if (equals != NULL)
-    {
-      *equals = '\0';
-      if (strcmp(line, target) == 0)
-      {
-        fclose(file);
-        return equals + 1;
-      }
-    }
+    close(sockD);
+    return -1;
   }
-  fclose(file);
-  return NULL;
+  return sockD;
 }
 
-// Send string from socket
+static transferGuard transfer_guard = NULL;
+
+// Install the hook accounting every receive and send (NULL accounts nothing)
+void setTransferGuard(transferGuard guard)
+{
+  transfer_guard = guard;
+}
+
+// Helper function:
+// Monotonic clock in nanoseconds, for timing blocked transfers
+static long long monotonicNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Send string from socket: its length, then its bytes
+// Returns 1 when sent (an empty string included), 0 on failure.
 int sendText(int sockD, const char *str)
 {
   size_t len = strlen(str);
-  if (send(sockD, &len, sizeof(len), 0) < 0)
+  if (!sendAll(sockD, &len, sizeof(len)))
   {
     perror("Fail to send length of string");
     return 0;
   }
-  if (send(sockD, str, len, 0) < 0)
+  if (!sendAll(sockD, str, len))
   {
     perror("Fail to send string data");
     return 0;
   }
-  return (int)len;
+  return 1;
 }
 
 // Receive string from socket
 int receiveText(int sockD, char **str)
+{
+  char *text = NULL;
+  if (!receiveTextWith(sockD, &text, malloc))
+  {
+    free(text);
+    return 0;
+  }
+  *str = text;
+  return 1;
+}
+
+// Receive string from socket into memory taken from allocate
+// Returns 1 when received (an empty string included), 0 on failure; then *str
+// may still hold memory from allocate, which the caller releases.
+int receiveTextWith(int sockD, char **str, textAllocator allocate)
 {
   size_t len;
-  if (recv(sockD, &len, sizeof(len), 0) < 0)
+  *str = NULL;
+  if (!recvAll(sockD, &len, sizeof(len)))
   {
     perror("Fail to receive length of string");
     return 0;
   }
+  if (len > TEXT_MAX_SIZE)
+  {
+    fprintf(stderr, "Refusing a string of %zu bytes\n", len);
+    return 0;
+  }
 
   // +1 for null terminator
-  *str = (char *)malloc(len + 1); 
+  *str = (char *)allocate(len + 1); 
   if (*str == NULL)
   {
     perror("Fail to allocate memory for string");
     return 0;
   }
 
-  if (recv(sockD, *str, len, 0) < 0)
+  if (!recvAll(sockD, *str, len))
   {
     perror("Fail to receive string data");
     return 0;
   }
 
   (*str)[len] = '\0'; // Null-terminate the received string
-  return (int)len;
+  return 1;
+}
+
+// Send exactly len bytes, looping over partial sends
+int sendAll(int sockD, const void *buf, size_t len)
+{
+  const char *p = (const char *)buf;
+  while (len > 0)
+  {
+    long long started = transfer_guard != NULL ? monotonicNs() : 0;
+    ssize_t sent = send(sockD, p, len, MSG_NOSIGNAL);
+    if (transfer_guard != NULL && !transfer_guard(sockD, (long)sent, monotonicNs() - started))
+    {
+      return 0;
+    }
+    if (sent <= 0)
+    {
+      return 0;
+    }
+    p += sent;
+    len -= (size_t)sent;
+  }
+  return 1;
+}
+
+// Receive exactly len bytes, looping over partial receives
+int recvAll(int sockD, void *buf, size_t len)
+{
+  char *p = (char *)buf;
+  while (len > 0)
+  {
+    long long started = transfer_guard != NULL ? monotonicNs() : 0;
+    ssize_t got = recv(sockD, p, len, 0);
+    if (transfer_guard != NULL && !transfer_guard(sockD, (long)got, monotonicNs() - started))
+    {
+      return 0;
+    }
+    if (got <= 0)
+    {
+      return 0;
+    }
+    p += got;
+    len -= (size_t)got;
+  }
+  return 1;
+}
+
+static transferPacer transfer_pacer = NULL;
+
+// Install the pacing hook of file transfers (NULL transfers at full speed)
+void setTransferPacer(transferPacer pacer)
+{
+  transfer_pacer = pacer;
+}
+
+// Length of the content behind a stream, -1 when unknown
+// Streams without a file descriptor (a version rebuilt from extents) are measured by seeking.
+long long fileLength(FILE *fp)
+{
+  struct stat file_stat;
+  if (fileno(fp) >= 0)
+  {
+    return fstat(fileno(fp), &file_stat) < 0 ? -1 : (long long)file_stat.st_size;
+  }
+  off_t position = ftello(fp);
+  if (position < 0 || fseeko(fp, 0, SEEK_END) != 0)
+  {
+    return -1;
+  }
+  off_t end = ftello(fp);
+  fseeko(fp, position, SEEK_SET);
+  return (long long)end;
+}
+
+// Stream a whole file to the socket: total length first, then fixed-size chunks
+int sendFileData(int sockD, FILE *fp)
+{
+  long long length = fileLength(fp);
+  if (length < 0)
+  {
+    perror("Fail to stat file for sending");
+    return 0;
+  }
+  size_t len = (size_t)length;
+  if (!sendAll(sockD, &len, sizeof(len)))
+  {
+    perror("Fail to send length of file");
+    return 0;
+  }
+
+  size_t chunk = (size_t)getTunables()->io_buffer_size;
+  char *buffer = (char *)ioBufferGet();
+  if (buffer == NULL)
+  {
+    perror("Fail to allocate transfer buffer");
+    return 0;
+  }
+  size_t remaining = len;
+  int ok = 1;
+  while (ok && remaining > 0)
+  {
+    size_t want = remaining < chunk ? remaining : chunk;
+    traceSpan read_span = traceStart("disk read");
+    size_t bytesRead = fread(buffer, 1, want, fp);
+    traceStop(read_span);
+    traceSpan send_span = traceStart("socket send");
+    if (bytesRead == 0)
+    {
+      perror("Fail to read file data");
+      ok = 0;
+    }
+    else if (!sendAll(sockD, buffer, bytesRead))
+    {
+      perror("Fail to send file data");
+      ok = 0;
+    }
+    traceStop(send_span);
+    if (ok && transfer_pacer != NULL)
+    {
+      transfer_pacer(bytesRead);
+    }
+    remaining -= bytesRead;
+  }
+  ioBufferPut(buffer);
+  return ok;
+}
+
+// Helper function:
+// Fold bytes into a running 64-bit FNV-1a hash
+static uint64_t checksumUpdate(uint64_t hash, const unsigned char *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Receive a file streamed by sendFileData and write it to fp
+// Returns the number of bytes written, or -1 on failure
+long receiveFileData(int sockD, FILE *fp)
+{
+  return receiveFileDataChecksum(sockD, fp, NULL);
+}
+
+// Same as receiveFileData; a non-NULL checksum receives the checksum of the
+// bytes written, as fileChecksum computes it, without reading them back
+long receiveFileDataChecksum(int sockD, FILE *fp, char *checksum)
+{
+  size_t len;
+  if (!recvAll(sockD, &len, sizeof(len)))
+  {
+    perror("Fail to receive length of file");
+    return -1;
+  }
+
+  size_t chunk = (size_t)getTunables()->io_buffer_size;
+  char *buffer = (char *)ioBufferGet();
+  if (buffer == NULL)
+  {
+    perror("Fail to allocate transfer buffer");
+    return -1;
+  }
+  uint64_t hash = 14695981039346656037ULL;
+  size_t remaining = len;
+  while (remaining > 0)
+  {
+    size_t want = remaining < chunk ? remaining : chunk;
+    traceSpan recv_span = traceStart("socket recv");
+    int received = recvAll(sockD, buffer, want);
+    traceStop(recv_span);
+    if (!received)
+    {
+      perror("Fail to receive file data");
+      ioBufferPut(buffer);
+      return -1;
+    }
+    traceSpan write_span = traceStart("disk write");
+    size_t written = fwrite(buffer, 1, want, fp);
+    traceStop(write_span);
+    if (written != want)
+    {
+      perror("Fail to write file data");
+      ioBufferPut(buffer);
+      return -1;
+    }
+    if (checksum != NULL)
+    {
+      hash = checksumUpdate(hash, (const unsigned char *)buffer, want);
+    }
+    if (transfer_pacer != NULL)
+    {
+      transfer_pacer(want);
+    }
+    remaining -= want;
+  }
+  ioBufferPut(buffer);
+  if (checksum != NULL)
+  {
+    snprintf(checksum, CHECKSUM_SIZE, "%016llx", (unsigned long long)hash);
+  }
+  return (long)len;
+}
+
+// 64-bit FNV-1a hash of a string, with a final mix so nearby keys spread out
+unsigned long long hashString(const char *str)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++)
+  {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return (unsigned long long)hash;
+}
+
+// Compute a 64-bit FNV-1a checksum of a file's content as a hex string
+// checksum must hold at least CHECKSUM_SIZE bytes
+int fileChecksum(const char *file_name, char *checksum)
+{
+  FILE *fp = fopen(file_name, "rb");
+  if (fp == NULL)
+  {
+    return 0;
+  }
+  int ok = streamChecksum(fp, checksum);
+  fclose(fp);
+  return ok;
+}
+
+// Same checksum as fileChecksum, over the rest of an open stream
+int streamChecksum(FILE *fp, char *checksum)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  unsigned char buffer[TRANSFER_CHUNK_SIZE];
+  size_t bytesRead;
+  while ((bytesRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+  {
+    hash = checksumUpdate(hash, buffer, bytesRead);
+  }
+  if (ferror(fp))
+  {
+    return 0;
+  }
+  snprintf(checksum, CHECKSUM_SIZE, "%016llx", (unsigned long long)hash);
+  return 1;
+}
+
+// Same checksum as fileChecksum, for content already in memory
+void dataChecksum(const void *data, size_t len, char *checksum)
+{
+  uint64_t hash = checksumUpdate(14695981039346656037ULL, (const unsigned char *)data, len);
+  snprintf(checksum, CHECKSUM_SIZE, "%016llx", (unsigned long long)hash);
+}
+
+// Find the latest version of a path in a catalog text ("<path>=<version>" lines)
+// Returns -1 when the path is not listed
+int catalogLookup(const char *catalog, const char *file_path)
+{
+  size_t len = strlen(file_path);
+  const char *line = catalog;
+  while (line != NULL && *line != '\0')
+  {
+    if (strncmp(line, file_path, len) == 0 && line[len] == '=')
+    {
+      return atoi(line + len + 1);
+    }
+    line = strchr(line, '\n');
+    if (line != NULL)
+    {
+      line++;
+    }
+  }
+  return -1;
+}
+
+// Create the parent folders of a path, like mkdir -p on its dirname
+void makeParentDirs(const char *file_path)
+{
+  char path[strlen(file_path) + 1];
+  strcpy(path, file_path);
+  for (char *p = path + 1; *p != '\0'; p++)
+  {
+    if (*p == '/')
+    {
+      *p = '\0';
+      mkdir(path, 0755);
+      *p = '/';
+    }
+  }
 }
 
 // Check whether a file name exists
@@ -130,25 +478,23 @@ char *getFileSuffix(const char *file_name, char delimiter)
 }
 
 // Function to create a versioned file name by name (prefix) and version number (suffix)
-void createFileName(char *new_file, char *prev_file, int versionNumber)
+// new_file needs room for strlen(prev_file) + VERSION_NAME_EXTRA bytes.
+void createFileName(char *new_file, const char *prev_file, int versionNumber)
 {
   if (versionNumber == 0)
   {
-    sprintf(new_file, "%s", prev_file);
-    new_file[strlen(prev_file) + 1] = '\0';
+    strcpy(new_file, prev_file);
     return;
   }
-  char *prefix = getFilePrefix(prev_file, '.');
-  if (prefix == NULL)
+  // Same split as getFilePrefix/getFileSuffix, without copying either part
+  const char *dot = strrchr(prev_file, '.');
+  if (dot == NULL || dot == prev_file)
   { // When there is no file suffix
     sprintf(new_file, "%s_%d", prev_file, versionNumber);
   }
   else
   { // When there is a file suffix
-    char *suffix = getFileSuffix(prev_file, '.');
-    sprintf(new_file, "%s_%d.%s", prefix, versionNumber, suffix);
-    free(prefix);
-    free(suffix);
+    sprintf(new_file, "%.*s_%d%s", (int)(dot - prev_file), prev_file, versionNumber, dot);
   }
 }
 
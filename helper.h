@@ -1,13 +1,80 @@
 #ifndef HELPER_H
 #define HELPER_H
 
-char *getConfig(const char *target);
+#include <stdio.h>
+
+#define TRANSFER_CHUNK_SIZE 65536
+// Longest string receiveText accepts (catalogs and listings included)
+#define TEXT_MAX_SIZE (256UL * 1024 * 1024)
+#define VERSION_PATH ".file_VERSION"
+#define CHECKSUM_SIZE 17
+
+// Room createFileName needs beyond the name: '_', the version digits and the terminator
+#define VERSION_NAME_EXTRA 16
+
+// Status codes leading a GET reply
+#define GET_STATUS_ERROR -1
+#define GET_STATUS_DATA 0
+#define GET_STATUS_NOT_MODIFIED 1
+
+// Status of one MWRITE item
+#define MWRITE_STATUS_ERROR -1
+#define MWRITE_STATUS_STORED 0
+
+// Kind of delta requested by DIFF
+#define DIFF_MODE_AUTO 0   // line diff for text, binary delta otherwise
+#define DIFF_MODE_LINES 1
+#define DIFF_MODE_BINARY 2
+
+// Events pushed to WATCH subscribers
+#define WATCH_OP_WRITE 1
+#define WATCH_OP_RM 2
+#define WATCH_OP_RESET 3 // earlier events were lost, re-read the watched paths
+
+// What a LIST request enumerates
+#define LIST_MODE_FOLDER 0 // files and subfolders directly inside a folder
+#define LIST_MODE_PREFIX 1 // every stored path starting with a prefix
+#define LIST_MODE_MANIFEST 2 // like LIST_MODE_PREFIX, with the checksum of every latest version
+
+// Sent in place of a GET version number: a snapshot time (microseconds) follows
+#define GET_VERSION_AT_TIME -2
+
+// Sent in place of a checksum when the client has nothing cached
+#define NO_CHECKSUM "-"
+
+int parseEndpoint(const char *endpoint, char *ip, size_t size, int *port, int default_port);
+int connectEndpoint(const char *ip, int port);
 int sendText(int sockD, const char *str);
 int receiveText(int sockD, char **str);
+// Source of the memory a received string is stored in (malloc, arenaAlloc)
+typedef void *(*textAllocator)(size_t size);
+
+int receiveTextWith(int sockD, char **str, textAllocator allocate);
+int sendAll(int sockD, const void *buf, size_t len);
+int recvAll(int sockD, void *buf, size_t len);
+// Called after every receive and send with its result and the time it blocked;
+// returning 0 fails the transfer
+typedef int (*transferGuard)(int sockD, long bytes, long long waited_ns);
+
+void setTransferGuard(transferGuard guard);
+// Called after every chunk of a file transfer; may sleep to pace it
+typedef void (*transferPacer)(size_t bytes);
+
+void setTransferPacer(transferPacer pacer);
+long long fileLength(FILE *fp);
+int sendFileData(int sockD, FILE *fp);
+long receiveFileData(int sockD, FILE *fp);
+long receiveFileDataChecksum(int sockD, FILE *fp, char *checksum);
+unsigned long long hashString(const char *str);
+int fileChecksum(const char *file_name, char *checksum);
+int streamChecksum(FILE *fp, char *checksum);
+void dataChecksum(const void *data, size_t len, char *checksum);
+int catalogLookup(const char *catalog, const char *file_path);
+void makeParentDirs(const char *file_path);
 int isValidFile(const char *file_name);
 char *getFilePrefix(const char *file_name, char delimiter);
 char *getFileSuffix(const char *file_name, char delimiter);
-void createFileName(char *new_file, char *prev_file, int versionNumber);
+void createFileName(char *new_file, const char *prev_file, int versionNumber);
 void errorMsg(const char *msg);
 
 #endif
\ No newline at end of file
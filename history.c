@@ -0,0 +1,420 @@
+/*
+ * history.c -- Time-ordered version index for point-in-time reads
+ *
+ * Every committed version is appended to HISTORY_PATH as
+ *   <commit time in microseconds> <version> <path>
+ * and kept in memory as one array per path, sorted by commit time, so the
+ * version a path had at any moment is found by binary search.
+ *
+ * Commit times are strictly increasing, and historyNow never hands out a
+ * time a later commit could reuse, so a snapshot time pins one exact state
+ * of the store. RM forgets the history of a path, or of every path inside a
+ * removed folder: their old versions are gone, and a later WRITE reuses
+ * their numbers.
+ *
+ * The file is shared with a predecessor or successor process during an
+ * upgrade: before every use the index picks up lines appended by the other
+ * process, and reloads when the file was rewritten.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "helper.h"
+#include "catalog.h"
+#include "history.h"
+
+#define HISTORY_BUCKETS 4096
+#define HISTORY_FORGET -1
+
+typedef struct
+{
+  long long time;
+  int version;
+} historyPoint;
+
+typedef struct historyPath
+{
+  char *path;
+  historyPoint *points; // sorted by time
+  int count;
+  int capacity;
+  struct historyPath *next;
+} historyPath;
+
+static historyPath *buckets[HISTORY_BUCKETS];
+static long long last_time = 0;
+static off_t loaded_size = 0;
+static ino_t loaded_inode = 0;
+static int live_points = 0; // commits in the index
+static int stale_lines = 0; // lines of the file dropped by a later forget
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Helper function:
+// Find the history of a path, optionally creating an empty one
+static historyPath *findPath(const char *file_path, int create)
+{
+  historyPath **bucket = &buckets[hashString(file_path) % HISTORY_BUCKETS];
+  for (historyPath *entry = *bucket; entry != NULL; entry = entry->next)
+  {
+    if (strcmp(entry->path, file_path) == 0)
+    {
+      return entry;
+    }
+  }
+  if (!create)
+  {
+    return NULL;
+  }
+  historyPath *entry = (historyPath *)calloc(1, sizeof(historyPath));
+  if (entry == NULL || (entry->path = strdup(file_path)) == NULL)
+  {
+    free(entry);
+    return NULL;
+  }
+  entry->next = *bucket;
+  *bucket = entry;
+  return entry;
+}
+
+// Helper function:
+// Whether a path is the removed path, or inside it when it is a folder
+static int insidePath(const char *file_path, const char *removed)
+{
+  size_t removed_len = strlen(removed);
+  if (strncmp(file_path, removed, removed_len) != 0)
+  {
+    return 0;
+  }
+  char next = file_path[removed_len];
+  return next == '\0' || next == '/' || (removed_len > 0 && removed[removed_len - 1] == '/');
+}
+
+// Helper function:
+// Drop from memory the history of a removed path and of the paths inside it
+static void forgetPaths(const char *removed)
+{
+  for (int b = 0; b < HISTORY_BUCKETS; b++)
+  {
+    historyPath **link = &buckets[b];
+    while (*link != NULL)
+    {
+      historyPath *entry = *link;
+      if (!insidePath(entry->path, removed))
+      {
+        link = &entry->next;
+        continue;
+      }
+      *link = entry->next;
+      live_points -= entry->count;
+      stale_lines += entry->count;
+      free(entry->path);
+      free(entry->points);
+      free(entry);
+    }
+  }
+}
+
+// Helper function:
+// Add one commit to the in-memory index
+static void addPoint(const char *file_path, long long time, int version)
+{
+  historyPath *entry = findPath(file_path, 1);
+  if (entry == NULL)
+  {
+    return;
+  }
+  if (entry->count == entry->capacity)
+  {
+    int capacity = entry->capacity == 0 ? 4 : entry->capacity * 2;
+    historyPoint *grown = (historyPoint *)realloc(entry->points, capacity * sizeof(historyPoint));
+    if (grown == NULL)
+    {
+      return;
+    }
+    entry->points = grown;
+    entry->capacity = capacity;
+  }
+  // Commits arrive in time order; keep the array sorted if one does not
+  int i = entry->count++;
+  while (i > 0 && entry->points[i - 1].time > time)
+  {
+    entry->points[i] = entry->points[i - 1];
+    i--;
+  }
+  entry->points[i].time = time;
+  entry->points[i].version = version;
+  live_points++;
+  if (time > last_time)
+  {
+    last_time = time;
+  }
+}
+
+// Helper function:
+// Forget everything held in memory
+static void clearIndex(void)
+{
+  for (int b = 0; b < HISTORY_BUCKETS; b++)
+  {
+    while (buckets[b] != NULL)
+    {
+      historyPath *entry = buckets[b];
+      buckets[b] = entry->next;
+      free(entry->path);
+      free(entry->points);
+      free(entry);
+    }
+  }
+  live_points = 0;
+  stale_lines = 0;
+  loaded_size = 0;
+}
+
+// Helper function:
+// Bring the index up to date with the history file; caller holds history_lock
+static void syncIndex(void)
+{
+  struct stat history_stat;
+  if (stat(HISTORY_PATH, &history_stat) < 0)
+  {
+    return;
+  }
+  if (history_stat.st_ino != loaded_inode || history_stat.st_size < loaded_size)
+  {
+    // Compacted by another process: start over
+    clearIndex();
+    loaded_inode = history_stat.st_ino;
+  }
+  if (history_stat.st_size == loaded_size)
+  {
+    return;
+  }
+
+  FILE *filePointer = fopen(HISTORY_PATH, "r");
+  if (filePointer == NULL || fseeko(filePointer, loaded_size, SEEK_SET) != 0)
+  {
+    if (filePointer != NULL)
+    {
+      fclose(filePointer);
+    }
+    return;
+  }
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_size, filePointer)) > 0)
+  {
+    if (line[len - 1] != '\n')
+    {
+      break; // still being appended, pick it up next time
+    }
+    loaded_size += (off_t)len;
+    line[len - 1] = '\0';
+
+    long long time;
+    int version, offset;
+    if (sscanf(line, "%lld %d %n", &time, &version, &offset) != 2 || line[offset] == '\0')
+    {
+      continue;
+    }
+    if (version == HISTORY_FORGET)
+    {
+      forgetPaths(line + offset);
+      stale_lines++;
+    }
+    else
+    {
+      addPoint(line + offset, time, version);
+    }
+  }
+  free(line);
+  fclose(filePointer);
+}
+
+// Helper function:
+// Current wall-clock time in microseconds
+static long long clockNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Helper function:
+// Append one commit to the history file; caller holds history_lock
+static void appendPoint(const char *file_path, long long time, int version)
+{
+  FILE *filePointer = fopen(HISTORY_PATH, "a");
+  if (filePointer == NULL)
+  {
+    perror("Fail to open version history");
+    return;
+  }
+  fprintf(filePointer, "%lld %d %s\n", time, version, file_path);
+  fclose(filePointer);
+}
+
+// Helper function:
+// Rewrite the history file from the index, leaving out forgotten lines;
+// caller holds history_lock
+static void compactHistory(void)
+{
+  FILE *temp = fopen(HISTORY_PATH ".temp", "w");
+  if (temp == NULL)
+  {
+    perror("Fail to compact version history");
+    return;
+  }
+  for (int b = 0; b < HISTORY_BUCKETS; b++)
+  {
+    for (historyPath *entry = buckets[b]; entry != NULL; entry = entry->next)
+    {
+      for (int i = 0; i < entry->count; i++)
+      {
+        fprintf(temp, "%lld %d %s\n", entry->points[i].time, entry->points[i].version, entry->path);
+      }
+    }
+  }
+  fclose(temp);
+  if (rename(HISTORY_PATH ".temp", HISTORY_PATH) != 0)
+  {
+    perror("Fail to replace version history");
+    return;
+  }
+  struct stat history_stat;
+  if (stat(HISTORY_PATH, &history_stat) == 0)
+  {
+    loaded_inode = history_stat.st_ino;
+    loaded_size = history_stat.st_size;
+  }
+  stale_lines = 0;
+}
+
+// Function: load the history file and index versions stored before it existed
+// Versions listed in the version info file but missing from the history are
+// added with their modification time as commit time.
+void historyInit(void)
+{
+  pthread_mutex_lock(&history_lock);
+  syncIndex();
+
+  char *catalog = readCatalog();
+  if (catalog != NULL)
+  {
+    char *save = NULL;
+    for (char *line = strtok_r(catalog, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    {
+      char *equals = strchr(line, '=');
+      if (equals == NULL)
+      {
+        continue;
+      }
+      *equals = '\0';
+      if (findPath(line, 0) != NULL)
+      {
+        continue;
+      }
+      int latest = atoi(equals + 1);
+      char file_name[strlen(line) + VERSION_NAME_EXTRA];
+      long long previous = 0;
+      for (int v = 0; v <= latest; v++)
+      {
+        struct stat file_stat;
+        createFileName(file_name, line, v);
+        if (stat(file_name, &file_stat) < 0)
+        {
+          continue;
+        }
+        long long time = (long long)file_stat.st_mtime * 1000000;
+        time = time > previous ? time : previous + 1;
+        appendPoint(line, time, v);
+        previous = time;
+      }
+    }
+    free(catalog);
+  }
+  syncIndex();
+  pthread_mutex_unlock(&history_lock);
+}
+
+// Function: record a committed version, returns its commit time
+// Callers hold the catalog lock, so appends never race with historyForget.
+long long historyRecord(const char *file_path, int version)
+{
+  pthread_mutex_lock(&history_lock);
+  syncIndex();
+  long long time = clockNow();
+  if (time <= last_time)
+  {
+    time = last_time + 1;
+  }
+  appendPoint(file_path, time, version);
+  syncIndex();
+  pthread_mutex_unlock(&history_lock);
+  return time;
+}
+
+// Function: forget the history of a removed path
+// For a folder, the history of every file inside it goes as well. Callers
+// hold the catalog lock, so the forget line is ordered with the commits.
+void historyForget(const char *file_path)
+{
+  pthread_mutex_lock(&history_lock);
+  syncIndex();
+  appendPoint(file_path, last_time, HISTORY_FORGET);
+  syncIndex();
+  if (stale_lines > live_points)
+  {
+    compactHistory();
+  }
+  pthread_mutex_unlock(&history_lock);
+}
+
+// Function: the version a path had at a given time (microseconds), -1 if none
+int historyLookup(const char *file_path, long long at)
+{
+  pthread_mutex_lock(&history_lock);
+  syncIndex();
+  int version = -1;
+  historyPath *entry = findPath(file_path, 0);
+  if (entry != NULL)
+  {
+    // Last commit at or before the requested time
+    int low = 0, high = entry->count - 1;
+    while (low <= high)
+    {
+      int mid = low + (high - low) / 2;
+      if (entry->points[mid].time <= at)
+      {
+        version = entry->points[mid].version;
+        low = mid + 1;
+      }
+      else
+      {
+        high = mid - 1;
+      }
+    }
+  }
+  pthread_mutex_unlock(&history_lock);
+  return version;
+}
+
+// Function: a snapshot time covering every commit made so far
+// Later commits are guaranteed a strictly greater time.
+long long historyNow(void)
+{
+  pthread_mutex_lock(&history_lock);
+  syncIndex();
+  long long time = clockNow();
+  if (time < last_time)
+  {
+    time = last_time;
+  }
+  last_time = time;
+  pthread_mutex_unlock(&history_lock);
+  return time;
+}
@@ -0,0 +1,12 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#define HISTORY_PATH ".file_HISTORY"
+
+void historyInit(void);
+long long historyRecord(const char *file_path, int version);
+void historyForget(const char *file_path);
+int historyLookup(const char *file_path, long long at);
+long long historyNow(void);
+
+#endif
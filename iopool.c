@@ -0,0 +1,68 @@
+/*
+ * iopool.c -- Recycled file transfer buffers
+ *
+ * Every file transfer needs one IO_BUFFER_SIZE buffer. Instead of a fresh
+ * malloc per transfer, buffers are page aligned and returned to a shared
+ * free list, which keeps at most IO_BUFFER_POOL idle ones. A long-running
+ * server then settles on as many buffers as it has concurrent transfers,
+ * and stops fragmenting the heap with large short-lived blocks.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "config.h"
+#include "iopool.h"
+
+// An idle buffer stores the link to the next one in its first bytes
+typedef struct idleBuffer
+{
+  struct idleBuffer *next;
+} idleBuffer;
+
+static idleBuffer *idle_buffers = NULL;
+static int idle_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function: take an IO_BUFFER_SIZE buffer from the pool, NULL when out of memory
+void *ioBufferGet(void)
+{
+  pthread_mutex_lock(&pool_lock);
+  idleBuffer *buffer = idle_buffers;
+  if (buffer != NULL)
+  {
+    idle_buffers = buffer->next;
+    idle_count--;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  if (buffer != NULL)
+  {
+    return buffer;
+  }
+
+  void *memory;
+  if (posix_memalign(&memory, IO_BUFFER_ALIGN, (size_t)getTunables()->io_buffer_size) != 0)
+  {
+    return NULL;
+  }
+  return memory;
+}
+
+// Function: give a buffer from ioBufferGet back for reuse
+void ioBufferPut(void *buffer)
+{
+  if (buffer == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock(&pool_lock);
+  if (idle_count < getTunables()->io_buffer_pool)
+  {
+    idleBuffer *idle = (idleBuffer *)buffer;
+    idle->next = idle_buffers;
+    idle_buffers = idle;
+    idle_count++;
+    buffer = NULL;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  free(buffer);
+}
@@ -0,0 +1,10 @@
+#ifndef IOPOOL_H
+#define IOPOOL_H
+
+// Alignment of pooled buffers, a page so direct and vectored I/O can use them
+#define IO_BUFFER_ALIGN 4096
+
+void *ioBufferGet(void);
+void ioBufferPut(void *buffer);
+
+#endif
@@ -0,0 +1,489 @@
+/*
+ * names.c -- Radix tree of the stored paths, for folder and prefix listings
+ *
+ * Every path in the version info file is kept in a compressed trie: each
+ * edge carries a run of bytes, and siblings are sorted by their first byte.
+ * A node where a stored path ends holds its latest version and the size of
+ * that version, and every node sums the files, versions and bytes below it,
+ * so a listing reports a whole subfolder without visiting it. A manifest
+ * listing (SYNC) also reports the checksum of every latest version that is
+ * kept here. The caller computes the missing ones after releasing the
+ * catalog lock and hands them back with namesKeepChecksum; they are kept
+ * until the path gets a new version.
+ *
+ * The tree is built from the version info file at startup and follows the
+ * commits and removals of this process afterwards; the filesystem is never
+ * walked. When another process rewrites the version info file (during an
+ * upgrade) the tree is rebuilt from it. Callers hold the catalog lock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "helper.h"
+#include "catalog.h"
+#include "store.h"
+#include "names.h"
+
+#define LINE_BUFFER_SIZE 1024
+
+typedef struct nameNode
+{
+  char *label; // bytes of the edge from the parent
+  size_t label_len;
+  struct nameNode **children; // sorted by the first byte of their label
+  int child_count;
+  int child_capacity;
+  int latest;        // latest version of the path ending here, -1 if none does
+  long long size;    // bytes of that version
+  long files;        // stored paths in this subtree
+  long versions;     // their versions
+  long long bytes;   // sizes of their latest versions
+  int checksum_version;         // version checksum belongs to, -1 if not computed
+  char checksum[CHECKSUM_SIZE];
+} nameNode;
+
+static nameNode root = {"", 0, NULL, 0, 0, -1, 0, 0, 0, 0, -1, ""};
+
+// Helper function:
+// Allocate a node for an edge, with nothing stored below it yet
+static nameNode *newNode(const char *label, size_t label_len)
+{
+  nameNode *node = (nameNode *)calloc(1, sizeof(nameNode));
+  if (node == NULL || (node->label = (char *)malloc(label_len + 1)) == NULL)
+  {
+    free(node);
+    return NULL;
+  }
+  memcpy(node->label, label, label_len);
+  node->label[label_len] = '\0';
+  node->label_len = label_len;
+  node->latest = -1;
+  node->checksum_version = -1;
+  return node;
+}
+
+// Helper function:
+// Free a node and everything below it
+static void freeNode(nameNode *node)
+{
+  for (int i = 0; i < node->child_count; i++)
+  {
+    freeNode(node->children[i]);
+  }
+  free(node->children);
+  free(node->label);
+  free(node);
+}
+
+// Helper function:
+// Index among the children of the one whose label starts with byte, or
+// where it would be inserted (as -index - 1)
+static int findChild(const nameNode *node, unsigned char byte)
+{
+  int low = 0, high = node->child_count - 1;
+  while (low <= high)
+  {
+    int mid = (low + high) / 2;
+    unsigned char first = (unsigned char)node->children[mid]->label[0];
+    if (first == byte)
+    {
+      return mid;
+    }
+    if (first < byte)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid - 1;
+    }
+  }
+  return -low - 1;
+}
+
+// Helper function:
+// Insert a child at a position returned by findChild
+static int insertChild(nameNode *node, int index, nameNode *child)
+{
+  if (node->child_count == node->child_capacity)
+  {
+    int capacity = node->child_capacity == 0 ? 2 : node->child_capacity * 2;
+    nameNode **grown = (nameNode **)realloc(node->children, capacity * sizeof(nameNode *));
+    if (grown == NULL)
+    {
+      return 0;
+    }
+    node->children = grown;
+    node->child_capacity = capacity;
+  }
+  memmove(&node->children[index + 1], &node->children[index], (node->child_count - index) * sizeof(nameNode *));
+  node->children[index] = child;
+  node->child_count++;
+  return 1;
+}
+
+// Helper function:
+// Split the edge of a child after its first keep bytes; returns the new middle node
+static nameNode *splitChild(nameNode *parent, int index, size_t keep)
+{
+  nameNode *child = parent->children[index];
+  nameNode *middle = newNode(child->label, keep);
+  char *rest = middle == NULL ? NULL : (char *)malloc(child->label_len - keep + 1);
+  if (rest == NULL || !insertChild(middle, 0, child))
+  {
+    free(rest);
+    if (middle != NULL)
+    {
+      free(middle->children);
+      free(middle->label);
+      free(middle);
+    }
+    return NULL;
+  }
+  memcpy(rest, child->label + keep, child->label_len - keep + 1);
+  free(child->label);
+  child->label = rest;
+  child->label_len -= keep;
+  middle->files = child->files;
+  middle->versions = child->versions;
+  middle->bytes = child->bytes;
+  parent->children[index] = middle;
+  return middle;
+}
+
+// Helper function:
+// Fold a node that stores nothing into its only child, keeping the tree compressed
+static void mergeChild(nameNode *node)
+{
+  nameNode *child = node->children[0];
+  char *label = (char *)malloc(node->label_len + child->label_len + 1);
+  if (label == NULL)
+  {
+    return;
+  }
+  memcpy(label, node->label, node->label_len);
+  memcpy(label + node->label_len, child->label, child->label_len + 1);
+  free(node->label);
+  node->label = label;
+  node->label_len += child->label_len;
+  free(node->children);
+  node->children = child->children;
+  node->child_count = child->child_count;
+  node->child_capacity = child->child_capacity;
+  node->latest = child->latest;
+  node->size = child->size;
+  node->checksum_version = child->checksum_version;
+  memcpy(node->checksum, child->checksum, sizeof(node->checksum));
+  free(child->label);
+  free(child);
+}
+
+// Helper function:
+// Tidy the nodes on a path after something below them went away
+// path[0] is the root and path[depth - 1] the deepest node still attached.
+static void prune(nameNode **path, int depth)
+{
+  for (int d = depth - 1; d > 0; d--)
+  {
+    nameNode *node = path[d], *parent = path[d - 1];
+    if (node->latest >= 0 || node->child_count > 1)
+    {
+      return;
+    }
+    if (node->child_count == 1)
+    {
+      mergeChild(node);
+      return;
+    }
+    int index = findChild(parent, (unsigned char)node->label[0]);
+    memmove(&parent->children[index], &parent->children[index + 1],
+            (parent->child_count - index - 1) * sizeof(nameNode *));
+    parent->child_count--;
+    freeNode(node);
+  }
+}
+
+// Helper function:
+// Add the change of one subtree's sums to every node on the path to it
+static void addToPath(nameNode **path, int depth, long files, long versions, long long bytes)
+{
+  for (int d = 0; d < depth; d++)
+  {
+    path[d]->files += files;
+    path[d]->versions += versions;
+    path[d]->bytes += bytes;
+  }
+}
+
+// Helper function:
+// Record the latest version of a path, creating its nodes as needed
+static void storePath(const char *file_path, int latest, long long size)
+{
+  nameNode *path[strlen(file_path) + 2];
+  int depth = 0;
+  nameNode *node = &root;
+  path[depth++] = node;
+  const char *rest = file_path;
+  while (*rest != '\0')
+  {
+    int index = findChild(node, (unsigned char)*rest);
+    if (index < 0)
+    {
+      nameNode *leaf = newNode(rest, strlen(rest));
+      if (leaf == NULL || !insertChild(node, -index - 1, leaf))
+      {
+        if (leaf != NULL)
+        {
+          freeNode(leaf);
+        }
+        return;
+      }
+      node = leaf;
+      path[depth++] = node;
+      break;
+    }
+    nameNode *child = node->children[index];
+    size_t common = 0;
+    while (common < child->label_len && rest[common] == child->label[common])
+    {
+      common++;
+    }
+    if (common < child->label_len && (child = splitChild(node, index, common)) == NULL)
+    {
+      return;
+    }
+    node = child;
+    path[depth++] = node;
+    rest += common;
+  }
+
+  long versions = node->latest >= 0 ? node->latest + 1 : 0;
+  long long bytes = node->latest >= 0 ? node->size : 0;
+  addToPath(path, depth, node->latest >= 0 ? 0 : 1, latest + 1 - versions, size - bytes);
+  node->latest = latest;
+  node->size = size;
+  node->checksum_version = -1;
+}
+
+// Helper function:
+// Follow a key down the tree; returns the node whose edge the key ends in,
+// and in *skip how many bytes of that edge the key covers (NULL if no path
+// starts with the key). With path, the nodes walked are recorded there.
+static nameNode *findKey(const char *key, size_t *skip, nameNode **path, int *depth)
+{
+  nameNode *node = &root;
+  if (path != NULL)
+  {
+    path[(*depth)++] = node;
+  }
+  const char *rest = key;
+  *skip = 0;
+  while (*rest != '\0')
+  {
+    int index = findChild(node, (unsigned char)*rest);
+    if (index < 0)
+    {
+      return NULL;
+    }
+    node = node->children[index];
+    size_t rest_len = strlen(rest);
+    size_t common = rest_len < node->label_len ? rest_len : node->label_len;
+    if (memcmp(rest, node->label, common) != 0)
+    {
+      return NULL;
+    }
+    if (path != NULL)
+    {
+      path[(*depth)++] = node;
+    }
+    rest += common;
+    *skip = common;
+  }
+  *skip = node == &root ? 0 : *skip;
+  return node;
+}
+
+// Helper function:
+// Size of a stored version, 0 when it cannot be read
+static long long versionSize(const char *file_path, int version)
+{
+  long long size = storeLength(file_path, version);
+  return size < 0 ? 0 : size;
+}
+
+// Helper function:
+// Rebuild the tree when another process rewrote the version info file
+static void namesSync(void)
+{
+  if (catalogChangedElsewhere())
+  {
+    namesLoad();
+  }
+}
+
+// Function: build the tree from the version info file
+void namesLoad(void)
+{
+  for (int i = 0; i < root.child_count; i++)
+  {
+    freeNode(root.children[i]);
+  }
+  free(root.children);
+  root = (nameNode){"", 0, NULL, 0, 0, -1, 0, 0, 0, 0, -1, ""};
+
+  char *catalog = readCatalog();
+  if (catalog != NULL)
+  {
+    char *save = NULL;
+    for (char *line = strtok_r(catalog, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    {
+      char *equals = strchr(line, '=');
+      if (equals == NULL || equals == line)
+      {
+        continue;
+      }
+      *equals = '\0';
+      int latest = atoi(equals + 1);
+      storePath(line, latest, versionSize(line, latest));
+    }
+    free(catalog);
+  }
+  catalogChangedElsewhere();
+}
+
+// Function: record a committed version of a path, unless a later one is known
+void namesUpdate(const char *file_path, int version)
+{
+  namesSync();
+  size_t skip;
+  nameNode *node = findKey(file_path, &skip, NULL, NULL);
+  if (node != NULL && skip == node->label_len && node->latest > version)
+  {
+    return;
+  }
+  storePath(file_path, version, versionSize(file_path, version));
+}
+
+// Function: keep the checksum of a path's latest version for manifest listings,
+// unless the path got another version since it was listed
+void namesKeepChecksum(const char *file_path, int version, const char *checksum)
+{
+  namesSync();
+  size_t skip;
+  nameNode *node = findKey(file_path, &skip, NULL, NULL);
+  if (node != NULL && skip == node->label_len && node->latest == version)
+  {
+    strcpy(node->checksum, checksum);
+    node->checksum_version = version;
+  }
+}
+
+// Function: forget a removed path, or a removed folder with everything inside it
+void namesRemove(const char *file_path)
+{
+  namesSync();
+
+  // The path itself
+  nameNode *path[strlen(file_path) + 2];
+  int depth = 0;
+  size_t skip;
+  nameNode *node = findKey(file_path, &skip, path, &depth);
+  if (node != NULL && node != &root && skip == node->label_len && node->latest >= 0)
+  {
+    addToPath(path, depth, -1, -(node->latest + 1), -node->size);
+    node->latest = -1;
+    node->size = 0;
+    prune(path, depth);
+  }
+
+  // Everything under it as a folder: the subtree the key "<path>/" ends in
+  size_t len = strlen(file_path);
+  char folder[len + 2];
+  memcpy(folder, file_path, len + 1);
+  if (len == 0 || folder[len - 1] != '/')
+  {
+    strcat(folder, "/");
+  }
+  depth = 0;
+  node = findKey(folder, &skip, path, &depth);
+  if (node != NULL && node != &root)
+  {
+    addToPath(path, depth - 1, -node->files, -node->versions, -node->bytes);
+    nameNode *parent = path[depth - 2];
+    int index = findChild(parent, (unsigned char)node->label[0]);
+    memmove(&parent->children[index], &parent->children[index + 1],
+            (parent->child_count - index - 1) * sizeof(nameNode *));
+    parent->child_count--;
+    freeNode(node);
+    prune(path, depth - 1);
+  }
+}
+
+// Helper function:
+// Write the entries of a subtree: stored paths as "F <versions> <bytes> <name>",
+// and in folder mode subfolders as "D <files> <versions> <bytes> <name>/"
+// without descending into them. Manifest mode writes stored paths as
+// "M <versions> <bytes> <checksum> <name>" instead, with NO_CHECKSUM where
+// none is kept yet. Names drop the first name_from bytes of the key.
+static int listNode(FILE *out, nameNode *node, size_t skip, char *key, size_t key_len, size_t name_from, int mode)
+{
+  const char *tail = node->label + skip;
+  size_t tail_len = node->label_len - skip;
+  if (key_len + tail_len >= NAMES_KEY_SIZE)
+  {
+    return 0;
+  }
+  const char *slash = mode == LIST_MODE_FOLDER ? (const char *)memchr(tail, '/', tail_len) : NULL;
+  if (slash != NULL)
+  {
+    fprintf(out, "D %ld %ld %lld %.*s%.*s\n", node->files, node->versions, node->bytes, (int)(key_len - name_from),
+            key + name_from, (int)(slash - tail + 1), tail);
+    return 1;
+  }
+
+  memcpy(key + key_len, tail, tail_len);
+  key_len += tail_len;
+  int entries = 0;
+  if (node->latest >= 0 && mode == LIST_MODE_MANIFEST)
+  {
+    fprintf(out, "M %d %lld %s %.*s\n", node->latest + 1, node->size,
+            node->checksum_version >= 0 ? node->checksum : NO_CHECKSUM, (int)(key_len - name_from), key + name_from);
+    entries++;
+  }
+  else if (node->latest >= 0)
+  {
+    fprintf(out, "F %d %lld %.*s\n", node->latest + 1, node->size, (int)(key_len - name_from), key + name_from);
+    entries++;
+  }
+  for (int i = 0; i < node->child_count; i++)
+  {
+    entries += listNode(out, node->children[i], 0, key, key_len, name_from, mode);
+  }
+  return entries;
+}
+
+// Function: list the stored paths starting with prefix (LIST_MODE_PREFIX), or
+// the files and subfolders directly inside the folder prefix (LIST_MODE_FOLDER,
+// names relative to it, "" for the top), or the stored paths starting with
+// prefix with their checksums (LIST_MODE_MANIFEST); returns the number of entries
+int namesList(const char *prefix, int mode, FILE *out)
+{
+  namesSync();
+  size_t skip;
+  nameNode *node = findKey(prefix, &skip, NULL, NULL);
+  if (node == NULL)
+  {
+    return 0;
+  }
+
+  // The key so far is the whole prefix; the edge it ends in continues after skip bytes
+  size_t prefix_len = strlen(prefix);
+  if (prefix_len >= NAMES_KEY_SIZE)
+  {
+    return 0;
+  }
+  char key[NAMES_KEY_SIZE];
+  memcpy(key, prefix, prefix_len);
+  return listNode(out, node, skip, key, prefix_len, mode == LIST_MODE_FOLDER ? prefix_len : 0, mode);
+}
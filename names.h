@@ -0,0 +1,15 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <stdio.h>
+
+// Longest path a listing reports
+#define NAMES_KEY_SIZE 1024
+
+void namesLoad(void);
+void namesUpdate(const char *file_path, int version);
+void namesKeepChecksum(const char *file_path, int version, const char *checksum);
+void namesRemove(const char *file_path);
+int namesList(const char *prefix, int mode, FILE *out);
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ * replica.c -- Asynchronous primary -> replica replication
+ *
+ * Every committed WRITE and RM is appended to an in-memory ordered log.
+ * One shipper thread per replica streams the log over a long-lived
+ * REPLICATE connection and waits for the replica to acknowledge each entry.
+ * An idle stream is pinged every REPLICA_HEARTBEAT_SEC, so the replica can
+ * hold it to the usual connection deadlines, one entry at a time.
+ *
+ * Lag is bounded by the log capacity: a writer blocks while some replica is
+ * a full log behind, and after the lag timeout that replica is detached.
+ * A detached (or freshly started) replica catches up from the catalog,
+ * shipping only the versions it is missing, before it follows the log again.
+ * Its catalog carries the checksum of every latest version: a path whose
+ * content differs from ours at that number was removed and written again
+ * here meanwhile, so the replica drops its versions and gets all of ours.
+ *
+ * A draining server flushes the log before it exits, so commits it accepted
+ * after handing its listeners to a successor (whose own catch-up already
+ * ran) still reach the replicas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "helper.h"
+#include "config.h"
+#include "store.h"
+#include "catalog.h"
+#include "replica.h"
+
+#define ENDPOINT_SIZE 64
+#define LINE_BUFFER_SIZE 1024
+
+typedef struct
+{
+  unsigned long seq;
+  int op;
+  char *path;
+  int version;
+} replEntry;
+
+typedef struct
+{
+  char ip[ENDPOINT_SIZE];
+  int port;
+  unsigned long acked; // sequence number of the next entry the replica needs
+  int attached;        // follows the log (otherwise it has to catch up first)
+  pthread_t tid;
+} replTarget;
+
+static replEntry *log_ring = NULL;
+static unsigned long log_capacity = 0;
+static unsigned long log_head = 0; // sequence number of the next entry
+static replTarget *targets = NULL;
+static int target_count = 0;
+static int lag_timeout_sec = DEFAULT_REPLICA_LAG_TIMEOUT;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+
+// Helper function:
+// Ship one operation to a replica and wait for its acknowledgement
+// A WRITE whose version no longer exists on disk is skipped (a later RM covers it).
+static int shipEntry(int sockD, int op, const char *file_path, int version)
+{
+  FILE *filePointer = NULL;
+  if (op == REPL_OP_WRITE)
+  {
+    filePointer = storeOpen(file_path, version);
+    if (filePointer == NULL)
+    {
+      return 1;
+    }
+  }
+
+  int ok = sendAll(sockD, &op, sizeof(op)) && sendText(sockD, file_path);
+  if (ok && op == REPL_OP_WRITE)
+  {
+    ok = sendAll(sockD, &version, sizeof(version)) && sendFileData(sockD, filePointer);
+  }
+  if (filePointer != NULL)
+  {
+    fclose(filePointer);
+  }
+
+  int ack = 0;
+  return ok && recvAll(sockD, &ack, sizeof(ack)) && ack == 1;
+}
+
+// Helper function:
+// The checksum a replica reported for the latest version of a path, 0 when it sent none
+static int replicaChecksum(const char *replica_catalog, const char *file_path, char *checksum)
+{
+  size_t len = strlen(file_path);
+  const char *line = replica_catalog;
+  while (line != NULL && *line != '\0')
+  {
+    if (strncmp(line, file_path, len) == 0 && line[len] == '=')
+    {
+      return sscanf(line + len + 1, "%*d %16s", checksum) == 1 && strcmp(checksum, NO_CHECKSUM) != 0;
+    }
+    line = strchr(line, '\n');
+    if (line != NULL)
+    {
+      line++;
+    }
+  }
+  return 0;
+}
+
+// Helper function:
+// Whether a replica holds versions of a path that are not ours: it has more of
+// them, or its latest one has other content than ours with the same number
+static int diverged(const char *replica_catalog, const char *file_path, int replica_latest, int latest)
+{
+  char replica_sum[CHECKSUM_SIZE], local_sum[CHECKSUM_SIZE];
+  if (replica_latest > latest)
+  {
+    return 1;
+  }
+  return replica_latest >= 0 && replicaChecksum(replica_catalog, file_path, replica_sum) &&
+         storeChecksum(file_path, replica_latest, local_sum) && strcmp(replica_sum, local_sum) != 0;
+}
+
+// Helper function:
+// Bring a replica up to date with the local catalog
+static int catchUp(int sockD, const char *replica_catalog)
+{
+  char *catalog = readCatalog();
+  char *lines = catalog != NULL ? strdup(catalog) : NULL;
+  if (lines == NULL)
+  {
+    free(catalog);
+    return 0;
+  }
+
+  // Ship every version the replica has not seen yet
+  int ok = 1;
+  char *save = NULL;
+  for (char *line = strtok_r(lines, "\n", &save); ok && line != NULL; line = strtok_r(NULL, "\n", &save))
+  {
+    char *equals = strchr(line, '=');
+    if (equals == NULL)
+    {
+      continue;
+    }
+    *equals = '\0';
+    int latest = atoi(equals + 1);
+    int replica_latest = catalogLookup(replica_catalog, line);
+    if (diverged(replica_catalog, line, replica_latest, latest))
+    {
+      ok = shipEntry(sockD, REPL_OP_RM, line, 0);
+      replica_latest = -1;
+    }
+    for (int v = replica_latest + 1; ok && v <= latest; v++)
+    {
+      ok = shipEntry(sockD, REPL_OP_WRITE, line, v);
+    }
+  }
+  free(lines);
+
+  // Remove what was deleted here while the replica was away
+  const char *entry = replica_catalog;
+  while (ok && entry != NULL && *entry != '\0')
+  {
+    const char *equals = strchr(entry, '=');
+    const char *newline = strchr(entry, '\n');
+    if (equals != NULL && (newline == NULL || equals < newline))
+    {
+      char file_path[LINE_BUFFER_SIZE];
+      size_t len = equals - entry;
+      if (len < sizeof(file_path))
+      {
+        memcpy(file_path, entry, len);
+        file_path[len] = '\0';
+        if (catalogLookup(catalog, file_path) < 0)
+        {
+          ok = shipEntry(sockD, REPL_OP_RM, file_path, 0);
+        }
+      }
+    }
+    entry = newline == NULL ? NULL : newline + 1;
+  }
+
+  free(catalog);
+  return ok;
+}
+
+// Function: shipper thread, one per replica
+static void *replicaShipper(void *arg)
+{
+  replTarget *target = (replTarget *)arg;
+  while (1)
+  {
+    int sockD = connectEndpoint(target->ip, target->port);
+    if (sockD < 0)
+    {
+      sleep(1);
+      continue;
+    }
+
+    // Handshake: the replica answers with its own catalog
+    char *replica_catalog = NULL;
+    if (!sendText(sockD, "REPLICATE") || !receiveText(sockD, &replica_catalog))
+    {
+      free(replica_catalog);
+      close(sockD);
+      sleep(1);
+      continue;
+    }
+
+    // Start following the log from here, then fill in everything older from the catalog
+    pthread_mutex_lock(&log_lock);
+    unsigned long next = log_head;
+    target->acked = next;
+    target->attached = 1;
+    pthread_mutex_unlock(&log_lock);
+
+    int ok = catchUp(sockD, replica_catalog);
+    free(replica_catalog);
+    if (ok)
+    {
+      printf("Replica %s:%d is in sync\n", target->ip, target->port);
+    }
+
+    while (ok)
+    {
+      pthread_mutex_lock(&log_lock);
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += REPLICA_HEARTBEAT_SEC;
+      int idle = 0;
+      while (target->attached && next == log_head && !idle)
+      {
+        idle = pthread_cond_timedwait(&log_cond, &log_lock, &deadline) == ETIMEDOUT;
+      }
+      if (!target->attached || log_head - next > log_capacity)
+      {
+        pthread_mutex_unlock(&log_lock);
+        break;
+      }
+      if (next == log_head)
+      {
+        // Nothing committed for a while: show the replica we are still here
+        pthread_mutex_unlock(&log_lock);
+        ok = shipEntry(sockD, REPL_OP_PING, "", 0);
+        continue;
+      }
+      replEntry *slot = &log_ring[next % log_capacity];
+      int op = slot->op, version = slot->version;
+      char *file_path = strdup(slot->path);
+      pthread_mutex_unlock(&log_lock);
+
+      ok = file_path != NULL && shipEntry(sockD, op, file_path, version);
+      free(file_path);
+
+      if (ok)
+      {
+        pthread_mutex_lock(&log_lock);
+        target->acked = ++next;
+        pthread_cond_broadcast(&log_cond);
+        pthread_mutex_unlock(&log_lock);
+      }
+    }
+
+    // Lost the replica or it fell too far behind: catch up again on reconnect
+    pthread_mutex_lock(&log_lock);
+    target->attached = 0;
+    pthread_cond_broadcast(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+    fprintf(stderr, "Replica %s:%d detached, will catch up on reconnect\n", target->ip, target->port);
+
+    int op = REPL_OP_END;
+    sendAll(sockD, &op, sizeof(op));
+    close(sockD);
+    sleep(1);
+  }
+  return NULL;
+}
+
+// Function: start shipping the log to a comma-separated list of "ip:port" replicas
+void replicationStart(const char *replica_list, int max_lag, int lag_timeout)
+{
+  if (replica_list == NULL || *replica_list == '\0')
+  {
+    return;
+  }
+
+  log_capacity = max_lag > 0 ? (unsigned long)max_lag : DEFAULT_REPLICA_MAX_LAG;
+  lag_timeout_sec = lag_timeout > 0 ? lag_timeout : DEFAULT_REPLICA_LAG_TIMEOUT;
+  log_ring = (replEntry *)calloc(log_capacity, sizeof(replEntry));
+  if (log_ring == NULL)
+  {
+    errorMsg("Fail to allocate replication log");
+  }
+
+  char list[strlen(replica_list) + 1];
+  strcpy(list, replica_list);
+  for (char *p = list; *p != '\0'; p++)
+  {
+    target_count += *p == ',';
+  }
+  target_count++;
+  targets = (replTarget *)calloc(target_count, sizeof(replTarget));
+  if (targets == NULL)
+  {
+    errorMsg("Fail to allocate replica list");
+  }
+
+  int n = 0;
+  char *save_ptr;
+  for (char *endpoint = strtok_r(list, ",", &save_ptr); endpoint != NULL; endpoint = strtok_r(NULL, ",", &save_ptr))
+  {
+    if (!parseEndpoint(endpoint, targets[n].ip, sizeof(targets[n].ip), &targets[n].port, 0))
+    {
+      fprintf(stderr, "Invalid replica endpoint '%s'\n", endpoint);
+      continue;
+    }
+    n++;
+  }
+  target_count = n;
+
+  for (int i = 0; i < target_count; i++)
+  {
+    if (pthread_create(&targets[i].tid, NULL, replicaShipper, &targets[i]) != 0)
+    {
+      errorMsg("Fail to create replica shipper thread");
+    }
+    pthread_detach(targets[i].tid);
+    printf("Replicating to %s:%d\n", targets[i].ip, targets[i].port);
+  }
+}
+
+// Function: append a committed operation to the replication log
+// Blocks while an attached replica is a full log behind, for at most the lag timeout.
+void replicationLog(int op, const char *file_path, int version)
+{
+  if (target_count == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&log_lock);
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += lag_timeout_sec;
+  while (1)
+  {
+    int lagging = 0;
+    for (int i = 0; i < target_count; i++)
+    {
+      lagging |= targets[i].attached && log_head - targets[i].acked >= log_capacity;
+    }
+    if (!lagging)
+    {
+      break;
+    }
+    if (pthread_cond_timedwait(&log_cond, &log_lock, &deadline) == ETIMEDOUT)
+    {
+      for (int i = 0; i < target_count; i++)
+      {
+        if (targets[i].attached && log_head - targets[i].acked >= log_capacity)
+        {
+          targets[i].attached = 0;
+        }
+      }
+    }
+  }
+
+  replEntry *slot = &log_ring[log_head % log_capacity];
+  free(slot->path);
+  slot->seq = log_head++;
+  slot->op = op;
+  slot->path = strdup(file_path);
+  slot->version = version;
+  pthread_cond_broadcast(&log_cond);
+  pthread_mutex_unlock(&log_lock);
+}
+
+// Function: wait until every replica acknowledged the whole log, or until deadline (CLOCK_REALTIME)
+// A detached replica counts once it caught up again. Returns 0 on timeout.
+int replicationFlush(const struct timespec *deadline)
+{
+  pthread_mutex_lock(&log_lock);
+  int flushed = 0;
+  while (1)
+  {
+    flushed = 1;
+    for (int i = 0; i < target_count; i++)
+    {
+      flushed &= targets[i].attached && targets[i].acked == log_head;
+    }
+    if (flushed || pthread_cond_timedwait(&log_cond, &log_lock, deadline) == ETIMEDOUT)
+    {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&log_lock);
+  return flushed;
+}
@@ -0,0 +1,20 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <time.h>
+
+// Operations carried by the replication log
+#define REPL_OP_END 0
+#define REPL_OP_WRITE 1
+#define REPL_OP_RM 2
+#define REPL_OP_PING 3 // no change, shows an idle stream is alive
+
+// Seconds an idle stream waits before a ping; a replica gives up on a
+// primary silent for IDLE_TIMEOUT, but never sooner than three pings
+#define REPLICA_HEARTBEAT_SEC 1
+
+void replicationStart(const char *replica_list, int max_lag, int lag_timeout);
+void replicationLog(int op, const char *file_path, int version);
+int replicationFlush(const struct timespec *deadline);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * sched.c -- Fair pacing of bulk transfers between clients
+ *
+ * Requests fall in two priority classes. Metadata (LS, RM, CATALOG, a GET
+ * answered from the client's cache or fitting in one chunk) is never queued
+ * or paced. Bulk transfers (WRITE data, larger GET data) are:
+ *   - admitted through BULK_SLOTS, kept below WORKERS. A transfer that has
+ *     to wait for a slot first lends its worker back to the pool (the wait
+ *     hook starts a stand-in), so waiting uploads never hold workers and
+ *     some always stay free for metadata;
+ *   - paced by one token bucket per client (peer IP). Its rate is the fair
+ *     share of BULK_RATE among the clients moving data right now, capped by
+ *     CLIENT_RATE, so a client opening many transfers gets no more bandwidth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "config.h"
+#include "sched.h"
+
+typedef struct schedClient
+{
+  char ip[INET_ADDRSTRLEN];
+  int transfers;            // bulk transfers in progress
+  double tokens;            // bytes that may be moved now, negative while in debt
+  struct timespec refilled; // last time tokens were added
+  struct schedClient *next;
+} schedClient;
+
+static schedClient *clients = NULL;
+static int active_clients = 0;
+static int bulk_running = 0;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER;
+
+// Client of the bulk transfer running on this thread, if any
+static __thread schedClient *current = NULL;
+
+// Called before a transfer blocks for a slot
+static void (*slot_wait_hook)(void) = NULL;
+
+// Function: install the hook called before a bulk transfer waits for a slot
+void schedSetWaitHook(void (*hook)(void))
+{
+  slot_wait_hook = hook;
+}
+
+// Helper function:
+// Bytes per second the current client may move, 0 when unlimited
+static long clientRate(void)
+{
+  const rfsConfig *tunables = getTunables();
+  long rate = tunables->client_rate;
+  if (tunables->bulk_rate > 0)
+  {
+    long share = tunables->bulk_rate / (active_clients > 0 ? active_clients : 1);
+    if (share < 1)
+    {
+      share = 1;
+    }
+    if (rate == 0 || share < rate)
+    {
+      rate = share;
+    }
+  }
+  return rate;
+}
+
+// Function: admit a bulk transfer for the peer of client_sock
+// Blocks while BULK_SLOTS transfers are already running, after calling the wait hook.
+void schedBulkBegin(int client_sock)
+{
+  char ip[INET_ADDRSTRLEN] = "";
+  struct sockaddr_in client_addr;
+  socklen_t client_size = sizeof(client_addr);
+  if (getpeername(client_sock, (struct sockaddr *)&client_addr, &client_size) == 0)
+  {
+    inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof(ip));
+  }
+
+  pthread_mutex_lock(&sched_lock);
+  int slots = getTunables()->bulk_slots;
+  int hooked = 0;
+  while (slots > 0 && bulk_running >= slots)
+  {
+    if (!hooked && slot_wait_hook != NULL)
+    {
+      pthread_mutex_unlock(&sched_lock);
+      slot_wait_hook();
+      hooked = 1;
+      pthread_mutex_lock(&sched_lock);
+      continue;
+    }
+    pthread_cond_wait(&slot_free, &sched_lock);
+  }
+  bulk_running++;
+
+  schedClient *client = clients;
+  while (client != NULL && strcmp(client->ip, ip) != 0)
+  {
+    client = client->next;
+  }
+  if (client == NULL)
+  {
+    // A new client may send its first chunk right away
+    client = (schedClient *)calloc(1, sizeof(schedClient));
+    if (client != NULL)
+    {
+      strcpy(client->ip, ip);
+      client->tokens = getTunables()->io_buffer_size;
+      clock_gettime(CLOCK_MONOTONIC, &client->refilled);
+      client->next = clients;
+      clients = client;
+    }
+  }
+  if (client != NULL && client->transfers++ == 0)
+  {
+    active_clients++;
+  }
+  current = client;
+  pthread_mutex_unlock(&sched_lock);
+}
+
+// Function: end the bulk transfer of this thread, freeing its slot
+void schedBulkEnd(void)
+{
+  pthread_mutex_lock(&sched_lock);
+  bulk_running--;
+  pthread_cond_signal(&slot_free);
+  if (current != NULL && --current->transfers == 0)
+  {
+    active_clients--;
+    schedClient **link = &clients;
+    while (*link != current)
+    {
+      link = &(*link)->next;
+    }
+    *link = current->next;
+    free(current);
+  }
+  current = NULL;
+  pthread_mutex_unlock(&sched_lock);
+}
+
+// Function: transfer pacer, charges bytes to the client of this thread
+// and sleeps until its bucket is out of debt.
+void schedPace(size_t bytes)
+{
+  if (current == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&sched_lock);
+  long rate = clientRate();
+  if (rate == 0)
+  {
+    pthread_mutex_unlock(&sched_lock);
+    return;
+  }
+
+  // Refill for the time since the last chunk; at most one chunk may be saved up
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - current->refilled.tv_sec) + (now.tv_nsec - current->refilled.tv_nsec) / 1e9;
+  double burst = getTunables()->io_buffer_size;
+  current->tokens += elapsed * rate;
+  if (current->tokens > burst)
+  {
+    current->tokens = burst;
+  }
+  current->refilled = now;
+  current->tokens -= (double)bytes;
+  double wait = current->tokens < 0 ? -current->tokens / rate : 0;
+  pthread_mutex_unlock(&sched_lock);
+
+  if (wait > 0)
+  {
+    struct timespec pause = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+    nanosleep(&pause, NULL);
+  }
+}
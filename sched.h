@@ -0,0 +1,11 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+
+void schedSetWaitHook(void (*hook)(void));
+void schedBulkBegin(int client_sock);
+void schedBulkEnd(void);
+void schedPace(size_t bytes);
+
+#endif
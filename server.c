@@ -14,13 +14,99 @@
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
 #include "helper.h"
+#include "config.h"
+#include "replica.h"
+#include "handoff.h"
+#include "sched.h"
+#include "history.h"
+#include "catalog.h"
+#include "trace.h"
+#include "arena.h"
+#include "store.h"
+#include "diff.h"
+#include "watch.h"
+#include "names.h"
+#include "tier.h"
+#include "deadline.h"
 
-#define PORT_NUMBER 1500
 #define MAX_BUFFER_SIZE 1024
 #define VER_BUFFER_SIZE 256
-#define VERSION_PATH ".file_VERSION"
 #define LOCK_FILE ".file_LOCK"
+#define CATALOG_LOCK_FILE ".file_CATALOG_LOCK"
+#define MAX_ACCEPTORS 64
+#define CLIENT_QUEUE_SIZE 1024
+
+// Serializes version assignment and every rewrite of the version info file,
+// across threads (mutex) and across processes during an upgrade (flock)
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
+static int catalog_lock_desc = -1;
+
+// Set on replicas: client WRITE and RM are refused, changes only come from the primary
+static int read_only = 0;
+
+// Listening sockets, one per acceptor thread
+static int listeners[MAX_ACCEPTORS];
+static int listener_count = 0;
+
+// Connection drain: once set, acceptors stop and the process exits when
+// in-flight requests are done (or the drain timeout expires)
+static volatile int draining = 0;
+static int inflight = 0;
+static int wake_pipe[2] = {-1, -1};
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cond = PTHREAD_COND_INITIALIZER;
+
+// Accepted connection waiting for a worker, and the span of its wait
+typedef struct
+{
+  int client_sock;
+  traceSpan waiting;
+  struct timespec queued; // CLOCK_MONOTONIC, counts against IDLE_TIMEOUT
+} queuedClient;
+
+// Accepted connections waiting for a worker (WORKERS>0)
+static queuedClient client_queue[CLIENT_QUEUE_SIZE];
+static int queue_start = 0, queue_count = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+
+// A worker about to wait for a bulk slot hands its place in the pool to a
+// stand-in and retires once its request is done, so WORKERS threads always
+// serve the queue
+static __thread int pool_worker = 0; // this thread serves the queue
+static __thread int lent_out = 0;    // its place in the pool went to a stand-in
+
+// Helper function:
+// Take the catalog lock, shared with a predecessor or successor process
+void catalogLock(void)
+{
+  traceSpan span = traceStart("catalog lock wait");
+  pthread_mutex_lock(&catalog_lock);
+  if (catalog_lock_desc >= 0)
+  {
+    flock(catalog_lock_desc, LOCK_EX);
+  }
+  traceStop(span);
+}
+
+// Helper function:
+// Release the catalog lock
+void catalogUnlock(void)
+{
+  if (catalog_lock_desc >= 0)
+  {
+    flock(catalog_lock_desc, LOCK_UN);
+  }
+  pthread_mutex_unlock(&catalog_lock);
+}
 
 // Helper function: 
 // Send error message to client
@@ -33,23 +119,31 @@ void sendError(int client_sock, const char *msgs)
 // Helper function (Question 4)
 // Create a file lock for the file directory to avoid data corruption,
 // also prevents multiple clients from writing to the same file simultaneously.
-int createLock(char *directory, char **lock_path)
+// The lock path is allocated from the request arena.
+int createLock(const char *file_path, char **lock_path)
 {
-  if (directory == NULL)
+  traceSpan span = traceStart("createLock");
+  // +2 for the '/' and the null terminator
+  *lock_path = (char *)arenaAlloc(strlen(file_path) + strlen(LOCK_FILE) + 2);
+  if (*lock_path == NULL)
+  {
+    traceStop(span);
+    return 0;
+  }
+  const char *slash = strrchr(file_path, '/');
+  if (slash == NULL || slash == file_path)
   {
-    *lock_path = (char *)malloc(strlen(LOCK_FILE));
     strcpy(*lock_path, LOCK_FILE);
   }
   else
   {
-    *lock_path = (char *)malloc(strlen(directory) + strlen(LOCK_FILE) + 1);
-    sprintf(*lock_path, "%s/%s", directory, LOCK_FILE);
-    free(directory);
+    sprintf(*lock_path, "%.*s/%s", (int)(slash - file_path), file_path, LOCK_FILE);
   }
 
   // When lock already exists in current folder
   if (isValidFile(*lock_path))
   {
+    traceStop(span);
     return 0;
   }
 
@@ -57,124 +151,134 @@ int createLock(char *directory, char **lock_path)
   FILE *lockfilePointer = fopen(*lock_path, "w");
   if (lockfilePointer == NULL)
   {
+    traceStop(span);
     return 0;
   }
   fclose(lockfilePointer);
 
+  traceStop(span);
   return 1;
 }
 
-// Function: retreive the latest version number from file name
-int getNewVer(const char *file_name)
+// Helper function:
+// Drain the file data of a refused WRITE so the stream stays aligned
+long discardFileData(int client_sock)
 {
-  FILE *filePointer = fopen(VERSION_PATH, "r");
-  if (filePointer == NULL)
-  {
-    errorMsg("Error opening version info file");
-  }
-  char line[VER_BUFFER_SIZE];
-  // reads the file line by line and store in array
-  while (fgets(line, VER_BUFFER_SIZE, filePointer))
+  FILE *devNull = fopen("/dev/null", "w");
+  if (devNull == NULL)
   {
-    // split the line by '=' to get file name and version number
-    char *equals = strchr(line, '=');
-    if (equals != NULL)
-    {
-      *equals = '\0'; // replace '=' with a null character
-      if (strcmp(line, file_name) == 0)
-      {
-        fclose(filePointer);
-        return atoi(equals + 1); // update version number by 1
-      }
-    }
+    return -1;
   }
-  fclose(filePointer);
-  return 0;
+  long len = receiveFileData(client_sock, devNull);
+  fclose(devNull);
+  return len;
 }
 
-// Function: update the latest version by file name
-// Either appends a new version entry if it's the first version
-// or udpates the existing entry for subsequent versions.
-void updateNewVer(const char *file_name, int versionNumber)
+// Helper function:
+// Store the file data streamed by the client as the next version of local_file,
+// describing the outcome in response.
+// Returns 1 when stored, 0 when refused (the data was drained), -1 when the stream broke.
+int writeVersion(int client_sock, const char *local_file, char *response)
 {
-  FILE *filePointer = fopen(VERSION_PATH, versionNumber == 1 ? "a" : "r+");
-  if (filePointer == NULL)
+  if (read_only)
   {
-    errorMsg("Fail to open the version file");
+    strcpy(response, "Read-only replica, send WRITE to the primary");
+    return discardFileData(client_sock) < 0 ? -1 : 0;
   }
 
-  // append new verson info if first version
-  if (versionNumber == 1)
+  // Folders of a new path are created on the way (SYNC uploads whole trees)
+  makeParentDirs(local_file);
+
+  // Lock the current directory to avoid concurrent modification 
+  char *lock_path;
+
+  // if the lock already exists (another client is writing to the file), 
+  // the function returns an error, thus preventing concurrent writes. (Question 4)
+  if (!createLock(local_file, &lock_path))
   {
-    fprintf(filePointer, "%s=%d\n", file_name, versionNumber);
-    fclose(filePointer);
-    return;
+    strcpy(response, "Fail to create file lock");
+    return discardFileData(client_sock) < 0 ? -1 : 0;
   }
 
-  char fileKey[strlen(file_name) + 1];
-  sprintf(fileKey, "%s=", file_name);
-  char line[VER_BUFFER_SIZE];
-
-  // read file line by line
-  while (fgets(line, VER_BUFFER_SIZE, filePointer))
+  // (Question 5) Find the latest version number 
+  char *file_name = (char *)arenaAlloc(strlen(local_file) + VERSION_NAME_EXTRA);
+  if (file_name == NULL)
   {
-    if (strncmp(line, fileKey, strlen(fileKey)) == 0)
-    {
-      // Rewind the file pointer to the beginning of the line
-      fseek(filePointer, -strlen(line), SEEK_CUR);
+    strcpy(response, "Fail allocating memory");
+    remove(lock_path);
+    return discardFileData(client_sock) < 0 ? -1 : 0;
+  }
 
-      // Replace the old version with the new version
-      fprintf(filePointer, "%s%d\n", fileKey, versionNumber);
+  // The folder lock keeps the number ours until the version is committed below,
+  // so a refused or broken WRITE never leaves a number without its file
+  int versionNumber = 0;
+  catalogLock();
+  if (isValidFile(local_file))
+  {
+    versionNumber = getNewVer(local_file) + 1;
+  }
+  catalogUnlock();
+  createFileName(file_name, local_file, versionNumber);
 
-      // Move the file pointer back to where it was
-      fseek(filePointer, 0, SEEK_CUR);
-      break;
-    }
+  // Open local file
+  FILE *filePointer = fopen(file_name, "w");
+  if (filePointer == NULL)
+  {
+    strcpy(response, "Error opening remote file for writing");
+    remove(lock_path);
+    return discardFileData(client_sock) < 0 ? -1 : 0;
   }
 
+  // Stream the content straight to disk, paced as a bulk transfer
+  traceSpan payload_span = traceStart("receive payload");
+  char checksum[CHECKSUM_SIZE];
+  schedBulkBegin(client_sock);
+  long len = receiveFileDataChecksum(client_sock, filePointer, checksum);
+  schedBulkEnd();
+  traceStop(payload_span);
+  traceSpan close_span = traceStart("disk flush");
   fclose(filePointer);
-}
+  traceStop(close_span);
 
-// Function: remove version info related to a file name
-void removeVersionInfo(const char *file_name)
-{
-  FILE *filePointer = fopen(VERSION_PATH, "r");
-  if (filePointer == NULL)
+  // A complete version is committed: recorded in the version info file (version 0
+  // as well, so it lists every stored file), with its commit time and name indexed.
+  // A client that vanished or was evicted leaves nothing behind.
+  traceSpan commit_span = traceStart("commit");
+  if (len >= 0)
   {
-    errorMsg("Fail to open version file");
+    storeRecordChecksum(local_file, versionNumber, checksum);
+    catalogLock();
+    updateNewVer(local_file, versionNumber);
+    historyRecord(local_file, versionNumber);
+    namesUpdate(local_file, versionNumber);
+    // Handed to the replicas and watchers in commit order
+    replicationLog(REPL_OP_WRITE, local_file, versionNumber);
+    watchPublish(WATCH_OP_WRITE, local_file, versionNumber);
+    catalogUnlock();
   }
-
-  FILE *temp = fopen(".temp", "w");
-  if (temp == NULL)
+  else
   {
-    errorMsg("Fail to create temp file");
+    remove(file_name);
   }
 
-  char fileKey[strlen(file_name) + 1];
-  sprintf(fileKey, "%s=", file_name);
-  char line[VER_BUFFER_SIZE];
-
-  while (fgets(line, VER_BUFFER_SIZE, filePointer))
+  // Release the file lock
+  int unlocked = remove(lock_path) == 0;
+  traceStop(commit_span);
+  if (len < 0)
   {
-    if (strncmp(line, fileKey, strlen(fileKey)) != 0)
-    {
-      // Copy lines other than the one to be removed to the temporary file
-      fprintf(temp, "%s", line);
-    }
+    strcpy(response, "Error receiving file data");
+    return -1;
   }
 
-  // Close files
-  fclose(filePointer);
-  fclose(temp);
-
-  // Replace the original file with the temporary file
-  if (rename(".temp", VERSION_PATH) != 0)
+  if (!unlocked)
   {
-    errorMsg("Fail to replace version info");
+    strcpy(response, "Error removing the lock");
+    return 0;
   }
-}
-
 
+  snprintf(response, MAX_BUFFER_SIZE, "Successfully writing to file '%s'", file_name);
+  return 1;
+}
 
 // Question 1
 // Function: Write from the server side
@@ -182,174 +286,353 @@ void operateWrite(int client_sock)
 {
   // Receive client's remote file path
   char *local_file;
-  if (!receiveText(client_sock, &local_file))
+  if (!receiveTextWith(client_sock, &local_file, arenaAlloc))
   {
     sendError(client_sock, "Invalid local file path.");
     return;
   }
 
-  // (Question 5) Find the latest version number 
-  char *file_name = (char *)malloc(strlen(local_file) + 3); // 2 for versioning, 1 for null terminator
-  if (file_name == NULL)
+  if (read_only)
   {
-    sendError(client_sock, "Fail allocating memory"); // send error message to client socket descriptor
+    sendError(client_sock, "Read-only replica, send WRITE to the primary");
     return;
   }
 
-  if (!isValidFile(local_file))
+  char response[MAX_BUFFER_SIZE];
+  int stored = writeVersion(client_sock, local_file, response);
+  traceSpan response_span = traceStart("send response");
+  if (stored == 1)
   {
-    createFileName(file_name, local_file, 0); // create new file if file invalid
+    sendText(client_sock, response);
   }
   else
   {
-    int versionNumber = getNewVer(local_file) + 1;
-    createFileName(file_name, local_file, versionNumber);
-    updateNewVer(local_file, versionNumber);
+    sendError(client_sock, response);
   }
+  traceStop(response_span);
+}
 
-  // Lock the current directory to avoid concurrent modification 
-  char *prefix = getFilePrefix(local_file, '/');
+// Function: write several files over one connection
+// The client streams a count, then each remote path and its data; the outcome
+// of every item is reported as soon as it is stored: index, status, message.
+void operateMultiWrite(int client_sock)
+{
+  int count;
+  if (!recvAll(client_sock, &count, sizeof(count)) || count < 0)
+  {
+    return;
+  }
+
+  int stored = 0;
+  for (int i = 0; i < count; i++)
+  {
+    char *local_file;
+    if (!receiveTextWith(client_sock, &local_file, arenaAlloc))
+    {
+      return;
+    }
+    char response[MAX_BUFFER_SIZE];
+    int result = writeVersion(client_sock, local_file, response);
+    if (result < 0)
+    {
+      perror(response);
+      return;
+    }
+    int status = result == 1 ? MWRITE_STATUS_STORED : MWRITE_STATUS_ERROR;
+    stored += result;
+    if (!sendAll(client_sock, &i, sizeof(i)) || !sendAll(client_sock, &status, sizeof(status)) ||
+        !sendText(client_sock, response))
+    {
+      return;
+    }
+  }
+
+  char response[VER_BUFFER_SIZE];
+  sprintf(response, "Stored %d of %d file(s)", stored, count);
+  sendText(client_sock, response);
+}
+
+// Helper function:
+// Store the bytes streamed by the client as the next version of local_file,
+// written at offset of the latest version (STORE_APPEND: at its end). The new
+// version references the unchanged extents of the latest one (copy-on-write),
+// so only the new bytes are written to disk.
+// Returns 1 when stored, 0 when refused (the data was drained), -1 when the stream broke.
+int writeDelta(int client_sock, const char *local_file, long long offset, char *response)
+{
+  if (read_only)
+  {
+    strcpy(response, "Read-only replica, send APPEND and PATCH to the primary");
+    return discardFileData(client_sock) < 0 ? -1 : 0;
+  }
+
+  // Lock the directory first: the latest version must not change under the new one
   char *lock_path;
+  if (!createLock(local_file, &lock_path))
+  {
+    strcpy(response, "Fail to create file lock");
+    return discardFileData(client_sock) < 0 ? -1 : 0;
+  }
 
-  // if the lock already exists (another client is writing to the file), 
-  // the function returns an error, thus preventing concurrent writes. (Question 4)
-  if (!createLock(prefix, &lock_path))
+  traceSpan resolve_span = traceStart("resolve version");
+  catalogLock();
+  int baseVersion = isValidFile(local_file) ? getNewVer(local_file) : -1;
+  catalogUnlock();
+  long long base_length = baseVersion < 0 ? -1 : storeLength(local_file, baseVersion);
+  traceStop(resolve_span);
+  int refused = 1;
+  if (base_length < 0)
   {
-    sendError(client_sock, "Fail to create file lock");
-    return;
+    strcpy(response, "Remote file not found, WRITE it first");
+  }
+  else if (offset != STORE_APPEND && (offset < 0 || offset > base_length))
+  {
+    sprintf(response, "Offset %lld is outside the file (%lld bytes)", offset, base_length);
+  }
+  else
+  {
+    refused = 0;
+  }
+  if (refused)
+  {
+    remove(lock_path);
+    return discardFileData(client_sock) < 0 ? -1 : 0;
   }
 
-  // Open local file
-  FILE *filePointer = fopen(file_name, "w");
+  int versionNumber = baseVersion + 1;
+  FILE *filePointer = storeBeginDelta(local_file, versionNumber);
   if (filePointer == NULL)
   {
-    sendError(client_sock, "Error opening remote file for writing");
-    return;
+    strcpy(response, "Error opening remote file for writing");
+    remove(lock_path);
+    return discardFileData(client_sock) < 0 ? -1 : 0;
   }
 
-  char *buffer;
-  int len = receiveText(client_sock, &buffer);
-  if (len)
+  // Only the new bytes travel and reach the disk
+  traceSpan payload_span = traceStart("receive payload");
+  schedBulkBegin(client_sock);
+  long len = receiveFileData(client_sock, filePointer);
+  schedBulkEnd();
+  traceStop(payload_span);
+
+  traceSpan commit_span = traceStart("commit");
+  int stored = len >= 0 && storeCommitDelta(filePointer, local_file, baseVersion, versionNumber, offset, len);
+  char file_name[strlen(local_file) + VERSION_NAME_EXTRA];
+  createFileName(file_name, local_file, versionNumber);
+  if (stored)
   {
-    fwrite(buffer, 1, len, filePointer);
+    catalogLock();
+    updateNewVer(local_file, versionNumber);
+    historyRecord(local_file, versionNumber);
+    namesUpdate(local_file, versionNumber);
+    replicationLog(REPL_OP_WRITE, local_file, versionNumber);
+    watchPublish(WATCH_OP_WRITE, local_file, versionNumber);
+    catalogUnlock();
   }
   else
   {
-    return;
+    if (len < 0)
+    {
+      fclose(filePointer);
+    }
+    remove(file_name);
   }
+  remove(lock_path);
+  traceStop(commit_span);
 
-  // Release the file lock
-  if (remove(lock_path) != 0)
+  if (len < 0)
+  {
+    strcpy(response, "Error receiving file data");
+    return -1;
+  }
+  if (!stored)
+  {
+    strcpy(response, "Error storing the new version");
+    return 0;
+  }
+  snprintf(response, MAX_BUFFER_SIZE, "Successfully stored %ld new byte(s) as '%s'", len, file_name);
+  return 1;
+}
+
+// Function: APPEND and PATCH from the server side
+// The client sends the remote path, for PATCH the offset to write at, then the new bytes.
+void operateDelta(int client_sock, int patch)
+{
+  char *local_file;
+  if (!receiveTextWith(client_sock, &local_file, arenaAlloc))
+  {
+    sendError(client_sock, "Invalid local file path.");
+    return;
+  }
+  long long offset = STORE_APPEND;
+  if (patch && !recvAll(client_sock, &offset, sizeof(offset)))
   {
-    sendError(client_sock, "Error removing the lock");
+    sendError(client_sock, "Error receiving patch offset");
     return;
   }
 
   char response[MAX_BUFFER_SIZE];
-  sprintf(response, "Successfully writing to file '%s'", file_name);
-  sendText(client_sock, response);
-
-  // Free memory 
-  free(buffer);
-  free(lock_path);
-  free(local_file);
-  free(file_name);
+  int stored = writeDelta(client_sock, local_file, offset, response);
+  traceSpan response_span = traceStart("send response");
+  if (stored == 1)
+  {
+    sendText(client_sock, response);
+  }
+  else
+  {
+    sendError(client_sock, response);
+  }
+  traceStop(response_span);
+}
 
-  // Close the file
-  fclose(filePointer);
+// Helper function:
+// Report a failed GET: error status first, then the message
+void sendGetError(int client_sock, const char *msgs)
+{
+  int status = GET_STATUS_ERROR;
+  sendAll(client_sock, &status, sizeof(status));
+  sendError(client_sock, msgs);
 }
 
 // Question 2
 // Function: Get operation from the server side
+// Conditional GET: the client sends the checksum of its cached copy (or NO_CHECKSUM),
+// and receives GET_STATUS_NOT_MODIFIED instead of the data when it still matches.
 void operateGet(int client_sock)
 {
   // Receive client's remote file path
   char *local_file;
-  if (!receiveText(client_sock, &local_file))
+  if (!receiveTextWith(client_sock, &local_file, arenaAlloc))
   {
-    sendError(client_sock, "Error receiving file path for reading");
+    sendGetError(client_sock, "Error receiving file path for reading");
     return;
   }
 
   // Get version number of file
   int versionNumber;
-  if (recv(client_sock, &versionNumber, sizeof(versionNumber), 0) < 0)
+  if (!recvAll(client_sock, &versionNumber, sizeof(versionNumber)))
   {
-    sendError(client_sock, "Error receiving version number");
+    sendGetError(client_sock, "Error receiving version number");
     return;
   }
+  traceSpan resolve_span = traceStart("resolve version");
   if (versionNumber == -1)
   {
     // No appointed version number -> use the latest version
     versionNumber = getNewVer(local_file);
   }
+  else if (versionNumber == GET_VERSION_AT_TIME)
+  {
+    // Point-in-time read: the version committed last at or before the given time
+    long long at;
+    if (!recvAll(client_sock, &at, sizeof(at)))
+    {
+      sendGetError(client_sock, "Error receiving snapshot time");
+      return;
+    }
+    versionNumber = historyLookup(local_file, at);
+    if (versionNumber < 0)
+    {
+      sendGetError(client_sock, "No version of the file existed at that time");
+      return;
+    }
+  }
+  traceStop(resolve_span);
+
+  // Get the checksum of the client's cached copy
+  char *cached_checksum;
+  if (!receiveTextWith(client_sock, &cached_checksum, arenaAlloc))
+  {
+    sendGetError(client_sock, "Error receiving cached checksum");
+    return;
+  }
 
   // Get the corresponding version of the given file (Question 7)
-  char *file_name = (char *)malloc(strlen(local_file) + 3);
+  char *file_name = (char *)arenaAlloc(strlen(local_file) + VERSION_NAME_EXTRA);
   if (file_name == NULL)
   {
-    sendError(client_sock, "Error allocating memory");
+    sendGetError(client_sock, "Error allocating memory");
     return;
   }
 
   createFileName(file_name, local_file, versionNumber);
 
-  // Open local file
-  FILE *filePointer = fopen(file_name, "r");
-  if (filePointer == NULL)
+  // The checksum recorded with the version, so a current cached copy costs no disk read
+  char checksum[CHECKSUM_SIZE];
+  traceSpan checksum_span = traceStart("checksum");
+  int checked = storeChecksum(local_file, versionNumber, checksum);
+  traceStop(checksum_span);
+  if (!checked)
   {
-    sendError(client_sock, "Error opening remote file for reading");
+    sendGetError(client_sock, "Error opening remote file for reading");
     return;
   }
+  int status = strcmp(cached_checksum, checksum) == 0 ? GET_STATUS_NOT_MODIFIED : GET_STATUS_DATA;
 
-  // Read from the local file and write to the remote file
-  char buffer[MAX_BUFFER_SIZE];
-  size_t bytesRead = fread(buffer, 1, sizeof(buffer), filePointer);
-  if (bytesRead == 0)
+  // Open the version, whole or gathered from its extents
+  FILE *filePointer = NULL;
+  if (status == GET_STATUS_DATA && (filePointer = storeOpen(local_file, versionNumber)) == NULL)
   {
-    sendError(client_sock, "Error reading data from remote file");
+    sendGetError(client_sock, "Error opening remote file for reading");
     return;
   }
 
-  buffer[bytesRead] = '\0';
-  if (!sendText(client_sock, buffer))
+  // Tell the client which version it gets and whether its cached copy is still current
+  sendAll(client_sock, &status, sizeof(status));
+  sendAll(client_sock, &versionNumber, sizeof(versionNumber));
+  sendText(client_sock, checksum);
+
+  // Read from the local file and stream it to the client
+  // Anything larger than one chunk is a bulk transfer and gets paced.
+  if (status == GET_STATUS_DATA)
   {
-    sendError(client_sock, "Error sending data to client");
-    return;
+    int bulk = fileLength(filePointer) > getTunables()->io_buffer_size;
+    if (bulk)
+    {
+      schedBulkBegin(client_sock);
+    }
+    int sent = sendFileData(client_sock, filePointer);
+    if (bulk)
+    {
+      schedBulkEnd();
+    }
+    if (!sent)
+    {
+      perror("Error sending data to client");
+      fclose(filePointer);
+      return;
+    }
   }
 
   // Send response to the client
   char response[VER_BUFFER_SIZE];
-  sprintf(response, "Successfully reading from file '%s'", file_name);
-  sendText(client_sock, response);
-
-  // Free memory and close file
-  free(local_file);
-  free(file_name);
-  fclose(filePointer);
-}
-
-// Function: remove operation from the server side
-void operateRemove(int client_sock)
-{
-  // Receive client's remote file path
-  char *local_path;
-  if (!receiveText(client_sock, &local_path))
+  if (status == GET_STATUS_NOT_MODIFIED)
   {
-    return;
+    snprintf(response, sizeof(response), "File '%s' not modified", file_name);
+  }
+  else
+  {
+    snprintf(response, sizeof(response), "Successfully reading from file '%s'", file_name);
   }
+  sendText(client_sock, response);
 
-  char *file_name = (char *)malloc(strlen(local_path) + 3);
-  if (file_name == NULL)
+  // Close file
+  if (filePointer != NULL)
   {
-    sendError(client_sock, "Error allocating memory");
-    return;
+    fclose(filePointer);
   }
+}
 
-  // The response to be returned:
-  char response[MAX_BUFFER_SIZE];
+// Helper function:
+// Remove every version of a file (or a folder) and its version info,
+// describing the outcome for each version in response
+void removeAllVersions(const char *local_path, char *response)
+{
+  char file_name[strlen(local_path) + VERSION_NAME_EXTRA];
+  response[0] = '\0';
 
   // Find all versions of the file to remove
+  catalogLock();
   int versionNumber = getNewVer(local_path);
   for (int i = 0; i <= versionNumber; i++)
   {
@@ -357,40 +640,57 @@ void operateRemove(int client_sock)
     if (!isValidFile(file_name))
     {
       char warning[VER_BUFFER_SIZE];
-      sprintf(warning, "File '%s' not exist\n", file_name);
-      strcat(response, warning);
+      snprintf(warning, sizeof(warning), "File '%s' not exist\n", file_name);
+      strncat(response, warning, MAX_BUFFER_SIZE - strlen(response) - 1);
       continue;
     }
-    // Use the system command to execute the remove operation
-    char command[VER_BUFFER_SIZE];
-    sprintf(command, "rm -rf %s", file_name);
+    // Remove the version file, or the folder, with any cold copies
     char message[VER_BUFFER_SIZE];
-    if (system(command) == 0)
+    if (tierRemove(file_name))
     {
-      sprintf(message, "File '%s' is removed successfully\n", file_name);
+      snprintf(message, sizeof(message), "File '%s' is removed successfully\n", file_name);
     }
     else
     {
-      sprintf(message, "Error removing file '%s'\n", file_name);
+      snprintf(message, sizeof(message), "Error removing file '%s'\n", file_name);
     }
-    strcat(response, message);
+    strncat(response, message, MAX_BUFFER_SIZE - strlen(response) - 1);
+  }
+
+  // Remove related version info and commit history
+  removeVersionInfo(local_path);
+  historyForget(local_path);
+  namesRemove(local_path);
+  replicationLog(REPL_OP_RM, local_path, 0);
+  watchPublish(WATCH_OP_RM, local_path, 0);
+  catalogUnlock();
+}
+
+// Function: remove operation from the server side
+void operateRemove(int client_sock)
+{
+  // Receive client's remote file path
+  char *local_path;
+  if (!receiveTextWith(client_sock, &local_path, arenaAlloc))
+  {
+    return;
   }
 
-  // Remove related version info
-  if (versionNumber > 0)
+  if (read_only)
   {
-    removeVersionInfo(local_path);
+    sendError(client_sock, "Read-only replica, send RM to the primary");
+    return;
   }
 
+  // The response to be returned:
+  char response[MAX_BUFFER_SIZE];
+  removeAllVersions(local_path, response);
+
   // Trim new line character
   response[strlen(response) - 1] = '\0';
 
   // Send response to the client
   sendText(client_sock, response);
-
-  // Free memory
-  free(local_path);
-  free(file_name);
 }
 
 // Function: list operation from the server side
@@ -398,12 +698,12 @@ void operateList(int client_sock)
 {
   // Receive client's remote file path
   char *local_file;
-  if (!receiveText(client_sock, &local_file))
+  if (!receiveTextWith(client_sock, &local_file, arenaAlloc))
   {
     return;
   }
 
-  char *file_name = (char *)malloc(strlen(local_file) + 3);
+  char *file_name = (char *)arenaAlloc(strlen(local_file) + VERSION_NAME_EXTRA);
   if (file_name == NULL)
   {
     sendError(client_sock, "Error allocating memory");
@@ -412,7 +712,7 @@ void operateList(int client_sock)
 
   // The response to be returned:
   char response[MAX_BUFFER_SIZE];
-  sprintf(response, "Versioning Information about %s:\n\n", local_file);
+  snprintf(response, sizeof(response), "Versioning Information about %s:\n\n", local_file);
 
   // Find all versions of the file to list
   int versionNumber = getNewVer(local_file);
@@ -422,9 +722,9 @@ void operateList(int client_sock)
     if (!isValidFile(file_name))
     {
       char warning[VER_BUFFER_SIZE];
-      sprintf(warning, "File '%s' not exist\n", file_name);
+      snprintf(warning, sizeof(warning), "File '%s' not exist\n", file_name);
       perror(warning);
-      strcat(response, warning);
+      strncat(response, warning, sizeof(response) - strlen(response) - 1);
       continue;
     }
 
@@ -433,9 +733,9 @@ void operateList(int client_sock)
     if (stat(file_name, &file_stat) < 0)
     {
       char warning[VER_BUFFER_SIZE];
-      sprintf(warning, "Error getting information about file '%s'", file_name);
+      snprintf(warning, sizeof(warning), "Error getting information about file '%s'", file_name);
       perror(warning);
-      strcat(response, warning);
+      strncat(response, warning, sizeof(response) - strlen(response) - 1);
       continue;
     }
 
@@ -446,7 +746,7 @@ void operateList(int client_sock)
              v,
              ctime(&file_stat.st_mtime));
 
-    strcat(response, version_info);
+    strncat(response, version_info, sizeof(response) - strlen(response) - 1);
   }
 
   // Trim new line character
@@ -454,142 +754,1294 @@ void operateList(int client_sock)
 
   // Send versioning information to the client
   sendText(client_sock, response);
-
-  // Free memory
-  free(local_file);
-  free(file_name);
-}
-
-// Function: Exit operation from the server side
-void operateExit(int client_sock, int socket_desc)
-{
-  sendText(client_sock, "Server terminated by client");
-  shutdown(client_sock, SHUT_RDWR);
-  close(client_sock);
-  close(socket_desc);
-  exit(EXIT_SUCCESS);
 }
 
-// Functions: handles each client's request in a multi-threaded TCP server
-void *clientTaskExecutor(void *arg)
+// Helper function:
+// Store one version shipped by the primary under its original version number
+// Returns 1 when applied, 0 when refused, -1 when the stream is broken.
+int applyReplicatedWrite(int client_sock, const char *file_path, int versionNumber)
 {
-  int *sockets = (int *)arg;
-  int client_sock = sockets[0], socket_desc = sockets[1];
-
-  // Receive client's action string
-  char *action;
-  if (!receiveText(client_sock, &action))
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  char temp_name[sizeof(file_name) + 8];
+  createFileName(file_name, file_path, versionNumber);
+  sprintf(temp_name, "%s.repl", file_name);
+
+  // Always drain the data so the stream stays aligned, even if it cannot be stored
+  makeParentDirs(file_path);
+  FILE *filePointer = fopen(temp_name, "w");
+  int stored = filePointer != NULL;
+  if (!stored)
   {
-    return NULL;
-  }
-
-  if (strcmp(action, "WRITE") == 0)
-  { // Question 1
-    operateWrite(client_sock);
-  }
-  else if (strcmp(action, "GET") == 0)
-  { // Question 2
-    operateGet(client_sock);
-  }
-  else if (strcmp(action, "RM") == 0)
-  { // Question 3
-    operateRemove(client_sock);
-  }
-  else if (strcmp(action, "LS") == 0)
-  { // Question 6
-    operateList(client_sock);
+    filePointer = fopen("/dev/null", "w");
   }
-  else if (strcmp(action, "EXIT") == 0)
-  { // Turn off the server
-    free(action);
-    operateExit(client_sock, socket_desc);
+  char checksum[CHECKSUM_SIZE];
+  if (filePointer == NULL || receiveFileDataChecksum(client_sock, filePointer, checksum) < 0)
+  {
+    if (filePointer != NULL)
+    {
+      fclose(filePointer);
+    }
+    remove(temp_name);
+    return -1;
   }
-  else
+  fclose(filePointer);
+  if (!stored || rename(temp_name, file_name) != 0)
   {
-    perror("Invalid action");
+    remove(temp_name);
+    return 0;
   }
+  storeRecordChecksum(file_path, versionNumber, checksum);
 
-  free(action);
-
-  // Close the client socket before exiting the thread
-  close(client_sock);
-
-  // Exit the thread
-  pthread_exit(NULL);
+  catalogLock();
+  if (versionNumber >= getNewVer(file_path))
+  {
+    updateNewVer(file_path, versionNumber);
+  }
+  historyRecord(file_path, versionNumber);
+  namesUpdate(file_path, versionNumber);
+  // Passed on to our own replicas, if any
+  replicationLog(REPL_OP_WRITE, file_path, versionNumber);
+  watchPublish(WATCH_OP_WRITE, file_path, versionNumber);
+  catalogUnlock();
+  return 1;
 }
 
-// Main function
-int main(void)
+// Function: send the list of stored files and their latest versions
+void operateCatalog(int client_sock)
 {
-  int socket_desc, client_sock;
-  socklen_t client_size;
-  struct sockaddr_in server_addr, client_addr;
+  char *catalog = readCatalog();
+  if (catalog == NULL)
+  {
+    sendError(client_sock, "Error reading version info");
+    return;
+  }
+  sendText(client_sock, catalog);
+  free(catalog);
+}
 
-  // Create socket:
-  socket_desc = socket(AF_INET, SOCK_STREAM, 0);
+// One MGET request, shared by its reader threads
+typedef struct
+{
+  int client_sock;
+  int count;
+  char **paths;
+  char **cached_checksums;
+  char *catalog;          // latest versions, read once for the whole batch
+  int next;               // next item to pick up
+  int broken;             // the client went away, stop reading
+  pthread_mutex_t lock;   // guards next
+  pthread_mutex_t send_lock; // one item at a time on the socket
+} mgetBatch;
+
+// Helper function:
+// Send the reply header of one MGET item; caller holds send_lock
+int sendMgetHeader(int client_sock, int index, int status, int versionNumber, const char *checksum)
+{
+  return sendAll(client_sock, &index, sizeof(index)) && sendAll(client_sock, &status, sizeof(status)) &&
+         sendAll(client_sock, &versionNumber, sizeof(versionNumber)) && sendText(client_sock, checksum);
+}
 
-  if (socket_desc < 0)
+// Helper function:
+// Read one MGET item from disk and stream its reply
+// Files up to MGET_PREFETCH_SIZE are read into memory before taking the socket,
+// so readers overlap their disk reads; larger ones are streamed under the lock.
+int serveMgetItem(mgetBatch *batch, int index)
+{
+  const char *local_file = batch->paths[index];
+  int status = GET_STATUS_ERROR;
+  const char *error = NULL;
+  char checksum[CHECKSUM_SIZE] = NO_CHECKSUM;
+  char *data = NULL;
+  size_t len = 0;
+  FILE *filePointer = NULL;
+
+  int versionNumber = catalogLookup(batch->catalog, local_file);
+  if (versionNumber < 0)
   {
-    errorMsg("Error while creating socket");
+    error = "File not found";
   }
-
-  // Set port and IP:
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(PORT_NUMBER);
-  char *ip_address = getConfig("IP_ADDRESS");
-  if (ip_address == NULL)
+  else if (!storeChecksum(local_file, versionNumber, checksum))
   {
-    errorMsg("Error retrieving IP address from .config");
+    error = "Error opening remote file for reading";
+  }
+  else if (strcmp(batch->cached_checksums[index], checksum) == 0)
+  {
+    // The cached copy is current: nothing to read
+    status = GET_STATUS_NOT_MODIFIED;
+  }
+  else
+  {
+    filePointer = storeOpen(local_file, versionNumber);
+    long long length = filePointer == NULL ? -1 : fileLength(filePointer);
+    if (length < 0)
+    {
+      error = "Error opening remote file for reading";
+    }
+    else if (length <= getTunables()->mget_prefetch_size)
+    {
+      len = (size_t)length;
+      data = (char *)malloc(len + 1);
+      if (data == NULL || fread(data, 1, len, filePointer) != len)
+      {
+        error = "Error reading data from remote file";
+      }
+    }
+    status = error == NULL ? GET_STATUS_DATA : GET_STATUS_ERROR;
   }
-  server_addr.sin_addr.s_addr = inet_addr(ip_address);
 
-  // Bind to the set port and IP:
-  if (bind(socket_desc, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+  pthread_mutex_lock(&batch->send_lock);
+  int ok = !batch->broken;
+  if (ok && status == GET_STATUS_ERROR)
   {
-    errorMsg("Couldn't bind to the port");
+    ok = sendAll(batch->client_sock, &index, sizeof(index)) &&
+         sendAll(batch->client_sock, &status, sizeof(status)) && sendText(batch->client_sock, error);
   }
-  printf("Done with binding\n");
+  else if (ok)
+  {
+    ok = sendMgetHeader(batch->client_sock, index, status, versionNumber, checksum);
+    if (ok && status == GET_STATUS_DATA && data != NULL)
+    {
+      ok = sendAll(batch->client_sock, &len, sizeof(len)) && (len == 0 || sendAll(batch->client_sock, data, len));
+    }
+    else if (ok && status == GET_STATUS_DATA)
+    {
+      schedBulkBegin(batch->client_sock);
+      ok = sendFileData(batch->client_sock, filePointer);
+      schedBulkEnd();
+    }
+  }
+  batch->broken |= !ok;
+  pthread_mutex_unlock(&batch->send_lock);
 
-  // Listen for clients:
-  if (listen(socket_desc, 1) < 0)
+  free(data);
+  if (filePointer != NULL)
   {
-    errorMsg("Error while listening");
+    fclose(filePointer);
   }
-  printf("\nListening for incoming connections.....\n");
+  return ok;
+}
 
-  // Accept multiple incoming connections:
+// Functions: MGET reader thread, serving items until the batch is done
+void *mgetReader(void *arg)
+{
+  mgetBatch *batch = (mgetBatch *)arg;
   while (1)
   {
+    pthread_mutex_lock(&batch->lock);
+    int index = batch->broken ? batch->count : batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+    if (index >= batch->count || !serveMgetItem(batch, index))
+    {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Function: get the latest version of several files over one connection
+// The client sends a count, then each remote path with the checksum of its
+// cached copy. Replies stream back in completion order, one per item:
+// index, status, then the error text or version, checksum and data.
+void operateMultiGet(int client_sock)
+{
+  int count;
+  if (!recvAll(client_sock, &count, sizeof(count)) || count < 0)
+  {
+    return;
+  }
+  // Clients split longer lists, so a larger count is not a client of ours
+  if (count > getTunables()->mget_max)
+  {
+    fprintf(stderr, "Refused MGET of %d paths, above MGET_MAX\n", count);
+    return;
+  }
+
+  mgetBatch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.client_sock = client_sock;
+  batch.paths = (char **)arenaAlloc(((size_t)count + 1) * sizeof(char *));
+  batch.cached_checksums = (char **)arenaAlloc(((size_t)count + 1) * sizeof(char *));
+  int received = batch.paths != NULL && batch.cached_checksums != NULL;
+  for (int i = 0; received && i < count; i++)
+  {
+    received = receiveTextWith(client_sock, &batch.paths[i], arenaAlloc) &&
+               receiveTextWith(client_sock, &batch.cached_checksums[i], arenaAlloc);
+  }
+  batch.catalog = received ? readCatalog() : NULL;
+
+  if (batch.catalog != NULL)
+  {
+    batch.count = count;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_mutex_init(&batch.send_lock, NULL);
+
+    // Parallel disk reads; the calling thread is one of the readers
+    int readers = count < getTunables()->mget_readers ? count : getTunables()->mget_readers;
+    pthread_t reader_tids[readers > 0 ? readers : 1];
+    int started = 0;
+    while (started + 1 < readers && pthread_create(&reader_tids[started], NULL, mgetReader, &batch) == 0)
+    {
+      started++;
+    }
+    mgetReader(&batch);
+    for (int i = 0; i < started; i++)
+    {
+      pthread_join(reader_tids[i], NULL);
+    }
+
+    if (!batch.broken)
+    {
+      char response[VER_BUFFER_SIZE];
+      sprintf(response, "Served %d file(s)", count);
+      sendText(client_sock, response);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    pthread_mutex_destroy(&batch.send_lock);
+  }
+
+  free(batch.catalog);
+}
+
+// Function: delta between two versions of a file
+// The client sends the remote path, the two version numbers (-1 for the latest)
+// and a DIFF_MODE_*. The reply is a GET status, then either the error text or
+// the kind of delta (1 = binary), its length and bytes, and a closing message.
+void operateDiff(int client_sock)
+{
+  char *local_file;
+  int versions[2], mode;
+  if (!receiveTextWith(client_sock, &local_file, arenaAlloc) || !recvAll(client_sock, versions, sizeof(versions)) ||
+      !recvAll(client_sock, &mode, sizeof(mode)))
+  {
+    sendGetError(client_sock, "Error receiving diff request");
+    return;
+  }
+
+  traceSpan resolve_span = traceStart("resolve version");
+  int latest = isValidFile(local_file) ? getNewVer(local_file) : -1;
+  traceStop(resolve_span);
+  for (int i = 0; i < 2; i++)
+  {
+    versions[i] = versions[i] == -1 ? latest : versions[i];
+    if (latest < 0 || versions[i] < 0 || versions[i] > latest)
+    {
+      sendGetError(client_sock, "No such version of the file");
+      return;
+    }
+  }
+
+  diffResult result;
+  int computed = diffVersions(local_file, versions[0], versions[1], mode, &result);
+  if (computed <= 0)
+  {
+    sendGetError(client_sock, computed < 0 ? "Versions too large to diff (DIFF_MAX_SIZE)" : "Error computing the diff");
+    return;
+  }
+
+  int status = GET_STATUS_DATA;
+  traceSpan send_span = traceStart("send response");
+  int ok = sendAll(client_sock, &status, sizeof(status)) &&
+           sendAll(client_sock, &result.binary, sizeof(result.binary)) &&
+           sendAll(client_sock, &result.len, sizeof(result.len)) &&
+           (result.len == 0 || sendAll(client_sock, result.data, result.len));
+  if (ok)
+  {
+    char response[VER_BUFFER_SIZE];
+    snprintf(response, sizeof(response), "%s of v%d..v%d: %zu byte(s)%s", result.binary ? "Binary delta" : "Diff",
+             versions[0], versions[1], result.len, result.cached ? " (cached)" : "");
+    sendText(client_sock, response);
+  }
+  traceStop(send_span);
+  diffFree(&result);
+}
+
+// Helper function:
+// Fill in the checksums a manifest listing lacks, outside the catalog lock:
+// the listing already pins the version of every path, so stale files are
+// read without blocking commits. The checksums found are then kept in the
+// index for the next listing. Returns the new listing, or NULL on failure.
+char *fillManifestChecksums(char *listing, size_t *size)
+{
+  char *filled = NULL;
+  size_t filled_size = 0;
+  FILE *out = open_memstream(&filled, &filled_size);
+  if (out == NULL)
+  {
+    return NULL;
+  }
+  traceSpan span = traceStart("manifest checksums");
+  long *computed = NULL; // offsets in filled of the lines with a new checksum
+  int computed_count = 0;
+  char *save = NULL;
+  for (char *line = strtok_r(listing, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+  {
+    int versions, offset = 0;
+    long long bytes;
+    char checksum[CHECKSUM_SIZE];
+    if (sscanf(line, "M %d %lld %16s %n", &versions, &bytes, checksum, &offset) == 3 && offset > 0 &&
+        strcmp(checksum, NO_CHECKSUM) == 0 && storeChecksum(line + offset, versions - 1, checksum))
+    {
+      long *grown = (long *)realloc(computed, (computed_count + 1) * sizeof(long));
+      if (grown != NULL)
+      {
+        computed = grown;
+        computed[computed_count++] = ftell(out);
+      }
+      fprintf(out, "M %d %lld %s %s\n", versions, bytes, checksum, line + offset);
+      continue;
+    }
+    fprintf(out, "%s\n", line);
+  }
+  fclose(out);
+
+  if (computed_count > 0)
+  {
+    catalogLock();
+  }
+  for (int i = 0; i < computed_count; i++)
+  {
+    int versions, offset = 0;
+    long long bytes;
+    char checksum[CHECKSUM_SIZE];
+    char *line = filled + computed[i];
+    char *newline = strchr(line, '\n');
+    *newline = '\0';
+    if (sscanf(line, "M %d %lld %16s %n", &versions, &bytes, checksum, &offset) == 3 && offset > 0)
+    {
+      namesKeepChecksum(line + offset, versions - 1, checksum);
+    }
+    *newline = '\n';
+  }
+  if (computed_count > 0)
+  {
+    catalogUnlock();
+  }
+  traceStop(span);
+  free(computed);
+  *size = filled_size;
+  return filled;
+}
+
+// Function: list a folder (LIST_MODE_FOLDER) or every path with a prefix
+// (LIST_MODE_PREFIX) from the index of stored paths, without touching the disk
+// The reply is a GET status, then either the error text or the length of the
+// listing and its "F <versions> <bytes> <name>" and "D <files> <versions>
+// <bytes> <name>/" lines. "/" names the top folder.
+void operateListing(int client_sock)
+{
+  int mode;
+  char *prefix;
+  if (!recvAll(client_sock, &mode, sizeof(mode)) || !receiveTextWith(client_sock, &prefix, arenaAlloc))
+  {
+    sendGetError(client_sock, "Error receiving list request");
+    return;
+  }
+
+  // A folder is listed as the prefix "<folder>/"
+  if (mode == LIST_MODE_FOLDER)
+  {
+    size_t len = strlen(prefix);
+    while (len > 0 && prefix[len - 1] == '/')
+    {
+      len--;
+    }
+    char *folder = (char *)arenaAlloc(len + 2);
+    if (folder == NULL)
+    {
+      sendGetError(client_sock, "Error allocating memory");
+      return;
+    }
+    memcpy(folder, prefix, len);
+    strcpy(folder + len, len > 0 ? "/" : "");
+    prefix = folder;
+  }
+
+  char *listing = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&listing, &size);
+  if (out == NULL)
+  {
+    sendGetError(client_sock, "Error allocating memory");
+    return;
+  }
+  traceSpan list_span = traceStart("list names");
+  catalogLock();
+  namesList(prefix, mode, out);
+  catalogUnlock();
+  traceStop(list_span);
+  fclose(out);
+  if (mode == LIST_MODE_MANIFEST)
+  {
+    char *filled = fillManifestChecksums(listing, &size);
+    free(listing);
+    listing = filled;
+    if (listing == NULL)
+    {
+      sendGetError(client_sock, "Error allocating memory");
+      return;
+    }
+  }
+
+  int status = GET_STATUS_DATA;
+  if (!sendAll(client_sock, &status, sizeof(status)) || !sendAll(client_sock, &size, sizeof(size)) ||
+      (size > 0 && !sendAll(client_sock, listing, size)))
+  {
+    perror("Error sending listing");
+  }
+  free(listing);
+}
+
+// Function: report a snapshot time covering every commit so far
+// GET with that time then reads exactly this state, however the store changes later.
+void operateSnapshot(int client_sock)
+{
+  char snapshot[VER_BUFFER_SIZE];
+  long long now = historyNow();
+  sprintf(snapshot, "%lld.%06lld", now / 1000000, now % 1000000);
+  sendText(client_sock, snapshot);
+}
+
+// Helper function:
+// The catalog with the checksum of every latest version, as "<path>=<version> <checksum>"
+// lines, so a primary can tell a path it rewrote since from the one held here
+char *readCatalogChecksums(void)
+{
+  char *catalog = readCatalog();
+  if (catalog == NULL)
+  {
+    return NULL;
+  }
+  size_t size = 0;
+  char *annotated = NULL;
+  FILE *annotatedStream = open_memstream(&annotated, &size);
+  if (annotatedStream == NULL)
+  {
+    free(catalog);
+    return NULL;
+  }
+  char *save = NULL;
+  for (char *line = strtok_r(catalog, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+  {
+    char *equals = strchr(line, '=');
+    char checksum[CHECKSUM_SIZE] = NO_CHECKSUM;
+    if (equals == NULL)
+    {
+      fprintf(annotatedStream, "%s\n", line);
+      continue;
+    }
+    *equals = '\0';
+    int versionNumber = atoi(equals + 1);
+    if (!storeChecksum(line, versionNumber, checksum))
+    {
+      strcpy(checksum, NO_CHECKSUM);
+    }
+    fprintf(annotatedStream, "%s=%d %s\n", line, versionNumber, checksum);
+  }
+  fclose(annotatedStream);
+  free(catalog);
+  return annotated;
+}
+
+// Helper function:
+// Whether the peer may send REPLICATE, which changes the store even on a
+// read-only replica: only the hosts listed in REPLICATE_FROM (comma-separated
+// addresses of the primaries and rebalancing hosts) may
+int isReplicationPeer(int client_sock)
+{
+  struct sockaddr_in peer_addr;
+  socklen_t addr_size = sizeof(peer_addr);
+  char peer_ip[INET_ADDRSTRLEN];
+  if (getpeername(client_sock, (struct sockaddr *)&peer_addr, &addr_size) != 0 || peer_addr.sin_family != AF_INET ||
+      inet_ntop(AF_INET, &peer_addr.sin_addr, peer_ip, sizeof(peer_ip)) == NULL)
+  {
+    return 0;
+  }
+  const char *allowed = getConfig("REPLICATE_FROM");
+  if (allowed == NULL)
+  {
+    allowed = DEFAULT_REPLICATE_FROM;
+  }
+  size_t ip_len = strlen(peer_ip);
+  for (const char *entry = allowed; *entry != '\0'; entry += strcspn(entry, ", "))
+  {
+    entry += strspn(entry, ", ");
+    if (strncmp(entry, peer_ip, ip_len) == 0 && strchr(", ", entry[ip_len]) != NULL)
+    {
+      return 1;
+    }
+  }
+  printf("\nRefused REPLICATE from %s: not listed in REPLICATE_FROM\n", peer_ip);
+  return 0;
+}
+
+// Function: apply the replication stream of a primary
+// Also used by the rebalancing tool to move version sets between shards.
+void operateReplicate(int client_sock)
+{
+  if (!isReplicationPeer(client_sock))
+  {
+    return;
+  }
+
+  // Handshake: report the local catalog so the primary only ships the gap
+  char *catalog = readCatalogChecksums();
+  if (catalog == NULL)
+  {
+    return;
+  }
+  int ok = sendText(client_sock, catalog);
+  free(catalog);
+
+  // Apply operations in log order, acknowledging each one. Each is held to
+  // the deadlines of a request; the primary pings while it has nothing to ship.
+  while (ok)
+  {
+    int op;
+    char *file_path;
+    deadlineNext(3 * REPLICA_HEARTBEAT_SEC);
+    if (!recvAll(client_sock, &op, sizeof(op)) || op == REPL_OP_END)
+    {
+      break;
+    }
+    deadlineRequest();
+    if (!receiveText(client_sock, &file_path))
+    {
+      break;
+    }
+
+    int ack = 1;
+    if (op == REPL_OP_WRITE)
+    {
+      int versionNumber;
+      ack = recvAll(client_sock, &versionNumber, sizeof(versionNumber))
+                ? applyReplicatedWrite(client_sock, file_path, versionNumber)
+                : -1;
+    }
+    else if (op == REPL_OP_RM)
+    {
+      char response[MAX_BUFFER_SIZE];
+      removeAllVersions(file_path, response);
+    }
+    free(file_path);
+
+    ok = ack >= 0 && sendAll(client_sock, &ack, sizeof(ack));
+  }
+}
+
+// Helper function:
+// Stop accepting new connections; the main thread then drains and exits
+void beginDrain(const char *reason)
+{
+  pthread_mutex_lock(&drain_lock);
+  if (!draining)
+  {
+    draining = 1;
+    printf("\nDraining in-flight requests (%s)\n", reason);
+    watchStop();
+    // Never read, so it keeps every acceptor's poll awake from now on
+    if (write(wake_pipe[1], "x", 1) < 0)
+    {
+      perror("Fail to wake acceptors");
+    }
+  }
+  pthread_cond_broadcast(&drain_cond);
+  pthread_mutex_unlock(&drain_lock);
+}
+
+// Function: Exit operation from the server side
+// In-flight requests are allowed to finish (up to DRAIN_TIMEOUT) before the process exits.
+void operateExit(int client_sock)
+{
+  beginDrain("EXIT");
+  sendText(client_sock, "Server terminated by client");
+  shutdown(client_sock, SHUT_RDWR);
+}
+
+// Helper function:
+// Count a finished connection, waking the drain when it was the last one
+void requestDone(void)
+{
+  pthread_mutex_lock(&drain_lock);
+  inflight--;
+  pthread_cond_broadcast(&drain_cond);
+  pthread_mutex_unlock(&drain_lock);
+}
+
+// Function: switch tracing on or off, or send the recorded spans
+// The command is "on", "off" or "dump"; a dump is streamed as Chrome trace JSON.
+void operateTrace(int client_sock)
+{
+  char *command;
+  if (!receiveTextWith(client_sock, &command, arenaAlloc))
+  {
+    perror("Error receiving trace command");
+    return;
+  }
+
+  char response[VER_BUFFER_SIZE];
+  if (strcmp(command, "on") == 0 || strcmp(command, "off") == 0)
+  {
+    int enabled = strcmp(command, "on") == 0;
+    traceEnable(enabled);
+    sprintf(response, "Tracing %s", enabled ? "enabled" : "disabled");
+    sendText(client_sock, response);
+  }
+  else if (strcmp(command, "dump") == 0)
+  {
+    // Render into a temporary file, then stream it like any file content
+    // A leading flag tells the client whether the JSON follows
+    FILE *filePointer = tmpfile();
+    int ready = filePointer != NULL;
+    sendAll(client_sock, &ready, sizeof(ready));
+    if (!ready)
+    {
+      sendError(client_sock, "Error creating trace dump");
+      return;
+    }
+    int events = traceDump(filePointer);
+    rewind(filePointer);
+    if (!sendFileData(client_sock, filePointer))
+    {
+      perror("Error sending trace dump");
+    }
+    else
+    {
+      sprintf(response, "Dumped %d trace event(s)", events);
+      sendText(client_sock, response);
+    }
+    fclose(filePointer);
+  }
+  else
+  {
+    sendError(client_sock, "Unknown trace command, expected on, off or dump");
+  }
+}
+
+typedef struct
+{
+  int client_sock;
+  char *filter;
+  unsigned long from;
+} watchRequest;
+
+static int watch_subscriptions = 0; // WATCH threads running, at most WATCH_MAX
+
+// Functions: thread serving one WATCH subscription until it ends
+void *watchExecutor(void *arg)
+{
+  watchRequest *request = (watchRequest *)arg;
+  watchServe(request->client_sock, request->filter, request->from);
+  close(request->client_sock);
+  free(request->filter);
+  free(request);
+  __atomic_sub_fetch(&watch_subscriptions, 1, __ATOMIC_RELAXED);
+  requestDone();
+  pthread_exit(NULL);
+}
+
+// Function: subscribe to the commits on a path, a folder (ending in '/') or a
+// prefix (ending in '*'), from a sequence number on (0 for new commits only)
+// The subscription gets a thread of its own, so it never holds one of the
+// WORKERS; at most WATCH_MAX are served at once. Returns 1 when that thread
+// took over the connection.
+int operateWatch(int client_sock)
+{
+  char *filter;
+  unsigned long from;
+  if (!receiveTextWith(client_sock, &filter, arenaAlloc) || !recvAll(client_sock, &from, sizeof(from)))
+  {
+    perror("Error receiving watch request");
+    return 0;
+  }
+
+  if (__atomic_add_fetch(&watch_subscriptions, 1, __ATOMIC_RELAXED) > getTunables()->watch_max)
+  {
+    __atomic_sub_fetch(&watch_subscriptions, 1, __ATOMIC_RELAXED);
+    watchRefuse(client_sock, "Too many WATCH subscriptions, try again later");
+    return 0;
+  }
+  watchRequest *request = (watchRequest *)malloc(sizeof(watchRequest));
+  if (request == NULL || (request->filter = strdup(filter)) == NULL)
+  {
+    free(request);
+    __atomic_sub_fetch(&watch_subscriptions, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  request->client_sock = client_sock;
+  request->from = from;
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, watchExecutor, request) != 0)
+  {
+    perror("Fail to create thread");
+    free(request->filter);
+    free(request);
+    __atomic_sub_fetch(&watch_subscriptions, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  pthread_detach(tid);
+  return 1;
+}
+
+// Helper function:
+// The action as a static string, so it can name a trace span
+static const char *actionName(const char *action)
+{
+  static const char *const names[] = {"WRITE", "GET", "MGET", "MWRITE", "APPEND", "PATCH", "DIFF", "RM",
+                                      "LS", "LIST", "CATALOG", "SNAPSHOT", "REPLICATE", "TRACE", "WATCH", "EXIT"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    if (strcmp(action, names[i]) == 0)
+    {
+      return names[i];
+    }
+  }
+  return "unknown action";
+}
+
+// Functions: handles one client's request, then closes its socket
+// Memory the request takes from its arena is released in one go at the end.
+// queued_ns is how long the connection waited for a worker since its accept.
+void handleClient(int client_sock, long long queued_ns)
+{
+  arenaBegin();
+  deadlineBegin(client_sock, queued_ns);
+
+  // Receive client's action string
+  char *action;
+  traceSpan receive_span = traceStart("receive action");
+  if (!receiveTextWith(client_sock, &action, arenaAlloc))
+  {
+    deadlineEnd();
+    arenaEnd();
+    close(client_sock);
+    requestDone();
+    return;
+  }
+  traceStop(receive_span);
+  deadlineRequest();
+
+  // The whole request, named after its action
+  traceSpan request_span = traceStart(actionName(action));
+  int detached = 0;
+
+  if (strcmp(action, "WRITE") == 0)
+  { // Question 1
+    operateWrite(client_sock);
+  }
+  else if (strcmp(action, "GET") == 0)
+  { // Question 2
+    operateGet(client_sock);
+  }
+  else if (strcmp(action, "MGET") == 0)
+  { // Many files in one round trip
+    operateMultiGet(client_sock);
+  }
+  else if (strcmp(action, "MWRITE") == 0)
+  { // Many files in one round trip
+    operateMultiWrite(client_sock);
+  }
+  else if (strcmp(action, "APPEND") == 0)
+  { // New version sharing the unchanged extents of the latest one
+    operateDelta(client_sock, 0);
+  }
+  else if (strcmp(action, "PATCH") == 0)
+  { // New version sharing the unchanged extents of the latest one
+    operateDelta(client_sock, 1);
+  }
+  else if (strcmp(action, "DIFF") == 0)
+  { // Delta between two stored versions
+    operateDiff(client_sock);
+  }
+  else if (strcmp(action, "RM") == 0)
+  { // Question 3
+    operateRemove(client_sock);
+  }
+  else if (strcmp(action, "LS") == 0)
+  { // Question 6
+    operateList(client_sock);
+  }
+  else if (strcmp(action, "LIST") == 0)
+  { // Folder and prefix listings from the index of stored paths
+    operateListing(client_sock);
+  }
+  else if (strcmp(action, "CATALOG") == 0)
+  { // Stored files, for rebalancing
+    operateCatalog(client_sock);
+  }
+  else if (strcmp(action, "SNAPSHOT") == 0)
+  { // Time pinning every committed version, for point-in-time reads
+    operateSnapshot(client_sock);
+  }
+  else if (strcmp(action, "REPLICATE") == 0)
+  { // Stream of committed changes from the primary
+    operateReplicate(client_sock);
+  }
+  else if (strcmp(action, "TRACE") == 0)
+  { // Request phase tracing
+    operateTrace(client_sock);
+  }
+  else if (strcmp(action, "WATCH") == 0)
+  { // Commits pushed over a long-lived connection
+    detached = operateWatch(client_sock);
+  }
+  else if (strcmp(action, "EXIT") == 0)
+  { // Turn off the server
+    operateExit(client_sock);
+  }
+  else
+  {
+    perror("Invalid action");
+  }
+  traceStop(request_span);
+  deadlineEnd();
+  arenaEnd();
+
+  // Close the client socket once the request is served, unless a WATCH
+  // subscription now owns it
+  if (!detached)
+  {
+    close(client_sock);
+    requestDone();
+  }
+}
+
+// Functions: thread entry serving a single connection (WORKERS=0)
+void *clientTaskExecutor(void *arg)
+{
+  int client_sock = *(int *)arg;
+  free(arg);
+  handleClient(client_sock, 0);
+
+  // Exit the thread
+  pthread_exit(NULL);
+}
+
+// Functions: worker thread serving connections from the queue (WORKERS>0)
+void *workerExecutor(void *arg)
+{
+  (void)arg;
+  pool_worker = 1;
+  while (1)
+  {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count == 0)
+    {
+      pthread_cond_wait(&queue_not_empty, &queue_lock);
+    }
+    int client_sock = client_queue[queue_start].client_sock;
+    traceSpan waiting = client_queue[queue_start].waiting;
+    struct timespec queued = client_queue[queue_start].queued;
+    queue_start = (queue_start + 1) % CLIENT_QUEUE_SIZE;
+    queue_count--;
+    pthread_cond_signal(&queue_not_full);
+    pthread_mutex_unlock(&queue_lock);
+
+    traceStop(waiting);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    handleClient(client_sock, (now.tv_sec - queued.tv_sec) * 1000000000LL + (now.tv_nsec - queued.tv_nsec));
+
+    // Its stand-in has taken over
+    if (lent_out)
+    {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Helper function:
+// Bulk slot wait hook: a worker about to wait for a slot starts a stand-in,
+// so the pool keeps serving metadata requests meanwhile
+void lendWorker(void)
+{
+  if (!pool_worker || lent_out)
+  {
+    return;
+  }
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, workerExecutor, NULL) != 0)
+  {
+    perror("Fail to create stand-in worker");
+    return;
+  }
+  pthread_detach(tid);
+  lent_out = 1;
+}
+
+// Helper function:
+// Hand an accepted connection to a worker, or to a thread of its own
+void dispatchClient(int client_sock)
+{
+  pthread_mutex_lock(&drain_lock);
+  inflight++;
+  pthread_mutex_unlock(&drain_lock);
+
+  if (getTunables()->workers > 0)
+  {
+    // Blocks the acceptor while every worker is busy and the queue is full
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count == CLIENT_QUEUE_SIZE)
+    {
+      pthread_cond_wait(&queue_not_full, &queue_lock);
+    }
+    queuedClient *slot = &client_queue[(queue_start + queue_count) % CLIENT_QUEUE_SIZE];
+    slot->client_sock = client_sock;
+    slot->waiting = traceStart("queue wait");
+    clock_gettime(CLOCK_MONOTONIC, &slot->queued);
+    queue_count++;
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&queue_lock);
+    return;
+  }
+
+  // Question 4
+  // A new thread is created whenever a new client connection is accepted (accept function),
+  // serving multiple clients simultaneously.
+  int *arg = (int *)malloc(sizeof(int));
+  if (arg == NULL)
+  {
+    close(client_sock);
+    requestDone();
+    return;
+  }
+  *arg = client_sock;
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, clientTaskExecutor, arg) != 0)
+  {
+    perror("Fail to create thread");
+    free(arg);
+    close(client_sock);
+    requestDone();
+    return;
+  }
+
+  // Set the thread to a detached state so it can release its 
+  // resources automatically upon completion
+  pthread_detach(tid);
+}
+
+// Functions: acceptor thread, accepting connections on its own listener
+// Returns once the server starts draining.
+void *acceptorExecutor(void *arg)
+{
+  int socket_desc = *(int *)arg;
+  struct sockaddr_in client_addr;
+  socklen_t client_size;
+  struct pollfd fds[2] = {{.fd = socket_desc, .events = POLLIN}, {.fd = wake_pipe[0], .events = POLLIN}};
+
+  // Accept multiple incoming connections:
+  while (!draining)
+  {
+    if (poll(fds, 2, -1) < 0 || draining)
+    {
+      continue;
+    }
+
+    // Listeners are non-blocking: another acceptor (or process) may have won the race
     client_size = sizeof(client_addr);
-    client_sock = accept(socket_desc, (struct sockaddr *)&client_addr, &client_size);
+    int client_sock = accept(socket_desc, (struct sockaddr *)&client_addr, &client_size);
 
     if (client_sock < 0)
     {
-      perror("Can't accept");
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        perror("Can't accept");
+      }
       continue;
     }
+    char client_ip[INET_ADDRSTRLEN];
     printf("\nClient connected at IP: %s and port: %i\n",
-           inet_ntoa(client_addr.sin_addr),
+           inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip)),
            ntohs(client_addr.sin_port));
 
-    // Question 4
-    // A new thread is created whenever a new client connection is accepted above (accept function),
-    // serving multiple clients simultaneously.
-    pthread_t tid;
-    int sockets[] = {client_sock, socket_desc};
-    if (pthread_create(&tid, NULL, clientTaskExecutor, (void *)sockets) != 0)
+    dispatchClient(client_sock);
+  }
+  return NULL;
+}
+
+// Functions: hand the listening sockets to a successor process (upgrade),
+// then start draining
+void *handoffExecutor(void *arg)
+{
+  int handoff_desc = *(int *)arg;
+  int backoff_ms = HANDOFF_RETRY_MIN_MS;
+  while (!draining)
+  {
+    if (handoffSend(handoff_desc, listeners, listener_count))
+    {
+      close(handoff_desc);
+      beginDrain("handed listeners to a new server");
+      break;
+    }
+    // A failing handoff socket must not spin; back off up to HANDOFF_RETRY_MAX_MS
+    struct timespec pause = {backoff_ms / 1000, (backoff_ms % 1000) * 1000000L};
+    nanosleep(&pause, NULL);
+    backoff_ms = backoff_ms * 2 < HANDOFF_RETRY_MAX_MS ? backoff_ms * 2 : HANDOFF_RETRY_MAX_MS;
+  }
+  return NULL;
+}
+
+// Functions: turn SIGINT and SIGTERM into a graceful drain
+void *signalExecutor(void *arg)
+{
+  sigset_t *signals = (sigset_t *)arg;
+  int sig;
+  if (sigwait(signals, &sig) == 0)
+  {
+    beginDrain(sig == SIGINT ? "SIGINT" : "SIGTERM");
+  }
+  return NULL;
+}
+
+// Helper function:
+// Create a listening socket on ip:port. SO_REUSEPORT lets every acceptor
+// bind its own socket to the same port; the kernel spreads connections across them.
+int createListener(const char *ip_address, int port, int backlog)
+{
+  // Create socket:
+  int socket_desc = socket(AF_INET, SOCK_STREAM, 0);
+  if (socket_desc < 0)
+  {
+    errorMsg("Error while creating socket");
+  }
+
+  int enable = 1;
+  if (setsockopt(socket_desc, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+      setsockopt(socket_desc, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+  {
+    errorMsg("Error while setting socket options");
+  }
+
+  // Set port and IP:
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  server_addr.sin_addr.s_addr = inet_addr(ip_address);
+
+  // Bind to the set port and IP:
+  if (bind(socket_desc, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+  {
+    errorMsg("Couldn't bind to the port");
+  }
+
+  // Listen for clients:
+  if (listen(socket_desc, backlog) < 0)
+  {
+    errorMsg("Error while listening");
+  }
+  fcntl(socket_desc, F_SETFL, fcntl(socket_desc, F_GETFL) | O_NONBLOCK);
+  return socket_desc;
+}
+
+// Main function
+// Usage: ./rfserver [-p port] [-d data-dir] [-r] [-R ip:port,...] [-u]
+//   -p  port to listen on (overrides PORT in .config)
+//   -d  folder holding the stored files, .config and version info
+//   -r  run as a read-only replica
+//   -R  replicas to ship committed changes to (overrides REPLICAS in .config)
+//   -u  upgrade: take over the listening sockets of the server running in the
+//       same data folder, which then drains and exits
+int main(int argc, char *argv[])
+{
+  int port = 0;
+  const char *data_dir = NULL;
+  const char *replica_list = NULL;
+  int upgrade = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:d:rR:u")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'd':
+      data_dir = optarg;
+      break;
+    case 'r':
+      read_only = 1;
+      break;
+    case 'R':
+      replica_list = optarg;
+      break;
+    case 'u':
+      upgrade = 1;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-p port] [-d data-dir] [-r] [-R ip:port,...] [-u]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (data_dir != NULL && chdir(data_dir) != 0)
+  {
+    errorMsg("Couldn't enter the data folder");
+  }
+
+  // Parse .config once; every tunable is read from here on
+  loadConfig(CONFIG_PATH);
+  const rfsConfig *tunables = getTunables();
+  if (tunables->ip_address[0] == '\0')
+  {
+    errorMsg("Error retrieving IP address from .config");
+  }
+  if (port <= 0)
+  {
+    port = tunables->port;
+  }
+
+  // Make sure the version info file exists before any request reads it
+  FILE *versionFile = fopen(VERSION_PATH, "a");
+  if (versionFile == NULL)
+  {
+    errorMsg("Error creating version info file");
+  }
+  fclose(versionFile);
+
+  catalog_lock_desc = open(CATALOG_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+  if (catalog_lock_desc < 0)
+  {
+    errorMsg("Error creating catalog lock file");
+  }
+
+  // Index commit times for point-in-time reads, and the stored paths for listings
+  catalogLock();
+  historyInit();
+  namesLoad();
+  catalogUnlock();
+
+  // A vanished peer must not kill the whole server
+  signal(SIGPIPE, SIG_IGN);
+
+  // Bulk transfers are paced per client (CLIENT_RATE, BULK_RATE)
+  setTransferPacer(schedPace);
+  schedSetWaitHook(lendWorker);
+
+  // Slow and stalled clients are evicted (IDLE_TIMEOUT, READ_TIMEOUT, WRITE_TIMEOUT, MIN_TRANSFER_RATE)
+  setTransferGuard(deadlineGuard);
+
+  // Request phase tracing (TRACE), also switched at run time by the TRACE action
+  traceEnable(tunables->trace);
+
+  // SIGINT and SIGTERM are handled by a dedicated thread; block them everywhere else
+  static sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  pthread_t signal_tid;
+  if (pthread_create(&signal_tid, NULL, signalExecutor, &signals) != 0)
+  {
+    errorMsg("Fail to create signal thread");
+  }
+  pthread_detach(signal_tid);
+
+  if (pipe(wake_pipe) < 0)
+  {
+    errorMsg("Error creating wake pipe");
+  }
+
+  // One listener per acceptor, all bound to the same port, or the
+  // listeners of the running server when upgrading
+  int handoff_sock = -1;
+  if (upgrade)
+  {
+    listener_count = handoffReceive(tunables->handoff_socket, listeners, MAX_ACCEPTORS, &handoff_sock);
+    if (listener_count == 0)
     {
-      perror("Fail to create thread");
-      close(client_sock);
-      continue; 
+      errorMsg("Couldn't take over the listeners of the running server");
     }
+    printf("Took over %d listener(s) from the running server\n", listener_count);
+  }
+  else
+  {
+    listener_count = tunables->acceptors < MAX_ACCEPTORS ? tunables->acceptors : MAX_ACCEPTORS;
+    for (int i = 0; i < listener_count; i++)
+    {
+      listeners[i] = createListener(tunables->ip_address, port, tunables->backlog);
+    }
+    printf("Done with binding\n");
+  }
+  printf("\nListening for incoming connections.....\n");
+
+  // Ship committed changes to the replicas in the background
+  if (replica_list == NULL)
+  {
+    replica_list = getConfig("REPLICAS");
+  }
+  replicationStart(replica_list, tunables->replica_max_lag, tunables->replica_lag_timeout);
 
-    // Set the thread to a detached state so it can release its 
-    // resources automatically upon completion
+  // Recent commits, pushed to WATCH subscribers
+  watchStart(tunables->watch_events);
+
+  // Old versions nobody reads move to compressed storage in the background
+  tierStart(tunables->tier_after, tunables->tier_interval, tunables->tier_dir, catalogLock, catalogUnlock);
+
+  for (int i = 0; i < tunables->workers; i++)
+  {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, workerExecutor, NULL) != 0)
+    {
+      errorMsg("Fail to create worker thread");
+    }
     pthread_detach(tid);
   }
 
-  close(socket_desc);
+  // Every listener gets its own acceptor thread
+  pthread_t acceptor_tids[MAX_ACCEPTORS];
+  for (int i = 0; i < listener_count; i++)
+  {
+    if (pthread_create(&acceptor_tids[i], NULL, acceptorExecutor, &listeners[i]) != 0)
+    {
+      errorMsg("Fail to create acceptor thread");
+    }
+  }
+
+  // Accepting now: release the old server (if any) and wait for our own successor
+  if (handoff_sock >= 0 && !handoffAck(handoff_sock))
+  {
+    perror("Fail to acknowledge the handoff");
+  }
+  int handoff_desc = handoffListen(tunables->handoff_socket);
+  pthread_t handoff_tid;
+  if (handoff_desc < 0 || pthread_create(&handoff_tid, NULL, handoffExecutor, &handoff_desc) != 0)
+  {
+    perror("Upgrade handoff unavailable");
+  }
+
+  // Drain: stop accepting, then give in-flight requests until the deadline
+  for (int i = 0; i < listener_count; i++)
+  {
+    pthread_join(acceptor_tids[i], NULL);
+  }
+  for (int i = 0; i < listener_count; i++)
+  {
+    close(listeners[i]);
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += tunables->drain_timeout;
+  pthread_mutex_lock(&drain_lock);
+  while (inflight > 0)
+  {
+    if (pthread_cond_timedwait(&drain_cond, &drain_lock, &deadline) != 0)
+    {
+      fprintf(stderr, "Drain timeout: %d request(s) still in flight\n", inflight);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&drain_lock);
+
+  // Commits made while draining went to no successor's log: ship them before exiting
+  if (!replicationFlush(&deadline))
+  {
+    fprintf(stderr, "Drain timeout: replicas did not acknowledge every commit\n");
+  }
+  printf("\nServer stopped\n");
 
   return 0;
 }
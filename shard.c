@@ -0,0 +1,124 @@
+/*
+ * shard.c -- Consistent hashing of remote paths onto cluster shards
+ *
+ * Each endpoint is placed on a 64-bit ring at `vnodes` points; a path is
+ * owned by the first point clockwise from its own hash. Adding a shard only
+ * moves the paths that fall between its new points and their predecessors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "helper.h"
+#include "config.h"
+#include "shard.h"
+
+// Helper function:
+// Order ring points by hash
+static int comparePoints(const void *a, const void *b)
+{
+  const shardPoint *pa = (const shardPoint *)a, *pb = (const shardPoint *)b;
+  if (pa->hash != pb->hash)
+  {
+    return pa->hash < pb->hash ? -1 : 1;
+  }
+  return pa->endpoint - pb->endpoint;
+}
+
+// Function: build the ring from a comma-separated list of "ip:port" shards
+int shardRingLoad(shardRing *ring, const char *shard_list, int vnodes, int default_port)
+{
+  memset(ring, 0, sizeof(*ring));
+  if (shard_list == NULL || *shard_list == '\0')
+  {
+    return 0;
+  }
+  if (vnodes <= 0)
+  {
+    vnodes = DEFAULT_SHARD_VNODES;
+  }
+
+  char list[strlen(shard_list) + 1];
+  strcpy(list, shard_list);
+  int count = 1;
+  for (char *p = list; *p != '\0'; p++)
+  {
+    count += *p == ',';
+  }
+  ring->endpoints = (shardEndpoint *)calloc(count, sizeof(shardEndpoint));
+  ring->points = (shardPoint *)calloc((size_t)count * vnodes, sizeof(shardPoint));
+  if (ring->endpoints == NULL || ring->points == NULL)
+  {
+    shardRingFree(ring);
+    return 0;
+  }
+
+  char *save_ptr;
+  for (char *endpoint = strtok_r(list, ",", &save_ptr); endpoint != NULL; endpoint = strtok_r(NULL, ",", &save_ptr))
+  {
+    shardEndpoint *e = &ring->endpoints[ring->endpoint_count];
+    if (!parseEndpoint(endpoint, e->ip, sizeof(e->ip), &e->port, default_port))
+    {
+      fprintf(stderr, "Invalid shard endpoint '%s'\n", endpoint);
+      shardRingFree(ring);
+      return 0;
+    }
+
+    // Virtual nodes are keyed by "ip:port#n"
+    for (int v = 0; v < vnodes; v++)
+    {
+      char key[SHARD_ENDPOINT_SIZE + 32];
+      snprintf(key, sizeof(key), "%s:%d#%d", e->ip, e->port, v);
+      ring->points[ring->point_count].hash = hashString(key);
+      ring->points[ring->point_count].endpoint = ring->endpoint_count;
+      ring->point_count++;
+    }
+    ring->endpoint_count++;
+  }
+
+  qsort(ring->points, ring->point_count, sizeof(shardPoint), comparePoints);
+  return ring->endpoint_count;
+}
+
+// Function: index of the endpoint owning a remote path
+int shardLookup(const shardRing *ring, const char *remote_path)
+{
+  unsigned long long hash = hashString(remote_path);
+
+  // Binary search for the first point at or after the hash, wrapping around
+  int low = 0, high = ring->point_count;
+  while (low < high)
+  {
+    int mid = low + (high - low) / 2;
+    if (ring->points[mid].hash < hash)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return ring->points[low == ring->point_count ? 0 : low].endpoint;
+}
+
+// Function: index of an endpoint in the ring, -1 if it is not part of it
+int shardFind(const shardRing *ring, const char *ip, int port)
+{
+  for (int i = 0; i < ring->endpoint_count; i++)
+  {
+    if (strcmp(ring->endpoints[i].ip, ip) == 0 && ring->endpoints[i].port == port)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Function: release the ring
+void shardRingFree(shardRing *ring)
+{
+  free(ring->endpoints);
+  free(ring->points);
+  memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,34 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#define SHARD_ENDPOINT_SIZE 64
+
+// One server of the cluster
+typedef struct
+{
+  char ip[SHARD_ENDPOINT_SIZE];
+  int port;
+} shardEndpoint;
+
+// Point of a server on the hash ring (one per virtual node)
+typedef struct
+{
+  unsigned long long hash;
+  int endpoint;
+} shardPoint;
+
+// Consistent hash ring over the shard endpoints
+typedef struct
+{
+  shardEndpoint *endpoints;
+  int endpoint_count;
+  shardPoint *points;
+  int point_count;
+} shardRing;
+
+int shardRingLoad(shardRing *ring, const char *shard_list, int vnodes, int default_port);
+int shardLookup(const shardRing *ring, const char *remote_path);
+int shardFind(const shardRing *ring, const char *ip, int port);
+void shardRingFree(shardRing *ring);
+
+#endif
@@ -0,0 +1,852 @@
+/*
+ * store.c -- Version content, stored whole or as copy-on-write extents
+ *
+ * A WRITE stores every version as a plain file. APPEND and PATCH store the
+ * new version as an extent file instead: only the bytes that changed, plus
+ * a map of extents that references the unchanged ranges of older versions
+ * of the same path in place. Layout of an extent file:
+ *
+ *   STORE_MAGIC | new bytes | storeExtent[count] | storeTrailer
+ *
+ * Extents always point at the file holding the bytes (a plain version or the
+ * data of an extent file), never at another map, so reading never chains.
+ * An extent file is marked with the extended attribute KIND_ATTR,
+ * "extents <mtime sec> <mtime nsec>"; a WRITE whose content starts with
+ * STORE_MAGIC is just content.
+ * Versions of a path are only ever removed together (RM), so nothing a map
+ * references disappears while the map exists.
+ *
+ * A version nobody read for TIER_AFTER seconds can be frozen (tier.c): its
+ * content moves to a gzip copy under TIER_DIR and the version file becomes a
+ * stub:
+ *
+ *   COLD_MAGIC | long long length | name of the version file
+ *
+ * A stub is told apart from content by KIND_ATTR as well, "cold <mtime sec>
+ * <mtime nsec>", never by its bytes: an upload that looks like a stub is just
+ * content. The copy is found with tierColdName, under
+ * TIER_DIR, from the name of the version file; the name kept in the stub only
+ * has to match it. Only versions no map references are frozen, so extents
+ * never point at a stub.
+ *
+ * storeOpen hides the differences from readers: an extent version is read
+ * through a stream that gathers its extents, a cold one through a stream
+ * that inflates its copy (fopencookie). Opening a version marks it accessed.
+ *
+ * The checksum of a version is kept on its file as the extended attribute
+ * CHECKSUM_ATTR, "<checksum> <mtime sec> <mtime nsec>": a WRITE records it
+ * while the bytes arrive, other versions get it the first time it is asked
+ * for. It only counts while the file keeps that modification time, so a
+ * rewritten file is never answered with the checksum of its old content.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <zlib.h>
+#include "helper.h"
+#include "tier.h"
+#include "store.h"
+
+#define STORE_MAGIC "\0RFS-EXTENTS-1\n"
+#define STORE_MAGIC_SIZE 16
+#define COLD_MAGIC "\0RFS-COLDZIP-1\n"
+#define COLD_NAME_SIZE 1024
+
+#define CHECKSUM_ATTR "user.rfs.checksum"
+#define CHECKSUM_ATTR_SIZE 64
+#define KIND_ATTR "user.rfs.kind"
+#define KIND_EXTENTS "extents"
+#define KIND_COLD "cold"
+
+// Reads within this many seconds of the last recorded access are not recorded again
+#define ACCESS_GRANULARITY 60
+
+typedef struct
+{
+  int version;      // version file holding the bytes
+  int reserved;
+  long long offset; // position of the bytes in that file
+  long long length;
+} storeExtent;
+
+typedef struct
+{
+  long long count; // extents stored right before the trailer
+  long long reserved;
+} storeTrailer;
+
+// Stream state of an extent version being read
+typedef struct
+{
+  char *file_path;
+  storeExtent *extents;
+  long long *starts; // position of each extent in the content
+  int count;
+  long long position;
+  long long length;
+  FILE *source; // file of the extent read last
+  int source_version;
+} extentReader;
+
+// Stream state of a cold version being read
+typedef struct
+{
+  gzFile copy;
+  long long position;
+  long long length;
+} coldReader;
+
+// Helper function:
+// Open a version file; touch records the read in its access time, which the
+// tiering goes by. Background reads pass 0 and leave the access time alone.
+static FILE *openVersionFile(const char *file_name, int touch)
+{
+  int fd = open(file_name, O_RDONLY | (touch ? 0 : O_NOATIME));
+  if (fd < 0 && !touch)
+  {
+    // O_NOATIME is refused on files of another owner
+    fd = open(file_name, O_RDONLY);
+  }
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  struct stat file_stat;
+  if (touch && fstat(fd, &file_stat) == 0 && file_stat.st_atime + ACCESS_GRANULARITY <= time(NULL))
+  {
+    const struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_OMIT}};
+    futimens(fd, times);
+  }
+  FILE *fp = fdopen(fd, "rb");
+  if (fp == NULL)
+  {
+    close(fd);
+  }
+  return fp;
+}
+
+// Helper function:
+// How the version file of fd is marked (KIND_ATTR) for the modification time
+// it has now: 1 for an extent file, 2 for a cold stub, 0 for plain content
+static int recordedKind(int fd)
+{
+  char value[CHECKSUM_ATTR_SIZE];
+  ssize_t len = fgetxattr(fd, KIND_ATTR, value, sizeof(value) - 1);
+  struct stat file_stat;
+  if (len <= 0 || fstat(fd, &file_stat) != 0)
+  {
+    return 0;
+  }
+  value[len] = '\0';
+  char recorded[16];
+  long long sec;
+  long nsec;
+  if (sscanf(value, "%15s %lld %ld", recorded, &sec, &nsec) != 3 ||
+      sec != (long long)file_stat.st_mtim.tv_sec || nsec != file_stat.st_mtim.tv_nsec)
+  {
+    return 0;
+  }
+  return strcmp(recorded, KIND_EXTENTS) == 0 ? 1 : strcmp(recorded, KIND_COLD) == 0 ? 2 : 0;
+}
+
+// Helper function:
+// Mark the version file of fd as kind, for the modification time it will keep
+static int recordKind(int fd, const char *kind, const struct timespec *mtime)
+{
+  char value[CHECKSUM_ATTR_SIZE];
+  int len = snprintf(value, sizeof(value), "%s %lld %ld", kind, (long long)mtime->tv_sec, mtime->tv_nsec);
+  return fsetxattr(fd, KIND_ATTR, value, (size_t)len, 0) == 0;
+}
+
+// Helper function:
+// Load the extent map of an open version file
+// Returns 1 for an extent file, 0 for a plain one (left rewound), 2 for a cold
+// stub (left after its magic), -1 when unreadable.
+static int readExtents(FILE *fp, storeExtent **extents, int *count)
+{
+  char magic[STORE_MAGIC_SIZE];
+  int kind = recordedKind(fileno(fp));
+  if (kind == 0)
+  {
+    return 0;
+  }
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, kind == 2 ? COLD_MAGIC : STORE_MAGIC, sizeof(magic)) != 0)
+  {
+    return -1;
+  }
+  if (kind == 2)
+  {
+    return 2;
+  }
+
+  storeTrailer trailer;
+  if (fseeko(fp, -(off_t)sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, fp) != 1 ||
+      trailer.count < 0 || trailer.count > (1 << 20))
+  {
+    return -1;
+  }
+  *count = (int)trailer.count;
+  *extents = (storeExtent *)malloc((*count + 1) * sizeof(storeExtent));
+  if (*extents == NULL)
+  {
+    return -1;
+  }
+  off_t records = (off_t)(sizeof(trailer) + *count * sizeof(storeExtent));
+  if (fseeko(fp, -records, SEEK_END) != 0 ||
+      fread(*extents, sizeof(storeExtent), *count, fp) != (size_t)*count)
+  {
+    free(*extents);
+    return -1;
+  }
+  return 1;
+}
+
+// Helper function:
+// The extents making up a version, a single one for a plain file
+static storeExtent *versionExtents(const char *file_path, int version, int *count)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  createFileName(file_name, file_path, version);
+  FILE *fp = fopen(file_name, "rb");
+  if (fp == NULL)
+  {
+    return NULL;
+  }
+
+  storeExtent *extents = NULL;
+  int kind = readExtents(fp, &extents, count);
+  if (kind == 0)
+  {
+    long long length = fileLength(fp);
+    extents = length < 0 ? NULL : (storeExtent *)malloc(sizeof(storeExtent));
+    if (extents != NULL)
+    {
+      extents[0].version = version;
+      extents[0].reserved = 0;
+      extents[0].offset = 0;
+      extents[0].length = length;
+      *count = length > 0 ? 1 : 0;
+    }
+  }
+  fclose(fp);
+  return kind == 1 || kind == 0 ? extents : NULL;
+}
+
+// Helper function:
+// Read from an extent version, gathering the bytes extent by extent
+static ssize_t extentRead(void *cookie, char *buf, size_t size)
+{
+  extentReader *reader = (extentReader *)cookie;
+  size_t total = 0;
+  while (total < size && reader->position < reader->length)
+  {
+    // Last extent starting at or before the position
+    int low = 0, high = reader->count - 1, index = 0;
+    while (low <= high)
+    {
+      int mid = low + (high - low) / 2;
+      if (reader->starts[mid] <= reader->position)
+      {
+        index = mid;
+        low = mid + 1;
+      }
+      else
+      {
+        high = mid - 1;
+      }
+    }
+    const storeExtent *extent = &reader->extents[index];
+
+    if (reader->source == NULL || reader->source_version != extent->version)
+    {
+      if (reader->source != NULL)
+      {
+        fclose(reader->source);
+      }
+      char file_name[strlen(reader->file_path) + VERSION_NAME_EXTRA];
+      createFileName(file_name, reader->file_path, extent->version);
+      reader->source = fopen(file_name, "rb");
+      reader->source_version = extent->version;
+      if (reader->source == NULL)
+      {
+        return -1;
+      }
+    }
+
+    long long skip = reader->position - reader->starts[index];
+    size_t want = size - total;
+    if ((long long)want > extent->length - skip)
+    {
+      want = (size_t)(extent->length - skip);
+    }
+    if (fseeko(reader->source, (off_t)(extent->offset + skip), SEEK_SET) != 0)
+    {
+      return -1;
+    }
+    size_t got = fread(buf + total, 1, want, reader->source);
+    if (got == 0)
+    {
+      return total > 0 ? (ssize_t)total : -1;
+    }
+    total += got;
+    reader->position += (long long)got;
+  }
+  return (ssize_t)total;
+}
+
+static int extentSeek(void *cookie, off64_t *offset, int whence)
+{
+  extentReader *reader = (extentReader *)cookie;
+  long long base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? reader->position : reader->length;
+  if (base + *offset < 0)
+  {
+    return -1;
+  }
+  reader->position = base + *offset;
+  *offset = reader->position;
+  return 0;
+}
+
+static int extentClose(void *cookie)
+{
+  extentReader *reader = (extentReader *)cookie;
+  if (reader->source != NULL)
+  {
+    fclose(reader->source);
+  }
+  free(reader->file_path);
+  free(reader->extents);
+  free(reader->starts);
+  free(reader);
+  return 0;
+}
+
+// Helper function:
+// Read from a cold version, inflating its compressed copy
+static ssize_t coldRead(void *cookie, char *buf, size_t size)
+{
+  coldReader *reader = (coldReader *)cookie;
+  if (reader->position >= reader->length)
+  {
+    return 0;
+  }
+  // Seeks only move the position; the copy follows on the next read
+  if (gztell(reader->copy) != reader->position && gzseek(reader->copy, reader->position, SEEK_SET) < 0)
+  {
+    return -1;
+  }
+  if ((long long)size > reader->length - reader->position)
+  {
+    size = (size_t)(reader->length - reader->position);
+  }
+  int got = gzread(reader->copy, buf, (unsigned)size);
+  if (got <= 0)
+  {
+    return -1;
+  }
+  reader->position += got;
+  return got;
+}
+
+static int coldSeek(void *cookie, off64_t *offset, int whence)
+{
+  coldReader *reader = (coldReader *)cookie;
+  long long base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? reader->position : reader->length;
+  if (base + *offset < 0)
+  {
+    return -1;
+  }
+  reader->position = base + *offset;
+  *offset = reader->position;
+  return 0;
+}
+
+static int coldClose(void *cookie)
+{
+  coldReader *reader = (coldReader *)cookie;
+  gzclose(reader->copy);
+  free(reader);
+  return 0;
+}
+
+// Helper function:
+// Stream the content of a cold version file from its copy under TIER_DIR
+// fp is the stub, positioned after its magic; it is closed here.
+static FILE *openCold(FILE *fp, const char *file_name)
+{
+  long long length;
+  char stub_name[COLD_NAME_SIZE];
+  char cold_name[TIER_NAME_SIZE];
+  size_t name_len = 0;
+  int ok = fread(&length, sizeof(length), 1, fp) == 1 && length >= 0;
+  if (ok)
+  {
+    name_len = fread(stub_name, 1, sizeof(stub_name) - 1, fp);
+    ok = name_len > 0 && name_len < sizeof(stub_name) - 1;
+  }
+  fclose(fp);
+  if (!ok)
+  {
+    return NULL;
+  }
+  stub_name[name_len] = '\0';
+  if (strcmp(stub_name, file_name) != 0 || !tierColdName(cold_name, sizeof(cold_name), file_name))
+  {
+    return NULL;
+  }
+
+  coldReader *reader = (coldReader *)calloc(1, sizeof(coldReader));
+  if (reader == NULL || (reader->copy = gzopen(cold_name, "rb")) == NULL)
+  {
+    free(reader);
+    return NULL;
+  }
+  gzbuffer(reader->copy, TRANSFER_CHUNK_SIZE);
+  reader->length = length;
+
+  cookie_io_functions_t io = {coldRead, NULL, coldSeek, coldClose};
+  fp = fopencookie(reader, "rb", io);
+  if (fp == NULL)
+  {
+    coldClose(reader);
+  }
+  return fp;
+}
+
+// Helper function:
+// Open the content of a version, recording the access when touch is set
+static FILE *openVersion(const char *file_path, int version, int touch)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  createFileName(file_name, file_path, version);
+  FILE *fp = openVersionFile(file_name, touch);
+  if (fp == NULL)
+  {
+    return NULL;
+  }
+  storeExtent *extents = NULL;
+  int count = 0;
+  int kind = readExtents(fp, &extents, &count);
+  if (kind == 0)
+  {
+    return fp;
+  }
+  if (kind == 2)
+  {
+    return openCold(fp, file_name);
+  }
+  fclose(fp);
+  if (kind < 0)
+  {
+    return NULL;
+  }
+
+  extentReader *reader = (extentReader *)calloc(1, sizeof(extentReader));
+  if (reader == NULL || (reader->file_path = strdup(file_path)) == NULL ||
+      (reader->starts = (long long *)malloc((count + 1) * sizeof(long long))) == NULL)
+  {
+    if (reader != NULL)
+    {
+      free(reader->file_path);
+      free(reader);
+    }
+    free(extents);
+    return NULL;
+  }
+  reader->extents = extents;
+  reader->count = count;
+  for (int i = 0; i < count; i++)
+  {
+    reader->starts[i] = reader->length;
+    reader->length += extents[i].length;
+  }
+
+  cookie_io_functions_t io = {extentRead, NULL, extentSeek, extentClose};
+  fp = fopencookie(reader, "rb", io);
+  if (fp == NULL)
+  {
+    extentClose(reader);
+  }
+  return fp;
+}
+
+// Function: open the content of a version for reading, NULL when missing
+// Plain versions are returned as the file itself; extent and cold versions as
+// a stream without a file descriptor (use fileLength, not fstat).
+FILE *storeOpen(const char *file_path, int version)
+{
+  return openVersion(file_path, version, 1);
+}
+
+// Function: size of a version's content, -1 when missing
+// Asking for the size is not an access of the content.
+long long storeLength(const char *file_path, int version)
+{
+  FILE *fp = openVersion(file_path, version, 0);
+  if (fp == NULL)
+  {
+    return -1;
+  }
+  long long length = fileLength(fp);
+  fclose(fp);
+  return length;
+}
+
+// Helper function:
+// The checksum recorded on a version file, if it still matches the file
+static int recordedChecksum(const char *file_name, char *checksum)
+{
+  char value[CHECKSUM_ATTR_SIZE];
+  ssize_t len = getxattr(file_name, CHECKSUM_ATTR, value, sizeof(value) - 1);
+  struct stat file_stat;
+  if (len <= 0 || stat(file_name, &file_stat) != 0)
+  {
+    return 0;
+  }
+  value[len] = '\0';
+  char recorded[CHECKSUM_SIZE];
+  long long sec;
+  long nsec;
+  if (sscanf(value, "%16s %lld %ld", recorded, &sec, &nsec) != 3 || strlen(recorded) != CHECKSUM_SIZE - 1 ||
+      sec != (long long)file_stat.st_mtim.tv_sec || nsec != file_stat.st_mtim.tv_nsec)
+  {
+    return 0;
+  }
+  strcpy(checksum, recorded);
+  return 1;
+}
+
+// Helper function:
+// Record a checksum on the version file of fd, stamped with its modification time
+static void recordChecksum(int fd, const char *checksum)
+{
+  struct stat file_stat;
+  char value[CHECKSUM_ATTR_SIZE];
+  if (fstat(fd, &file_stat) == 0)
+  {
+    int len = snprintf(value, sizeof(value), "%s %lld %ld", checksum, (long long)file_stat.st_mtim.tv_sec,
+                       file_stat.st_mtim.tv_nsec);
+    // Best effort: without extended attributes the checksum is computed on every request
+    fsetxattr(fd, CHECKSUM_ATTR, value, (size_t)len, 0);
+  }
+}
+
+// Function: record the checksum of a version whose content was just written
+void storeRecordChecksum(const char *file_path, int version, const char *checksum)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  createFileName(file_name, file_path, version);
+  int fd = open(file_name, O_RDONLY | O_NOATIME);
+  if (fd < 0)
+  {
+    fd = open(file_name, O_RDONLY);
+  }
+  if (fd >= 0)
+  {
+    recordChecksum(fd, checksum);
+    close(fd);
+  }
+}
+
+// Function: checksum of a version's content, as fileChecksum computes it
+// The recorded checksum is used when there is one; otherwise the content is
+// read once and its checksum recorded for the next request.
+int storeChecksum(const char *file_path, int version, char *checksum)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  createFileName(file_name, file_path, version);
+  if (recordedChecksum(file_name, checksum))
+  {
+    return 1;
+  }
+
+  // Record only on the file that was read, if nobody rewrote it meanwhile
+  struct stat before;
+  if (stat(file_name, &before) != 0)
+  {
+    return 0;
+  }
+  FILE *fp = openVersion(file_path, version, 0);
+  if (fp == NULL)
+  {
+    return 0;
+  }
+  int ok = streamChecksum(fp, checksum);
+  fclose(fp);
+
+  int fd = ok ? open(file_name, O_RDONLY | O_NOATIME) : -1;
+  if (ok && fd < 0)
+  {
+    fd = open(file_name, O_RDONLY);
+  }
+  struct stat after;
+  if (fd >= 0 && fstat(fd, &after) == 0 && after.st_ino == before.st_ino &&
+      after.st_mtim.tv_sec == before.st_mtim.tv_sec && after.st_mtim.tv_nsec == before.st_mtim.tv_nsec)
+  {
+    recordChecksum(fd, checksum);
+  }
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  return ok;
+}
+
+// Function: create an extent version; the new bytes are then written to the returned file
+FILE *storeBeginDelta(const char *file_path, int version)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  createFileName(file_name, file_path, version);
+  FILE *fp = fopen(file_name, "wb");
+  if (fp != NULL && fwrite(STORE_MAGIC, 1, STORE_MAGIC_SIZE, fp) != STORE_MAGIC_SIZE)
+  {
+    fclose(fp);
+    return NULL;
+  }
+  return fp;
+}
+
+// Helper function:
+// Add the part of an extent that falls in [from, to) of the content, merging
+// it with the previous extent when the bytes are contiguous in the same file
+static void addExtent(storeExtent *extents, int *count, const storeExtent *extent, long long start,
+                      long long from, long long to)
+{
+  long long low = start > from ? start : from;
+  long long high = start + extent->length < to ? start + extent->length : to;
+  if (low >= high)
+  {
+    return;
+  }
+  storeExtent *last = *count > 0 ? &extents[*count - 1] : NULL;
+  long long offset = extent->offset + (low - start);
+  if (last != NULL && last->version == extent->version && last->offset + last->length == offset)
+  {
+    last->length += high - low;
+    return;
+  }
+  extents[*count].version = extent->version;
+  extents[*count].reserved = 0;
+  extents[*count].offset = offset;
+  extents[*count].length = high - low;
+  (*count)++;
+}
+
+// Helper function:
+// Rewrite a version as a plain file once its map got too fragmented
+static int compactVersion(const char *file_path, int version)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  char temp_name[sizeof(file_name) + 8];
+  createFileName(file_name, file_path, version);
+  sprintf(temp_name, "%s.compact", file_name);
+
+  FILE *source = storeOpen(file_path, version);
+  FILE *target = fopen(temp_name, "wb");
+  int ok = source != NULL && target != NULL;
+  char buffer[TRANSFER_CHUNK_SIZE];
+  size_t bytesRead;
+  while (ok && (bytesRead = fread(buffer, 1, sizeof(buffer), source)) > 0)
+  {
+    ok = fwrite(buffer, 1, bytesRead, target) == bytesRead;
+  }
+  ok = ok && !ferror(source);
+  if (source != NULL)
+  {
+    fclose(source);
+  }
+  if (target != NULL)
+  {
+    ok = fclose(target) == 0 && ok;
+  }
+  if (!ok || rename(temp_name, file_name) != 0)
+  {
+    remove(temp_name);
+    return 0;
+  }
+  return 1;
+}
+
+// Function: finish an extent version whose len new bytes were written after storeBeginDelta
+// The new bytes replace [offset, offset + len) of base_version's content, or go at
+// its end for STORE_APPEND. Closes fp; returns 0 when the version cannot be stored.
+int storeCommitDelta(FILE *fp, const char *file_path, int base_version, int version, long long offset, long long len)
+{
+  int base_count = 0;
+  storeExtent *base = versionExtents(file_path, base_version, &base_count);
+  if (base == NULL)
+  {
+    fclose(fp);
+    return 0;
+  }
+  long long base_length = 0;
+  for (int i = 0; i < base_count; i++)
+  {
+    base_length += base[i].length;
+  }
+  if (offset == STORE_APPEND)
+  {
+    offset = base_length;
+  }
+  if (offset < 0 || offset > base_length)
+  {
+    free(base);
+    fclose(fp);
+    return 0;
+  }
+
+  // Unchanged bytes before the change, the new bytes, unchanged bytes after it
+  storeExtent *extents = (storeExtent *)malloc((base_count + 2) * sizeof(storeExtent));
+  int count = 0;
+  if (extents == NULL)
+  {
+    free(base);
+    fclose(fp);
+    return 0;
+  }
+  long long start = 0;
+  for (int i = 0; i < base_count; start += base[i].length, i++)
+  {
+    addExtent(extents, &count, &base[i], start, 0, offset);
+  }
+  storeExtent fresh = {version, 0, STORE_MAGIC_SIZE, len};
+  addExtent(extents, &count, &fresh, offset, offset, offset + len);
+  start = 0;
+  for (int i = 0; i < base_count; start += base[i].length, i++)
+  {
+    addExtent(extents, &count, &base[i], start, offset + len, base_length);
+  }
+  free(base);
+
+  // Marked as an extent file for the modification time the last write left
+  storeTrailer trailer = {count, 0};
+  struct stat written;
+  int ok = fseeko(fp, 0, SEEK_END) == 0 && fwrite(extents, sizeof(storeExtent), count, fp) == (size_t)count &&
+           fwrite(&trailer, sizeof(trailer), 1, fp) == 1 && fflush(fp) == 0 && fstat(fileno(fp), &written) == 0 &&
+           recordKind(fileno(fp), KIND_EXTENTS, &written.st_mtim);
+  ok = fclose(fp) == 0 && ok;
+  free(extents);
+
+  if (ok && count > STORE_MAX_EXTENTS)
+  {
+    ok = compactVersion(file_path, version);
+  }
+  return ok;
+}
+
+// Function: mark referenced[v] for every version v whose bytes an extent map of the path uses
+// referenced holds latest + 1 flags.
+void storeReferences(const char *file_path, int latest, char *referenced)
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  for (int v = 0; v <= latest; v++)
+  {
+    createFileName(file_name, file_path, v);
+    FILE *fp = openVersionFile(file_name, 0);
+    if (fp == NULL)
+    {
+      continue;
+    }
+    storeExtent *extents = NULL;
+    int count = 0;
+    if (readExtents(fp, &extents, &count) == 1)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        if (extents[i].version != v && extents[i].version >= 0 && extents[i].version <= latest)
+        {
+          referenced[extents[i].version] = 1;
+        }
+      }
+      free(extents);
+    }
+    fclose(fp);
+  }
+}
+
+// Function: move a version's content to a compressed copy under TIER_DIR, leaving a stub
+// The copy and the stub are written aside first and replace the version under
+// lock() only when its file did not change meanwhile. Returns 1 once frozen.
+int storeFreeze(const char *file_path, int version, void (*lock)(void), void (*unlock)(void))
+{
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  char stub_name[sizeof(file_name) + 8];
+  char cold_name[TIER_NAME_SIZE];
+  char cold_temp[TIER_NAME_SIZE + 8];
+  createFileName(file_name, file_path, version);
+  sprintf(stub_name, "%s.cold", file_name);
+
+  struct stat before;
+  if (strlen(file_name) >= COLD_NAME_SIZE - 1 || !tierColdName(cold_name, sizeof(cold_name), file_name) ||
+      stat(file_name, &before) != 0 || !S_ISREG(before.st_mode))
+  {
+    return 0;
+  }
+  sprintf(cold_temp, "%s.tmp", cold_name);
+
+  // Compress the content aside
+  makeParentDirs(cold_name);
+  FILE *source = openVersion(file_path, version, 0);
+  gzFile copy = source == NULL ? NULL : gzopen(cold_temp, "wb");
+  int ok = copy != NULL;
+  long long length = 0;
+  char buffer[TRANSFER_CHUNK_SIZE];
+  size_t bytesRead;
+  while (ok && (bytesRead = fread(buffer, 1, sizeof(buffer), source)) > 0)
+  {
+    ok = gzwrite(copy, buffer, (unsigned)bytesRead) == (int)bytesRead;
+    length += (long long)bytesRead;
+  }
+  ok = ok && !ferror(source);
+  if (source != NULL)
+  {
+    fclose(source);
+  }
+  if (copy != NULL)
+  {
+    ok = gzclose(copy) == Z_OK && ok;
+  }
+
+  // The stub keeps the version's times, which LS shows, and is marked cold for them
+  FILE *stub = ok ? fopen(stub_name, "wb") : NULL;
+  ok = stub != NULL && fwrite(COLD_MAGIC, 1, STORE_MAGIC_SIZE, stub) == STORE_MAGIC_SIZE &&
+       fwrite(&length, sizeof(length), 1, stub) == 1 &&
+       fwrite(file_name, 1, strlen(file_name), stub) == strlen(file_name) && fflush(stub) == 0 &&
+       recordKind(fileno(stub), KIND_COLD, &before.st_mtim);
+  if (stub != NULL)
+  {
+    // The recorded checksum moves along; it is stamped with the same times
+    char value[CHECKSUM_ATTR_SIZE];
+    ssize_t value_len = getxattr(file_name, CHECKSUM_ATTR, value, sizeof(value));
+    if (value_len > 0)
+    {
+      fsetxattr(fileno(stub), CHECKSUM_ATTR, value, (size_t)value_len, 0);
+    }
+    const struct timespec times[2] = {before.st_atim, before.st_mtim};
+    ok = futimens(fileno(stub), times) == 0 && ok;
+    ok = fclose(stub) == 0 && ok;
+  }
+
+  // Swap them in unless the version was removed or rewritten meanwhile
+  lock();
+  struct stat now;
+  ok = ok && stat(file_name, &now) == 0 && now.st_ino == before.st_ino && now.st_size == before.st_size &&
+       now.st_mtim.tv_sec == before.st_mtim.tv_sec && now.st_mtim.tv_nsec == before.st_mtim.tv_nsec &&
+       rename(cold_temp, cold_name) == 0 && rename(stub_name, file_name) == 0;
+  unlock();
+  if (!ok)
+  {
+    remove(cold_temp);
+    remove(stub_name);
+  }
+  return ok;
+}
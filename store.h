@@ -0,0 +1,21 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdio.h>
+
+// Versions built from more extents than this are rewritten as a plain copy
+#define STORE_MAX_EXTENTS 64
+
+// Offset passed to storeCommitDelta for an APPEND
+#define STORE_APPEND -1
+
+FILE *storeOpen(const char *file_path, int version);
+long long storeLength(const char *file_path, int version);
+int storeChecksum(const char *file_path, int version, char *checksum);
+void storeRecordChecksum(const char *file_path, int version, const char *checksum);
+FILE *storeBeginDelta(const char *file_path, int version);
+int storeCommitDelta(FILE *fp, const char *file_path, int base_version, int version, long long offset, long long len);
+void storeReferences(const char *file_path, int latest, char *referenced);
+int storeFreeze(const char *file_path, int version, void (*lock)(void), void (*unlock)(void));
+
+#endif
@@ -4,14 +4,34 @@
 local_dir="local"
 remote_dir="remote_files"
 file_version=".file_VERSION"
-rm -rf "$local_dir" "$remote_dir"
+cache_dir=".rfs_cache"
+replica_dir="replica_data"
+shard_dirs="shard_a shard_b shard_client"
+paced_dirs="paced_data paced_client"
+watch_dirs="watch_data watch_client"
+tier_dirs="tier_data tier_client"
+stress_dirs="stress_data stress_client"
+budget_dirs="budget_client mget_client"
+rm -rf "$local_dir" "$remote_dir" "$cache_dir" "$replica_dir" $shard_dirs $paced_dirs $watch_dirs $tier_dirs $stress_dirs $budget_dirs
 mkdir "$local_dir"
 mkdir "$remote_dir"
 truncate -s 0 "$file_version"
+rm -f .file_HISTORY
+
+# Frame a string as sendText does (shorter than 256 bytes)
+rawText() {
+    printf "$(printf '\\x%02x' ${#1})\\x00\\x00\\x00\\x00\\x00\\x00\\x00%s" "$1"
+}
 
 # Compile and initiate server
 make
-./rfserver &
+mkdir "$replica_dir"
+cp .config "$replica_dir/.config"
+./rfserver -p 1501 -d "$replica_dir" -r &
+replica_pid=$!
+./rfserver -R 127.0.0.1:1501 &
+server_pid=$!
+sleep 1
 
 # Test 1: Initial write test
 echo -e "\n----Test 1: Initial Write Operation----"
@@ -153,9 +173,11 @@ echo -e "\n----Test 6: Remove versioned file (RM)----"
 remote_file="$remote_dir/write.txt"
 
 # Execute RM command
-./rfs RM "$remote_file"
-if [ $? -ne 0 ]; then
+./rfs RM "$remote_file" | tee "$local_dir/rm.out"
+if [ "${PIPESTATUS[0]}" -ne 0 ]; then
     echo "Failed: RM operation"
+elif ! grep -q "'$remote_dir/write_1.txt' is removed successfully" "$local_dir/rm.out"; then
+    echo "Failed: RM response does not list every removed version"
 else
     # Verify remote file removal
     if [ -e "$remote_file" ]; then
@@ -195,8 +217,914 @@ else
     fi
 fi
 
-# Test 8: Server EXIT
-echo -e "\n----Test 8: Server EXIT Test----"
+# Test 8: Conditional GET served from the client cache
+echo -e "\n----Test 8: Conditional GET with Client Cache----"
+
+local_text="Cached content"
+local_file="$local_dir/cache.txt"
+remote_file="$remote_dir/cache.txt"
+printf "%s" "$local_text" >"$local_file"
+./rfs WRITE "$local_file" "$remote_file" >/dev/null
+
+# First GET downloads and fills the cache, second one is answered "not modified"
+./rfs GET "$remote_file" "$local_dir/cache_get.txt" >/dev/null
+response=$(./rfs GET "$remote_file" "$local_dir/cache_get.txt")
+if [ $? -ne 0 ]; then
+    echo "Failed: Cached GET operation"
+elif ! echo "$response" | grep -q "not modified"; then
+    echo "Failed: Unchanged file was transferred again"
+elif [ "$(cat $local_dir/cache_get.txt)" != "$local_text" ]; then
+    echo "Failed: Cached GET content mismatch"
+else
+    echo "Passed: Unchanged file served from client cache"
+fi
+
+# A new version on the server must be transferred again
+local_text="Cached content, second version"
+printf "%s" "$local_text" >"$local_file"
+./rfs WRITE "$local_file" "$remote_file" >/dev/null
+./rfs GET "$remote_file" "$local_dir/cache_get.txt" >/dev/null
+if [ "$(cat $local_dir/cache_get.txt)" == "$local_text" ]; then
+    echo "Passed: New version fetched past the cache"
+else
+    echo "Failed: Stale cached content returned"
+fi
+
+# The checksum recorded with a version does not outlive a rewrite of its file
+printf "%s" "Rewritten behind the server's back" >"$remote_dir/cache_1.txt"
+./rfs GET "$remote_file" "$local_dir/cache_get.txt" >/dev/null
+if [ "$(cat $local_dir/cache_get.txt)" == "Rewritten behind the server's back" ]; then
+    echo "Passed: Recorded checksum is dropped when the version file changes"
+else
+    echo "Failed: Stale recorded checksum answered the GET"
+fi
+
+# Test 9: Asynchronous replication and reads from a replica
+echo -e "\n----Test 9: Replication to a Read Replica----"
+
+local_file="$local_dir/replicated.txt"
+remote_file="$remote_dir/replicated.txt"
+printf "%s" "Replicated v0" >"$local_file"
+./rfs WRITE "$local_file" "$remote_file" >/dev/null
+printf "%s" "Replicated v1" >"$local_file"
+./rfs WRITE "$local_file" "$remote_file" >/dev/null
+
+# Replication is asynchronous: give the replica a moment to catch up
+for i in $(seq 1 20); do
+    [ -e "$replica_dir/$remote_dir/replicated_1.txt" ] && break
+    sleep 0.2
+done
+if [ "$(cat $replica_dir/$remote_dir/replicated.txt 2>/dev/null)" == "Replicated v0" ] &&
+   [ "$(cat $replica_dir/$remote_dir/replicated_1.txt 2>/dev/null)" == "Replicated v1" ]; then
+    echo "Passed: Versions shipped to the replica"
+else
+    echo "Failed: Replica is missing versions"
+fi
+
+# Reads fan out to the replica when READ_REPLICAS is configured
+mkdir -p fanout_client
+printf "IP_ADDRESS=127.0.0.1\nREAD_REPLICAS=127.0.0.1:1501\n" >fanout_client/.config
+(cd fanout_client && ../rfs GET "$remote_file" get.txt >/dev/null)
+if [ "$(cat fanout_client/get.txt 2>/dev/null)" == "Replicated v1" ]; then
+    echo "Passed: GET served with read fan-out"
+else
+    echo "Failed: GET with read fan-out"
+fi
+rm -rf fanout_client
+
+./rfs RM "$remote_file" >/dev/null
+for i in $(seq 1 20); do
+    ! [ -e "$replica_dir/$remote_dir/replicated.txt" ] && break
+    sleep 0.2
+done
+if [ -e "$replica_dir/$remote_dir/replicated.txt" ]; then
+    echo "Failed: RM not replicated"
+else
+    echo "Passed: RM replicated"
+fi
+
+# A path removed and written again while the replica was down is replaced on catch-up
+remote_file="$remote_dir/diverged.txt"
+printf "%s" "Before the outage" >"$local_file"
+./rfs WRITE "$local_file" "$remote_file" >/dev/null
+for i in $(seq 1 20); do
+    [ -e "$replica_dir/$remote_file" ] && break
+    sleep 0.2
+done
+kill -9 $replica_pid
+wait $replica_pid 2>/dev/null
+./rfs RM "$remote_file" >/dev/null
+printf "%s" "After the outage" >"$local_file"
+./rfs WRITE "$local_file" "$remote_file" >/dev/null
+./rfserver -p 1501 -d "$replica_dir" -r &
+replica_pid=$!
+for i in $(seq 1 30); do
+    [ "$(cat $replica_dir/$remote_file 2>/dev/null)" == "After the outage" ] && break
+    sleep 0.2
+done
+if [ "$(cat $replica_dir/$remote_file 2>/dev/null)" == "After the outage" ]; then
+    echo "Passed: Catch-up replaces a path rewritten under the same version number"
+else
+    echo "Failed: Replica kept the old content of a rewritten path"
+fi
+
+# Test 10: Path-sharded cluster and rebalancing
+echo -e "\n----Test 10: Sharded Cluster and Rebalance----"
+
+for shard in shard_a shard_b; do
+    mkdir -p "$shard/$remote_dir"
+    cp .config "$shard/.config"
+done
+./rfserver -p 1502 -d shard_a >/dev/null &
+shard_a_pid=$!
+./rfserver -p 1503 -d shard_b >/dev/null &
+shard_b_pid=$!
+mkdir shard_client
+printf "IP_ADDRESS=127.0.0.1\nSHARDS=127.0.0.1:1502\n" >shard_client/.config
+sleep 1
+
+# With a single shard every path lands on it
+for i in $(seq 1 8); do
+    printf "%s" "Shard file $i" >"$local_dir/shard_$i.txt"
+    (cd shard_client && ../rfs WRITE "../$local_dir/shard_$i.txt" "$remote_dir/shard_$i.txt" >/dev/null)
+done
+if [ "$(ls shard_a/$remote_dir | wc -l)" -eq 8 ]; then
+    echo "Passed: Single shard holds every path"
+else
+    echo "Failed: Paths not routed to the only shard"
+fi
+
+# Adding a shard and rebalancing moves the paths it now owns
+printf "IP_ADDRESS=127.0.0.1\nSHARDS=127.0.0.1:1502,127.0.0.1:1503\n" >shard_client/.config
+(cd shard_client && ../rfs REBALANCE >/dev/null)
+count_a=$(ls shard_a/$remote_dir | wc -l)
+count_b=$(ls shard_b/$remote_dir | wc -l)
+if [ "$count_b" -gt 0 ] && [ $((count_a + count_b)) -eq 8 ]; then
+    echo "Passed: Rebalance moved $count_b of 8 paths to the new shard"
+else
+    echo "Failed: Rebalance left shard_a=$count_a shard_b=$count_b"
+fi
+
+# Every path is still readable through the ring
+all_found=1
+for i in $(seq 1 8); do
+    (cd shard_client && ../rfs GET "$remote_dir/shard_$i.txt" get.txt >/dev/null 2>&1)
+    [ "$(cat shard_client/get.txt 2>/dev/null)" == "Shard file $i" ] || all_found=0
+done
+if [ $all_found -eq 1 ]; then
+    echo "Passed: GET routed to the owning shard"
+else
+    echo "Failed: GET through the shard ring"
+fi
+kill $shard_a_pid $shard_b_pid
+rm -rf $shard_dirs
+
+# Test 11: Connection storm across the acceptors
+echo -e "\n----Test 11: Concurrent Connection Storm----"
+
+printf "%s" "Storm" >"$local_dir/storm.txt"
+./rfs WRITE "$local_dir/storm.txt" "$remote_dir/storm.txt" >/dev/null
+storm_failures=0
+storm_pids=()
+for i in $(seq 1 100); do
+    ./rfs LS "$remote_dir/storm.txt" >/dev/null 2>&1 &
+    storm_pids+=($!)
+done
+for pid in "${storm_pids[@]}"; do
+    wait $pid || storm_failures=$((storm_failures + 1))
+done
+if [ $storm_failures -eq 0 ]; then
+    echo "Passed: 100 concurrent requests served"
+else
+    echo "Failed: $storm_failures of 100 concurrent requests failed"
+fi
+
+# Test 12: Bulk transfers are paced, metadata requests are not
+echo -e "\n----Test 12: Fair Bandwidth Scheduling----"
+
+mkdir -p "paced_data/$remote_dir" paced_client
+printf "IP_ADDRESS=127.0.0.1\nBULK_RATE=1048576\n" >paced_data/.config
+./rfserver -p 1504 -d paced_data >/dev/null &
+paced_pid=$!
+printf "IP_ADDRESS=127.0.0.1\nPORT=1504\n" >paced_client/.config
+sleep 1
+
+# 3 MiB at 1 MiB/s keeps the server busy for about three seconds
+head -c 3145728 /dev/urandom >"$local_dir/bulk.bin"
+(cd paced_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/small.txt" >/dev/null)
+bulk_start=$(date +%s%N)
+(cd paced_client && ../rfs WRITE "../$local_dir/bulk.bin" "$remote_dir/bulk.bin" >/dev/null) &
+bulk_pid=$!
+sleep 0.5
+slowest_ls=0
+for i in $(seq 1 10); do
+    ls_start=$(date +%s%N)
+    (cd paced_client && ../rfs LS "$remote_dir/small.txt" >/dev/null)
+    ls_time=$((($(date +%s%N) - ls_start) / 1000000))
+    [ $ls_time -gt $slowest_ls ] && slowest_ls=$ls_time
+done
+wait $bulk_pid
+bulk_time=$((($(date +%s%N) - bulk_start) / 1000000))
+if [ $bulk_time -ge 2000 ] && cmp -s "$local_dir/bulk.bin" "paced_data/$remote_dir/bulk.bin"; then
+    echo "Passed: Bulk WRITE paced to BULK_RATE (${bulk_time}ms)"
+else
+    echo "Failed: Bulk WRITE took ${bulk_time}ms or arrived corrupted"
+fi
+if [ $slowest_ls -lt 500 ]; then
+    echo "Passed: LS stays fast during a bulk transfer (slowest ${slowest_ls}ms)"
+else
+    echo "Failed: LS took ${slowest_ls}ms during a bulk transfer"
+fi
+kill $paced_pid
+
+# With a worker pool, uploads queued for the single bulk slot (in separate folders,
+# each under its own lock) do not hold the workers
+printf "IP_ADDRESS=127.0.0.1\nBULK_RATE=1048576\nWORKERS=2\nBULK_SLOTS=1\n" >paced_data/.config
+sleep 0.5
+./rfserver -p 1504 -d paced_data >/dev/null &
+paced_pid=$!
+sleep 1
+head -c 1048576 /dev/urandom >"$local_dir/bulk.bin"
+queued_pids=""
+for i in 1 2 3; do
+    (cd paced_client && ../rfs WRITE "../$local_dir/bulk.bin" "$remote_dir/queued_$i/bulk.bin" >/dev/null) &
+    queued_pids="$queued_pids $!"
+done
+sleep 0.5
+slowest_ls=0
+for i in $(seq 1 10); do
+    ls_start=$(date +%s%N)
+    (cd paced_client && ../rfs LS "$remote_dir/small.txt" >/dev/null)
+    ls_time=$((($(date +%s%N) - ls_start) / 1000000))
+    [ $ls_time -gt $slowest_ls ] && slowest_ls=$ls_time
+done
+wait $queued_pids
+if [ $slowest_ls -lt 500 ] && cmp -s "$local_dir/bulk.bin" "paced_data/$remote_dir/queued_3/bulk.bin"; then
+    echo "Passed: LS stays fast while uploads wait for a bulk slot (slowest ${slowest_ls}ms)"
+else
+    echo "Failed: LS took ${slowest_ls}ms while uploads waited for a bulk slot"
+fi
+kill $paced_pid
+rm -rf $paced_dirs
+
+# Test 13: Zero-downtime upgrade by listener handoff
+echo -e "\n----Test 13: Zero-downtime Upgrade----"
+
+# A 32 MiB WRITE still streaming when the listeners move commits on the old server while it drains
+head -c 33554432 /dev/urandom >"$local_dir/drained.bin"
+(
+    exec 3<>/dev/tcp/127.0.0.1/1500 || exit
+    { rawText WRITE; rawText "$remote_dir/drained.bin"; printf '\x00\x00\x00\x02\x00\x00\x00\x00'; } >&3
+    head -c 1 "$local_dir/drained.bin" >&3
+    sleep 2
+    tail -c +2 "$local_dir/drained.bin" >&3
+    cat <&3 >/dev/null
+) &
+drain_pid=$!
+
+# Keep clients busy until the old server has handed over its listening sockets
+rm -f "$local_dir/upgrade_done"
+(
+    failures=0
+    requests=0
+    while [ ! -e "$local_dir/upgrade_done" ] || [ $requests -lt 60 ]; do
+        ./rfs GET "$remote_dir/storm.txt" "$local_dir/upgrade_get.txt" >/dev/null 2>&1 || failures=$((failures + 1))
+        requests=$((requests + 1))
+    done
+    echo $failures >"$local_dir/upgrade_failures.txt"
+) &
+load_pid=$!
+sleep 0.2
+./rfserver -u -R 127.0.0.1:1501 &
+for i in $(seq 1 100); do
+    kill -0 $server_pid 2>/dev/null || break
+    sleep 0.1
+done
+touch "$local_dir/upgrade_done"
+wait $load_pid
+if kill -0 $server_pid 2>/dev/null; then
+    echo "Failed: The old server is still running after the upgrade"
+elif [ "$(cat $local_dir/upgrade_failures.txt)" == "0" ]; then
+    echo "Passed: No failed requests during the upgrade"
+else
+    echo "Failed: $(cat $local_dir/upgrade_failures.txt) requests failed during the upgrade"
+fi
+wait $drain_pid
+for i in $(seq 1 20); do
+    cmp -s "$replica_dir/$remote_dir/drained.bin" "$local_dir/drained.bin" && break
+    sleep 0.2
+done
+if cmp -s "$replica_dir/$remote_dir/drained.bin" "$local_dir/drained.bin"; then
+    echo "Passed: A commit made while draining reaches the replica"
+else
+    echo "Failed: A commit made while draining never reached the replica"
+fi
+
+# Test 14: Point-in-time reads pinned by a snapshot time
+echo -e "\n----Test 14: Point-in-time Snapshot Reads----"
+
+printf "%s" "Config A" >"$local_dir/pinned_a.txt"
+printf "%s" "Data A" >"$local_dir/pinned_b.txt"
+./rfs WRITE "$local_dir/pinned_a.txt" "$remote_dir/pinned_a.txt" >/dev/null
+./rfs WRITE "$local_dir/pinned_b.txt" "$remote_dir/pinned_b.txt" >/dev/null
+snapshot=$(./rfs SNAPSHOT | tail -n 1)
+printf "%s" "Config B" >"$local_dir/pinned_a.txt"
+printf "%s" "Data B" >"$local_dir/pinned_b.txt"
+./rfs WRITE "$local_dir/pinned_a.txt" "$remote_dir/pinned_a.txt" >/dev/null
+./rfs WRITE "$local_dir/pinned_b.txt" "$remote_dir/pinned_b.txt" >/dev/null
+
+./rfs GET --at "$snapshot" "$remote_dir/pinned_a.txt" "$local_dir/pinned_get.txt" >/dev/null
+if [ "$(cat $local_dir/pinned_get.txt)" == "Config A" ]; then
+    echo "Passed: GET --at returns the version current at the snapshot"
+else
+    echo "Failed: GET --at returned '$(cat $local_dir/pinned_get.txt)'"
+fi
+
+./rfs SNAPSHOT "$snapshot" "$local_dir/pinned_tree" "$remote_dir/pinned_a.txt" "$remote_dir/pinned_b.txt" >/dev/null
+if [ "$(cat $local_dir/pinned_tree/$remote_dir/pinned_a.txt)" == "Config A" ] &&
+    [ "$(cat $local_dir/pinned_tree/$remote_dir/pinned_b.txt)" == "Data A" ]; then
+    echo "Passed: SNAPSHOT downloads one consistent state of several paths"
+else
+    echo "Failed: SNAPSHOT mixed versions from different times"
+fi
+
+if ./rfs GET --at 1 "$remote_dir/pinned_a.txt" "$local_dir/pinned_get.txt" >/dev/null 2>&1; then
+    echo "Failed: GET --at before the first version succeeded"
+else
+    echo "Passed: GET --at before the first version is refused"
+fi
+
+# Removing a folder forgets the history of the files inside it
+printf "%s" "Old inner" >"$local_dir/pinned_inner.txt"
+./rfs WRITE "$local_dir/pinned_inner.txt" "$remote_dir/pinned_dir/inner.txt" >/dev/null
+snapshot=$(./rfs SNAPSHOT | tail -n 1)
+./rfs RM "$remote_dir/pinned_dir" >/dev/null
+printf "%s" "New inner" >"$local_dir/pinned_inner.txt"
+./rfs WRITE "$local_dir/pinned_inner.txt" "$remote_dir/pinned_dir/inner.txt" >/dev/null
+if ./rfs GET --at "$snapshot" "$remote_dir/pinned_dir/inner.txt" "$local_dir/pinned_get.txt" >/dev/null 2>&1; then
+    echo "Failed: GET --at resolved a file from a removed folder to '$(cat $local_dir/pinned_get.txt)'"
+else
+    echo "Passed: RM of a folder forgets the history of its files"
+fi
+
+# A history line longer than any fixed buffer does not stall the index
+history_long="$remote_dir"
+for i in 1 2 3 4 5; do
+    history_long="$history_long/$(printf 'h%.0s' $(seq 1 220))"
+done
+./rfs WRITE "$local_dir/pinned_inner.txt" "$history_long/long.txt" >/dev/null
+printf "%s" "After A" >"$local_dir/pinned_after.txt"
+./rfs WRITE "$local_dir/pinned_after.txt" "$remote_dir/pinned_after.txt" >/dev/null
+snapshot=$(./rfs SNAPSHOT | tail -n 1)
+printf "%s" "After B" >"$local_dir/pinned_after.txt"
+./rfs WRITE "$local_dir/pinned_after.txt" "$remote_dir/pinned_after.txt" >/dev/null
+./rfs GET --at "$snapshot" "$remote_dir/pinned_after.txt" "$local_dir/pinned_get.txt" >/dev/null 2>&1
+if [ "$(cat $local_dir/pinned_get.txt)" == "After A" ]; then
+    echo "Passed: history keeps indexing after a very long path"
+else
+    echo "Failed: GET --at after a long path returned '$(cat $local_dir/pinned_get.txt)'"
+fi
+
+# Test 15: Many files in one round trip
+echo -e "\n----Test 15: Multi-file MWRITE and MGET----"
+
+mkdir "$local_dir/multi"
+multi_paths=()
+for i in $(seq 1 20); do
+    printf "%s" "Multi file $i" >"$local_dir/multi/multi_$i.txt"
+    multi_paths+=("$remote_dir/multi_$i.txt")
+done
+./rfs MWRITE "$remote_dir" "$local_dir"/multi/multi_*.txt >"$local_dir/mwrite.txt" 2>&1
+if [ $? -eq 0 ] && [ "$(grep -c Successfully $local_dir/mwrite.txt)" -eq 20 ]; then
+    echo "Passed: MWRITE stored 20 files over one connection"
+else
+    echo "Failed: MWRITE did not store every file"
+fi
+
+./rfs MGET "$local_dir/mget" "${multi_paths[@]}" >/dev/null
+all_found=1
+for i in $(seq 1 20); do
+    [ "$(cat $local_dir/mget/$remote_dir/multi_$i.txt 2>/dev/null)" == "Multi file $i" ] || all_found=0
+done
+if [ $all_found -eq 1 ]; then
+    echo "Passed: MGET fetched 20 files in one round trip"
+else
+    echo "Failed: MGET content mismatch"
+fi
+
+# Second fetch is answered from the cache; a missing path fails on its own
+printf "%s\n" "${multi_paths[@]}" "$remote_dir/missing.txt" | ./rfs MGET "$local_dir/mget" >"$local_dir/mget.txt" 2>&1
+mget_status=$?
+if [ $mget_status -ne 0 ] && [ "$(grep -c 'from cache' $local_dir/mget.txt)" -eq 20 ] &&
+    grep -q "missing.txt: File not found" "$local_dir/mget.txt"; then
+    echo "Passed: Per-item status with cached items and a missing path"
+else
+    echo "Failed: MGET per-item status"
+fi
+
+# A cache budget is kept while MGET fills the cache
+mkdir budget_client
+printf "IP_ADDRESS=127.0.0.1\nPORT=1500\nCACHE_BUDGET=100\n" >budget_client/.config
+(cd budget_client && ../rfs MGET mget "${multi_paths[@]}" >/dev/null)
+all_found=1
+for i in $(seq 1 20); do
+    [ "$(cat budget_client/mget/$remote_dir/multi_$i.txt 2>/dev/null)" == "Multi file $i" ] || all_found=0
+done
+budget_used=$(find "budget_client/$cache_dir" -type f -name 'v*' -printf '%s\n' | awk '{ total += $1 } END { print total + 0 }')
+if [ $all_found -eq 1 ] && [ "$budget_used" -gt 0 ] && [ "$budget_used" -le 100 ] &&
+    [ -z "$(find "budget_client/$cache_dir" -name '.tmp*')" ]; then
+    echo "Passed: MGET keeps the client cache within CACHE_BUDGET"
+else
+    echo "Failed: Client cache holds $budget_used byte(s) over a budget of 100"
+fi
+
+# Longer lists than MGET_MAX go out in several requests; a larger count is refused
+mkdir mget_client
+printf "IP_ADDRESS=127.0.0.1\nPORT=1500\nMGET_MAX=7\n" >mget_client/.config
+(cd mget_client && ../rfs MGET mget "${multi_paths[@]}" >../$local_dir/mget_split.txt 2>&1)
+mget_status=$?
+mget_refused=$(
+    exec 3<>/dev/tcp/127.0.0.1/1500
+    { rawText MGET; printf '\x88\x13\x00\x00'; } >&3
+    timeout 5 cat <&3 >/dev/null && echo closed
+)
+if [ $mget_status -eq 0 ] && [ "$(grep -c 'Served' $local_dir/mget_split.txt)" -eq 3 ] &&
+    [ "$(ls mget_client/mget/$remote_dir | wc -l)" -eq 20 ] && [ "$mget_refused" == "closed" ]; then
+    echo "Passed: MGET batches are bounded by MGET_MAX"
+else
+    echo "Failed: MGET_MAX split or refusal"
+fi
+rm -rf $budget_dirs
+
+# Test 16: Request phase tracing
+echo -e "\n----Test 16: Request Phase Tracing----"
+
+./rfs TRACE on >/dev/null
+printf "%s" "Traced content" >"$local_dir/traced.txt"
+./rfs WRITE "$local_dir/traced.txt" "$remote_dir/traced.txt" >/dev/null
+./rfs GET "$remote_dir/traced.txt" "$local_dir/traced_get.txt" >/dev/null
+./rfs TRACE dump "$local_dir/trace.json" >/dev/null
+if grep -q '"traceEvents"' "$local_dir/trace.json" && grep -q '"name":"WRITE"' "$local_dir/trace.json" &&
+    grep -q '"name":"disk write"' "$local_dir/trace.json" && grep -q '"name":"resolve version"' "$local_dir/trace.json"; then
+    echo "Passed: Trace dump holds request and phase spans"
+else
+    echo "Failed: Trace dump is missing spans"
+fi
+
+# Requests made while tracing is off leave no spans behind
+./rfs TRACE off >/dev/null
+./rfs LS "$remote_dir/traced.txt" >/dev/null
+./rfs TRACE dump "$local_dir/trace_off.json" >/dev/null
+if [ "$(grep -c '"name":' $local_dir/trace.json)" -le "$(grep -c '"name":' $local_dir/trace_off.json)" ] &&
+    ! grep -q '"name":"LS"' "$local_dir/trace_off.json"; then
+    echo "Passed: No spans recorded while tracing is off"
+else
+    echo "Failed: Spans recorded while tracing is off"
+fi
+
+# Test 17: Copy-on-write APPEND and PATCH
+echo -e "\n----Test 17: Copy-on-write APPEND and PATCH----"
+
+head -c 262144 /dev/urandom >"$local_dir/log.bin"
+./rfs WRITE "$local_dir/log.bin" "$remote_dir/log.bin" >/dev/null
+head -c 1000 /dev/urandom >"$local_dir/log_tail.bin"
+./rfs APPEND "$local_dir/log_tail.bin" "$remote_dir/log.bin" >/dev/null
+cat "$local_dir/log.bin" "$local_dir/log_tail.bin" >"$local_dir/log_expected.bin"
+./rfs GET "$remote_dir/log.bin" "$local_dir/log_get.bin" >/dev/null
+if cmp -s "$local_dir/log_get.bin" "$local_dir/log_expected.bin" &&
+    [ "$(stat -c %s $remote_dir/log_1.bin)" -lt 2048 ]; then
+    echo "Passed: APPEND stores only the new bytes and GET returns the whole file"
+else
+    echo "Failed: APPEND content or stored size"
+fi
+
+# Overwrite a range in the middle; the unchanged extents stay shared
+head -c 500 /dev/urandom >"$local_dir/log_patch.bin"
+./rfs PATCH "$local_dir/log_patch.bin" "$remote_dir/log.bin" 100000 >/dev/null
+dd if="$local_dir/log_patch.bin" of="$local_dir/log_expected.bin" bs=1 seek=100000 conv=notrunc status=none
+./rfs GET "$remote_dir/log.bin" "$local_dir/log_get.bin" >/dev/null
+if cmp -s "$local_dir/log_get.bin" "$local_dir/log_expected.bin" &&
+    [ "$(stat -c %s $remote_dir/log_2.bin)" -lt 2048 ]; then
+    echo "Passed: PATCH replaces a byte range copy-on-write"
+else
+    echo "Failed: PATCH content or stored size"
+fi
+
+# Replicas receive the whole content of the new versions
+for i in $(seq 1 20); do
+    cmp -s "$replica_dir/$remote_dir/log_2.bin" "$local_dir/log_expected.bin" && break
+    sleep 0.2
+done
+if cmp -s "$replica_dir/$remote_dir/log_2.bin" "$local_dir/log_expected.bin"; then
+    echo "Passed: Patched version replicated"
+else
+    echo "Failed: Patched version not replicated"
+fi
+
+if ./rfs PATCH "$local_dir/log_patch.bin" "$remote_dir/log.bin" 999999 | grep -q "outside the file"; then
+    echo "Passed: PATCH past the end of the file is refused"
+else
+    echo "Failed: PATCH past the end of the file"
+fi
+
+# An upload that looks like an extent file is stored and served as content
+{
+    printf '\x00RFS-EXTENTS-1\n\x00'
+    printf '\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x40\x00\x00\x00\x00\x00\x00\x00'
+    printf '\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00'
+} >"$local_dir/extents.bin"
+./rfs WRITE "$local_dir/extents.bin" "$remote_dir/extents.bin" >/dev/null
+./rfs GET "$remote_dir/extents.bin" "$local_dir/extents_get.bin" >/dev/null
+if cmp -s "$local_dir/extents.bin" "$local_dir/extents_get.bin"; then
+    echo "Passed: Content that looks like an extent map is served as uploaded"
+else
+    echo "Failed: Uploaded content was read as an extent map"
+fi
+
+# Test 18: Server-side DIFF
+echo -e "\n----Test 18: Server-side DIFF----"
+
+seq 1 200 >"$local_dir/lines.txt"
+./rfs WRITE "$local_dir/lines.txt" "$remote_dir/lines.txt" >/dev/null
+sed -e 's/^50$/fifty/' -e '/^120$/d' "$local_dir/lines.txt" >"$local_dir/lines_new.txt"
+./rfs WRITE "$local_dir/lines_new.txt" "$remote_dir/lines.txt" >/dev/null
+./rfs DIFF "$remote_dir/lines.txt" 0 1 "$local_dir/lines.diff" >/dev/null
+if grep -q '^@@ -47,7 +47,7 @@$' "$local_dir/lines.diff" && grep -q '^-50$' "$local_dir/lines.diff" &&
+    grep -q '^+fifty$' "$local_dir/lines.diff" && grep -q '^-120$' "$local_dir/lines.diff" &&
+    [ "$(grep -c '^[-+][^-+]' $local_dir/lines.diff)" -eq 3 ]; then
+    echo "Passed: DIFF returns a minimal unified diff of two versions"
+else
+    echo "Failed: DIFF output"
+fi
+
+# The same pair again is answered from the result cache
+if ./rfs DIFF "$remote_dir/lines.txt" v0 latest "$local_dir/lines_again.diff" | grep -q "(cached)" &&
+    cmp -s "$local_dir/lines.diff" "$local_dir/lines_again.diff"; then
+    echo "Passed: Repeated DIFF served from the cache"
+else
+    echo "Failed: Repeated DIFF not cached"
+fi
+
+# Binary files get a copy/insert delta far smaller than either version
+./rfs DIFF -b "$remote_dir/log.bin" 0 2 "$local_dir/log.delta" >/dev/null
+if head -c 8 "$local_dir/log.delta" | grep -q "RFSDELTA" && [ "$(stat -c %s $local_dir/log.delta)" -lt 4096 ]; then
+    echo "Passed: Binary delta between versions is compact"
+else
+    echo "Failed: Binary delta between versions"
+fi
+
+# Past DIFF_MAX_COST edits a region is reported replaced whole, still a valid diff
+seq 1 100000 >"$local_dir/costly.txt"
+awk '{ print (NR % 10 == 0 ? "changed " $0 : $0) }' "$local_dir/costly.txt" >"$local_dir/costly_new.txt"
+./rfs WRITE "$local_dir/costly.txt" "$remote_dir/costly.txt" >/dev/null
+./rfs WRITE "$local_dir/costly_new.txt" "$remote_dir/costly.txt" >/dev/null
+./rfs DIFF "$remote_dir/costly.txt" 0 1 "$local_dir/costly.diff" >/dev/null
+cp "$local_dir/costly.txt" "$local_dir/costly_patched.txt"
+if [ "$(grep -c '^@@' $local_dir/costly.diff)" -eq 1 ] &&
+    patch -s "$local_dir/costly_patched.txt" "$local_dir/costly.diff" &&
+    cmp -s "$local_dir/costly_patched.txt" "$local_dir/costly_new.txt"; then
+    echo "Passed: DIFF gives up on an expensive split with one replace hunk"
+else
+    echo "Failed: DIFF of a heavily edited file"
+fi
+
+if ./rfs DIFF "$remote_dir/lines.txt" 0 7 | grep -q "No such version"; then
+    echo "Passed: DIFF against a missing version is refused"
+else
+    echo "Failed: DIFF against a missing version"
+fi
+
+# Test 19: WATCH subscriptions
+echo -e "\n----Test 19: WATCH Subscriptions----"
+
+# A wide coalescing window makes the burst below land in one batch
+mkdir -p "watch_data/$remote_dir" watch_client
+printf "IP_ADDRESS=127.0.0.1\nWATCH_COALESCE_MS=300\n" >watch_data/.config
+./rfserver -p 1505 -d watch_data >/dev/null &
+watch_pid=$!
+printf "IP_ADDRESS=127.0.0.1\nPORT=1505\n" >watch_client/.config
+sleep 1
+
+(cd watch_client && timeout 10 ../rfs WATCH -n 3 "$remote_dir/watch_*" >"../$local_dir/watch.out") &
+watcher_pid=$!
+sleep 0.3
+for i in $(seq 1 5); do
+    (cd watch_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/watch_a.txt" >/dev/null)
+done
+(cd watch_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/unwatched.txt" >/dev/null)
+sleep 0.6
+(cd watch_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/watch_b.txt" >/dev/null)
+sleep 0.6
+(cd watch_client && ../rfs RM "$remote_dir/watch_b.txt" >/dev/null)
+wait $watcher_pid
+if [ "$(grep -c ' WRITE ' $local_dir/watch.out)" -eq 2 ] && grep -q "WRITE $remote_dir/watch_a.txt v4$" "$local_dir/watch.out" &&
+    grep -q "RM $remote_dir/watch_b.txt$" "$local_dir/watch.out" && ! grep -q "unwatched" "$local_dir/watch.out"; then
+    echo "Passed: WATCH pushes matching commits with bursts coalesced"
+else
+    echo "Failed: WATCH events"
+fi
+
+# Resuming replays what was missed, collapsed to the latest event per path
+watch_base=$(grep "^Watching" "$local_dir/watch.out" | awk '{print $NF}')
+(cd watch_client && timeout 5 ../rfs WATCH -s "$watch_base" -n 1 "$remote_dir/watch_*" >"../$local_dir/watch_resume.out")
+if grep -q "^$((watch_base + 4)) WRITE $remote_dir/watch_a.txt v4$" "$local_dir/watch_resume.out" &&
+    grep -q "^$((watch_base + 7)) RM $remote_dir/watch_b.txt$" "$local_dir/watch_resume.out"; then
+    echo "Passed: WATCH resumes from a sequence number"
+else
+    echo "Failed: WATCH resume"
+fi
+
+# A restarted server numbers its events from 1 again, under a new epoch:
+# numbers from the earlier process reset even once the new one has passed them
+kill $watch_pid
+wait $watch_pid 2>/dev/null
+./rfserver -p 1505 -d watch_data >/dev/null &
+watch_pid=$!
+sleep 1
+for i in $(seq 1 3); do
+    (cd watch_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/watch_c.txt" >/dev/null)
+done
+(cd watch_client && timeout 5 ../rfs WATCH -s $((watch_base + 1)) -n 1 >"../$local_dir/watch_reset.out")
+if grep -q "RESET" "$local_dir/watch_reset.out" && ! grep -q "WRITE" "$local_dir/watch_reset.out"; then
+    echo "Passed: WATCH resets a sequence number from an earlier server"
+else
+    echo "Failed: WATCH resumed a sequence number from an earlier server"
+fi
+
+# Every subscription holds a thread: beyond WATCH_MAX they are turned down
+kill $watch_pid
+wait $watch_pid 2>/dev/null
+printf "WATCH_MAX=1\n" >>watch_data/.config
+./rfserver -p 1505 -d watch_data >/dev/null &
+watch_pid=$!
+sleep 1
+(cd watch_client && timeout 3 ../rfs WATCH >/dev/null) &
+watcher_pid=$!
+sleep 0.3
+if ! (cd watch_client && timeout 3 ../rfs WATCH 2>&1) | grep -q "Too many WATCH subscriptions"; then
+    echo "Failed: WATCH subscriptions beyond WATCH_MAX were accepted"
+else
+    echo "Passed: WATCH subscriptions are capped by WATCH_MAX"
+fi
+wait $watcher_pid
+kill $watch_pid
+rm -rf $watch_dirs
+
+# Test 20: Folder and prefix listings from the server's index
+echo -e "\n----Test 20: Namespace Listings (LS -d, LS -p)----"
+
+mkdir -p "$remote_dir/tree/sub"
+printf "12345" >"$local_dir/five.txt"
+printf "1234567890" >"$local_dir/ten.txt"
+./rfs WRITE "$local_dir/five.txt" "$remote_dir/tree/a.txt" >/dev/null
+./rfs WRITE "$local_dir/ten.txt" "$remote_dir/tree/a.txt" >/dev/null
+./rfs WRITE "$local_dir/five.txt" "$remote_dir/tree/sub/b.txt" >/dev/null
+./rfs WRITE "$local_dir/ten.txt" "$remote_dir/tree/sub/c.txt" >/dev/null
+./rfs LS -d "$remote_dir/tree" >"$local_dir/tree.out"
+if grep -q "a.txt .* 2 version(s), 10 byte(s)$" "$local_dir/tree.out" &&
+    grep -q "sub/ .* 2 file(s), 2 version(s), 15 byte(s)$" "$local_dir/tree.out" &&
+    grep -q "^Total: 3 file(s), 4 version(s), 25 byte(s)$" "$local_dir/tree.out"; then
+    echo "Passed: LS -d lists files and subfolders with counts and sizes"
+else
+    echo "Failed: LS -d listing"
+fi
+
+if ./rfs LS -p "$remote_dir/tree/sub/" | grep -q "^Total: 2 file(s), 2 version(s), 15 byte(s)$" &&
+    ./rfs LS -p "$remote_dir/tree/a" | grep -q "$remote_dir/tree/a.txt"; then
+    echo "Passed: LS -p lists every path with a prefix"
+else
+    echo "Failed: LS -p listing"
+fi
+
+# Removing a folder drops everything inside it from the index
+./rfs RM "$remote_dir/tree/sub" >/dev/null
+if ./rfs LS -d "$remote_dir/tree" | grep -q "^Total: 1 file(s), 2 version(s), 10 byte(s)$" &&
+    ! grep -q "$remote_dir/tree/sub/" "$file_version"; then
+    echo "Passed: Folder RM removes its files from the listing"
+else
+    echo "Failed: Folder RM left entries behind"
+fi
+
+# Commits append to the version info file, which is compacted as it grows
+for i in $(seq 1 30); do
+    ./rfs WRITE "$local_dir/five.txt" "$remote_dir/tree/appended.txt" >/dev/null
+done
+catalog_paths=$(cut -d= -f1 "$file_version" | sort -u | wc -l)
+if [ "$(grep "^$remote_dir/tree/appended.txt=" "$file_version" | tail -n 1)" == "$remote_dir/tree/appended.txt=29" ] &&
+    [ "$(wc -l <"$file_version")" -le $((2 * catalog_paths)) ] &&
+    ./rfs LS -d "$remote_dir/tree" | grep -q "appended.txt .* 30 version(s), 5 byte(s)$"; then
+    echo "Passed: Appended version info stays compact and current"
+else
+    echo "Failed: Appended version info"
+fi
+
+# A path longer than any fixed line buffer must not hide later entries
+long_part=$(printf 'd%.0s' $(seq 1 60))
+long_path="$remote_dir/tree/$long_part/$long_part/$long_part/$long_part/long.txt"
+./rfs WRITE "$local_dir/five.txt" "$long_path" >/dev/null
+./rfs WRITE "$local_dir/five.txt" "$remote_dir/tree/after_long.txt" >/dev/null
+./rfs WRITE "$local_dir/ten.txt" "$remote_dir/tree/after_long.txt" >/dev/null
+./rfs WRITE "$local_dir/five.txt" "$remote_dir/tree/after_long.txt" >/dev/null
+if [ -f "$remote_dir/tree/after_long_2.txt" ] && [ "$(cat $remote_dir/tree/after_long_1.txt)" == "1234567890" ] &&
+    grep -q "^$long_path=0$" "$file_version"; then
+    echo "Passed: Versions stay unique after a very long path"
+else
+    echo "Failed: A very long path froze the version info"
+fi
+
+# Test 21: Tiered storage of idle versions
+echo -e "\n----Test 21: Tiered Storage----"
+
+mkdir -p "tier_data/$remote_dir" tier_client
+printf "IP_ADDRESS=127.0.0.1\nTIER_AFTER=1\nTIER_INTERVAL=1\nREPLICATE_FROM=127.0.0.2\n" >tier_data/.config
+./rfserver -p 1506 -d tier_data >/dev/null &
+tier_pid=$!
+printf "IP_ADDRESS=127.0.0.1\nPORT=1506\n" >tier_client/.config
+sleep 1
+
+# v0 plain, v1 an APPEND referencing v0, v2 plain again
+seq 1 20000 >"$local_dir/cold.txt"
+seq 20001 20100 >"$local_dir/cold_tail.txt"
+cat "$local_dir/cold.txt" "$local_dir/cold_tail.txt" >"$local_dir/cold_v1.txt"
+(cd tier_client && ../rfs WRITE "../$local_dir/cold.txt" "$remote_dir/cold.txt" >/dev/null)
+(cd tier_client && ../rfs APPEND "../$local_dir/cold_tail.txt" "$remote_dir/cold.txt" >/dev/null)
+(cd tier_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/cold.txt" >/dev/null)
+# and a folder whose first version of a file goes cold as well
+(cd tier_client && ../rfs WRITE "../$local_dir/cold.txt" "$remote_dir/cold_dir/inner.txt" >/dev/null)
+(cd tier_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/cold_dir/inner.txt" >/dev/null)
+sleep 4
+if [ "$(find tier_data/.cold -name '*.gz' | wc -l)" -eq 3 ] && [ ! -e "tier_data/.cold/$remote_dir" ] &&
+    [ "$(stat -c %s "tier_data/$remote_dir/cold.txt")" -lt 100 ] &&
+    [ "$(stat -c %s "tier_data/$remote_dir/cold_dir/inner.txt")" -lt 100 ] &&
+    cmp -s "$local_dir/storm.txt" "tier_data/$remote_dir/cold_2.txt"; then
+    echo "Passed: Idle old versions are compressed and the latest one stays hot"
+else
+    echo "Failed: Tiering of idle versions"
+fi
+
+(cd tier_client && ../rfs GET -v0 "$remote_dir/cold.txt" "../$local_dir/cold_get0.txt" >/dev/null)
+(cd tier_client && ../rfs GET -v1 "$remote_dir/cold.txt" "../$local_dir/cold_get1.txt" >/dev/null)
+if cmp -s "$local_dir/cold.txt" "$local_dir/cold_get0.txt" && cmp -s "$local_dir/cold_v1.txt" "$local_dir/cold_get1.txt"; then
+    echo "Passed: GET reads cold versions transparently"
+else
+    echo "Failed: GET of cold versions"
+fi
+
+# An upload shaped like a stub is content, never a pointer to another file
+printf "%s" "Server secret" >"$local_dir/secret.txt"
+{ printf '\x00RFS-COLDZIP-1\n\x00\x0d\x00\x00\x00\x00\x00\x00\x00'; printf "%s" "$PWD/$local_dir/secret.txt"; } >"$local_dir/forged.bin"
+(cd tier_client && ../rfs WRITE "../$local_dir/forged.bin" "$remote_dir/forged.bin" >/dev/null)
+(cd tier_client && ../rfs GET "$remote_dir/forged.bin" "../$local_dir/forged_get.bin" >/dev/null)
+if cmp -s "$local_dir/forged.bin" "$local_dir/forged_get.bin"; then
+    echo "Passed: Content shaped like a cold stub is served as uploaded"
+else
+    echo "Failed: Content shaped like a cold stub was read through"
+fi
+
+(cd tier_client && ../rfs RM "$remote_dir/cold.txt" >/dev/null)
+cold_left=$(find tier_data/.cold -name '*.gz' | wc -l)
+(cd tier_client && ../rfs RM "$remote_dir/cold_dir" >/dev/null)
+if [ "$cold_left" -eq 1 ] && [ "$(find tier_data/.cold -name '*.gz' | wc -l)" -eq 0 ] &&
+    [ ! -e "tier_data/$remote_dir/cold_dir" ]; then
+    echo "Passed: RM removes the cold copies of files and folders"
+else
+    echo "Failed: RM left cold copies behind"
+fi
+
+# Only the hosts in REPLICATE_FROM may push changes through REPLICATE
+replicate_reply=$(
+    exec 3<>/dev/tcp/127.0.0.1/1506
+    rawText REPLICATE >&3
+    timeout 2 cat <&3 | wc -c
+)
+if [ "$replicate_reply" -eq 0 ]; then
+    echo "Passed: REPLICATE from a host not in REPLICATE_FROM is refused"
+else
+    echo "Failed: REPLICATE accepted from an unlisted host"
+fi
+kill $tier_pid
+rm -rf $tier_dirs
+
+# Test 22: Incremental SYNC of a local folder
+echo -e "\n----Test 22: SYNC----"
+
+mkdir -p "$local_dir/tree/docs/old"
+printf "alpha" >"$local_dir/tree/a.txt"
+printf "beta" >"$local_dir/tree/docs/b.txt"
+printf "gamma" >"$local_dir/tree/docs/old/c.txt"
+./rfs SYNC "$local_dir/tree" "$remote_dir/mirror" >"$local_dir/sync1.out"
+if grep -q "3 of 3 changed file(s) stored, 0 unchanged" "$local_dir/sync1.out" &&
+    ./rfs LS -p "$remote_dir/mirror/" | grep -q "^Total: 3 file(s), 3 version(s), 14 byte(s)$"; then
+    echo "Passed: SYNC uploads a folder tree"
+else
+    echo "Failed: SYNC of a new tree"
+fi
+
+# Nothing changed: nothing is sent and no file is hashed again
+./rfs SYNC "$local_dir/tree" "$remote_dir/mirror" >"$local_dir/sync2.out"
+if grep -q "0 of 0 changed file(s) stored, 3 unchanged, 0 checksum(s) computed" "$local_dir/sync2.out"; then
+    echo "Passed: SYNC of an unchanged folder uploads nothing"
+else
+    echo "Failed: SYNC re-sent unchanged files"
+fi
+
+printf "BETA" >"$local_dir/tree/docs/b.txt"
+printf "delta" >"$local_dir/tree/docs/d.txt"
+./rfs SYNC "$local_dir/tree" "$remote_dir/mirror" >"$local_dir/sync3.out"
+./rfs GET "$remote_dir/mirror/docs/b.txt" "$local_dir/sync_b.txt" >/dev/null
+if grep -q "2 of 2 changed file(s) stored, 2 unchanged" "$local_dir/sync3.out" &&
+    cmp -s "$local_dir/tree/docs/b.txt" "$local_dir/sync_b.txt" &&
+    ./rfs LS -p "$remote_dir/mirror/" | grep -q "^Total: 4 file(s), 5 version(s), 19 byte(s)$"; then
+    echo "Passed: SYNC uploads only changed and new files"
+else
+    echo "Failed: SYNC of changed files"
+fi
+
+# Test 23: Deadlines and eviction of slow clients (STRESS=1 for many more bad peers)
+echo -e "\n----Test 23: Slow Client Eviction----"
+
+# A WRITE announcing 1 MiB, then trickling one byte every half second
+slowWriter() {
+    exec 3<>/dev/tcp/127.0.0.1/1507 || return
+    { rawText WRITE; rawText "$remote_dir/slow.txt"; printf '\x00\x00\x10\x00\x00\x00\x00\x00'; } >&3
+    for _ in $(seq 1 40); do
+        printf x >&3 2>/dev/null || break
+        sleep 0.5
+    done
+}
+
+# A REPLICATE stream that goes silent after the handshake
+silentReplicator() {
+    exec 3<>/dev/tcp/127.0.0.1/1507 || return
+    rawText REPLICATE >&3
+    sleep 20
+}
+
+# A GET of a large file whose reply is never read
+stalledReader() {
+    exec 3<>/dev/tcp/127.0.0.1/1507 || return
+    { rawText GET; rawText "$remote_dir/big.bin"; printf '\xff\xff\xff\xff'; rawText "-"; } >&3
+    sleep 20
+}
+
+if [ "${STRESS:-0}" -eq 1 ]; then
+    bad_peers=64
+else
+    bad_peers=4
+fi
+mkdir -p "stress_data/$remote_dir" stress_client
+printf "IP_ADDRESS=127.0.0.1\nWORKERS=2\nIDLE_TIMEOUT=2\nREAD_TIMEOUT=2\nWRITE_TIMEOUT=2\nMIN_TRANSFER_RATE=1024\nMIN_RATE_GRACE=2\n" >stress_data/.config
+./rfserver -p 1507 -d stress_data >"$local_dir/stress_server.log" &
+stress_pid=$!
+printf "IP_ADDRESS=127.0.0.1\nPORT=1507\n" >stress_client/.config
+sleep 1
+head -c 16777216 /dev/zero >"$local_dir/big.bin"
+(cd stress_client && ../rfs WRITE "../$local_dir/big.bin" "$remote_dir/big.bin" >/dev/null)
+
+# Half-open peers that never send a byte, a slowloris writer, a stalled reader
+# and a silent REPLICATE stream
+bad_pids=""
+for _ in $(seq 1 $bad_peers); do
+    (exec 3<>/dev/tcp/127.0.0.1/1507 && sleep 20) 2>/dev/null &
+    bad_pids="$bad_pids $!"
+done
+slowWriter 2>/dev/null &
+bad_pids="$bad_pids $!"
+stalledReader 2>/dev/null &
+bad_pids="$bad_pids $!"
+silentReplicator 2>/dev/null &
+bad_pids="$bad_pids $!"
+sleep 0.5
+
+# Two workers are all the bad peers find, yet a well-behaved client still gets through
+if (cd stress_client && timeout 10 ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/good.txt" >/dev/null); then
+    echo "Passed: Requests are served while slow and half-open clients hold connections"
+else
+    echo "Failed: Bad peers exhausted the server"
+fi
+
+sleep 6
+evicted=$(grep -c "^Evicted client" "$local_dir/stress_server.log")
+if [ "$evicted" -ge $((bad_peers + 3)) ] && kill -0 $stress_pid 2>/dev/null; then
+    echo "Passed: Idle, trickling, stalled and silent replication clients are evicted ($evicted)"
+else
+    echo "Failed: Only $evicted of $((bad_peers + 3)) bad clients were evicted"
+fi
+
+# The evicted writer's folder lock and partial version are gone
+if [ ! -e "stress_data/$remote_dir/.file_LOCK" ] && [ ! -e "stress_data/$remote_dir/slow.txt" ] &&
+    ! grep -q "slow.txt" stress_data/.file_VERSION &&
+    (cd stress_client && ../rfs WRITE "../$local_dir/storm.txt" "$remote_dir/slow.txt" | grep -q "'$remote_dir/slow.txt'"); then
+    echo "Passed: Eviction releases the folder lock and drops the partial version"
+else
+    echo "Failed: Evicted writer left its lock or version behind"
+fi
+kill $bad_pids 2>/dev/null
+kill $stress_pid
+rm -rf $stress_dirs
+
+# Test 24: Server EXIT
+echo -e "\n----Test 24: Server EXIT Test----"
 
 # Execute EXIT command
 ./rfs EXIT
@@ -206,4 +1134,5 @@ else
     echo "Failed: Fail to perform rfs EXIT"
 fi
 
+kill $replica_pid
 make clean
@@ -0,0 +1,195 @@
+/*
+ * tier.c -- Moving versions nobody reads to compressed cold storage
+ *
+ * Old versions are rarely read again, yet each one keeps its full size on
+ * disk. A background thread wakes every TIER_INTERVAL seconds and walks the
+ * catalog. Every version other than the latest one that was neither read nor
+ * written for TIER_AFTER seconds is frozen (storeFreeze): its content is
+ * compressed into TIER_DIR/<hh>/<hash of the version file name>.gz and the
+ * version file becomes a small stub, which storeOpen reads through
+ * transparently. Being a hash, a cold name never leaves TIER_DIR, whatever
+ * the path.
+ *
+ * The latest version stays hot, as WRITE, APPEND and PATCH build on it, and
+ * so does any version whose bytes an extent map still references. The slow
+ * part of freezing runs without the catalog lock, which is only taken for
+ * the final swap, so requests are never held up by the compression.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "helper.h"
+#include "catalog.h"
+#include "store.h"
+#include "tier.h"
+
+static int tier_after = 0;
+static int tier_interval = 0;
+static char tier_dir[TIER_NAME_SIZE] = "";
+static void (*catalog_lock)(void) = NULL;
+static void (*catalog_unlock)(void) = NULL;
+
+// Function: name of the cold copy of a version file, always under TIER_DIR
+// The copies are spread over 256 folders by the hash of the name. Returns 0
+// when there is none: no TIER_DIR.
+int tierColdName(char *cold_name, size_t size, const char *file_name)
+{
+  if (tier_dir[0] == '\0')
+  {
+    return 0;
+  }
+  unsigned long long hash = hashString(file_name);
+  return snprintf(cold_name, size, "%s/%02llx/%016llx.gz", tier_dir, hash & 0xff, hash) < (int)size;
+}
+
+// Helper function:
+// Whether a version file went unused for TIER_AFTER seconds
+static int isIdle(const char *file_name, time_t now)
+{
+  struct stat file_stat;
+  if (stat(file_name, &file_stat) != 0 || !S_ISREG(file_stat.st_mode))
+  {
+    return 0;
+  }
+  time_t used = file_stat.st_atime > file_stat.st_mtime ? file_stat.st_atime : file_stat.st_mtime;
+  return now - used >= tier_after;
+}
+
+// Helper function:
+// Freeze the idle versions of one path older than its latest
+// Returns the number of versions frozen.
+static int tierPath(const char *file_path, int latest)
+{
+  char *referenced = (char *)calloc((size_t)latest + 1, 1);
+  if (referenced == NULL)
+  {
+    return 0;
+  }
+  storeReferences(file_path, latest, referenced);
+
+  char file_name[strlen(file_path) + VERSION_NAME_EXTRA];
+  time_t now = time(NULL);
+  int frozen = 0;
+  for (int v = 0; v < latest; v++)
+  {
+    createFileName(file_name, file_path, v);
+    if (!referenced[v] && isIdle(file_name, now))
+    {
+      frozen += storeFreeze(file_path, v, catalog_lock, catalog_unlock);
+    }
+  }
+  free(referenced);
+  return frozen;
+}
+
+// Helper function:
+// One pass over the catalog
+static void tierPass(void)
+{
+  catalog_lock();
+  char *catalog = readCatalog();
+  catalog_unlock();
+  if (catalog == NULL)
+  {
+    return;
+  }
+
+  int frozen = 0;
+  char *save = NULL;
+  for (char *line = strtok_r(catalog, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+  {
+    char *equals = strchr(line, '=');
+    if (equals == NULL || equals == line)
+    {
+      continue;
+    }
+    *equals = '\0';
+    frozen += tierPath(line, atoi(equals + 1));
+  }
+  free(catalog);
+  if (frozen > 0)
+  {
+    printf("Moved %d idle version(s) to %s\n", frozen, tier_dir);
+  }
+}
+
+// Helper function:
+// Tiering thread: a pass every TIER_INTERVAL seconds
+static void *tierExecutor(void *arg)
+{
+  (void)arg;
+  while (1)
+  {
+    sleep((unsigned)tier_interval);
+    tierPass();
+  }
+  return NULL;
+}
+
+// Function: start moving versions idle for after seconds to cold_dir, checking every interval seconds
+// lock and unlock guard the catalog; after 0 disables tiering.
+void tierStart(int after, int interval, const char *cold_dir, void (*lock)(void), void (*unlock)(void))
+{
+  snprintf(tier_dir, sizeof(tier_dir), "%s", cold_dir);
+  if (after <= 0)
+  {
+    return;
+  }
+  tier_after = after;
+  tier_interval = interval;
+  catalog_lock = lock;
+  catalog_unlock = unlock;
+
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, tierExecutor, NULL) != 0)
+  {
+    perror("Fail to create tiering thread");
+    return;
+  }
+  pthread_detach(tid);
+}
+
+// Helper function:
+// Remove one entry of a removed tree (nftw), a file along with its cold copy
+static int removeEntry(const char *path, const struct stat *path_stat, int type, struct FTW *walk)
+{
+  (void)path_stat;
+  (void)walk;
+  if (type == FTW_DP)
+  {
+    return rmdir(path);
+  }
+  if (unlink(path) != 0)
+  {
+    return -1;
+  }
+  char cold_name[TIER_NAME_SIZE];
+  if (type == FTW_F && tierColdName(cold_name, sizeof(cold_name), path))
+  {
+    unlink(cold_name);
+  }
+  return 0;
+}
+
+// Function: remove a version file, or a folder and everything below it, with
+// the cold copies of the files removed; returns 0 when something could not be removed
+int tierRemove(const char *file_name)
+{
+  struct stat file_stat;
+  if (lstat(file_name, &file_stat) != 0)
+  {
+    return 0;
+  }
+  if (S_ISDIR(file_stat.st_mode))
+  {
+    return nftw(file_name, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+  }
+  return removeEntry(file_name, &file_stat, S_ISREG(file_stat.st_mode) ? FTW_F : FTW_SL, NULL) == 0;
+}
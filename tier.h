@@ -0,0 +1,12 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <stddef.h>
+
+#define TIER_NAME_SIZE 1024
+
+void tierStart(int after, int interval, const char *cold_dir, void (*lock)(void), void (*unlock)(void));
+int tierRemove(const char *file_name);
+int tierColdName(char *cold_name, size_t size, const char *file_name);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * trace.c -- Low-overhead request phase tracing
+ *
+ * Every thread records complete spans (name, start, duration) into its own
+ * ring buffer of TRACE_EVENTS entries, so recording never contends with
+ * other threads. While tracing is off, traceStart/traceStop only test a flag.
+ * Rings of finished threads are reused by new ones and keep their events
+ * until the next traceEnable(1).
+ *
+ * traceDump writes the rings in Chrome trace-event format (JSON), ready for
+ * chrome://tracing or Perfetto.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "config.h"
+#include "trace.h"
+
+typedef struct
+{
+  const char *name;
+  long long start;    // nanoseconds, CLOCK_MONOTONIC
+  long long duration; // nanoseconds
+  int tid;
+} traceEvent;
+
+typedef struct traceRing
+{
+  traceEvent *events;
+  unsigned long capacity;
+  unsigned long head; // events ever recorded; the newest capacity ones are kept
+  int in_use;         // owned by a live thread
+  pthread_mutex_t lock;
+  struct traceRing *next;
+} traceRing;
+
+static volatile int trace_enabled = 0;
+static traceRing *rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static __thread traceRing *thread_ring = NULL;
+static __thread int thread_id = 0;
+
+// Helper function:
+// Hand the ring of an exiting thread back for reuse
+static void releaseRing(void *arg)
+{
+  traceRing *ring = (traceRing *)arg;
+  pthread_mutex_lock(&rings_lock);
+  ring->in_use = 0;
+  pthread_mutex_unlock(&rings_lock);
+}
+
+static void createRingKey(void)
+{
+  pthread_key_create(&ring_key, releaseRing);
+}
+
+// Helper function:
+// The calling thread's ring, taking a free one or allocating it on first use
+static traceRing *ownRing(void)
+{
+  if (thread_ring != NULL)
+  {
+    return thread_ring;
+  }
+  pthread_once(&ring_key_once, createRingKey);
+
+  pthread_mutex_lock(&rings_lock);
+  traceRing *ring = rings;
+  while (ring != NULL && ring->in_use)
+  {
+    ring = ring->next;
+  }
+  if (ring == NULL)
+  {
+    ring = (traceRing *)calloc(1, sizeof(traceRing));
+    unsigned long capacity = (unsigned long)getTunables()->trace_events;
+    if (ring == NULL || (ring->events = (traceEvent *)calloc(capacity, sizeof(traceEvent))) == NULL)
+    {
+      free(ring);
+      pthread_mutex_unlock(&rings_lock);
+      return NULL;
+    }
+    ring->capacity = capacity;
+    pthread_mutex_init(&ring->lock, NULL);
+    ring->next = rings;
+    rings = ring;
+  }
+  ring->in_use = 1;
+  pthread_mutex_unlock(&rings_lock);
+
+  pthread_setspecific(ring_key, ring);
+  thread_ring = ring;
+  thread_id = (int)syscall(SYS_gettid);
+  return ring;
+}
+
+// Helper function:
+// Monotonic clock in nanoseconds
+static long long clockNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Function: switch tracing on (dropping older events) or off
+void traceEnable(int enabled)
+{
+  if (enabled && !trace_enabled)
+  {
+    pthread_mutex_lock(&rings_lock);
+    for (traceRing *ring = rings; ring != NULL; ring = ring->next)
+    {
+      pthread_mutex_lock(&ring->lock);
+      ring->head = 0;
+      pthread_mutex_unlock(&ring->lock);
+    }
+    pthread_mutex_unlock(&rings_lock);
+  }
+  trace_enabled = enabled;
+}
+
+// Function: whether spans are being recorded
+int traceEnabled(void)
+{
+  return trace_enabled;
+}
+
+// Function: begin timing a phase; name must be a string literal
+traceSpan traceStart(const char *name)
+{
+  traceSpan span = {name, trace_enabled ? clockNs() : 0};
+  return span;
+}
+
+// Function: record a phase begun with traceStart
+void traceStop(traceSpan span)
+{
+  if (span.start == 0 || !trace_enabled)
+  {
+    return;
+  }
+  long long end = clockNs();
+  traceRing *ring = ownRing();
+  if (ring == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock(&ring->lock);
+  traceEvent *event = &ring->events[ring->head % ring->capacity];
+  event->name = span.name;
+  event->start = span.start;
+  event->duration = end - span.start;
+  event->tid = thread_id;
+  ring->head++;
+  pthread_mutex_unlock(&ring->lock);
+}
+
+// Function: write every recorded span as Chrome trace-event JSON
+// Returns the number of events written.
+int traceDump(FILE *fp)
+{
+  int pid = (int)getpid();
+  int written = 0;
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  pthread_mutex_lock(&rings_lock);
+  for (traceRing *ring = rings; ring != NULL; ring = ring->next)
+  {
+    pthread_mutex_lock(&ring->lock);
+    unsigned long first = ring->head > ring->capacity ? ring->head - ring->capacity : 0;
+    for (unsigned long i = first; i < ring->head; i++)
+    {
+      const traceEvent *event = &ring->events[i % ring->capacity];
+      fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"rfs\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+              written == 0 ? "" : ",", event->name, event->start / 1000.0, event->duration / 1000.0, pid, event->tid);
+      written++;
+    }
+    pthread_mutex_unlock(&ring->lock);
+  }
+  pthread_mutex_unlock(&rings_lock);
+  fprintf(fp, "\n]}\n");
+  return written;
+}
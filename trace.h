@@ -0,0 +1,19 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+// A phase being timed; start is 0 when tracing was off as it began
+typedef struct
+{
+  const char *name;
+  long long start;
+} traceSpan;
+
+void traceEnable(int enabled);
+int traceEnabled(void);
+traceSpan traceStart(const char *name);
+void traceStop(traceSpan span);
+int traceDump(FILE *fp);
+
+#endif
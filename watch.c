@@ -0,0 +1,287 @@
+/*
+ * watch.c -- Pushed notifications of committed changes
+ *
+ * Every committed WRITE and RM is also appended to an in-memory ring of
+ * events, numbered by a sequence that starts at 1 with the process. The
+ * numbers a client sees carry a per-process epoch in their high half, so a
+ * number handed out by another process never looks resumable. A WATCH
+ * subscriber keeps its connection open on a thread of its own and sleeps
+ * until an event lands. It then waits WATCH_COALESCE_MS for the rest of the
+ * burst, copies out the events its filter matches, and sends them as one
+ * batch holding only the latest event of every path. The batch is coalesced
+ * after the ring is released, so commits never wait on a slow subscriber. An idle subscription gets an empty batch every
+ * WATCH_HEARTBEAT_SEC seconds, which also notices a client that went away.
+ *
+ * A subscription that cannot be served gets the sequence number 0, which is
+ * never handed out, and the reason as text.
+ *
+ * A subscriber resumes by asking for the events from a sequence number on.
+ * When those already left the ring, or the number carries the epoch of
+ * another process, it first gets a RESET event: it has to re-read what it
+ * watches (LS) before following the new events.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "helper.h"
+#include "config.h"
+#include "arena.h"
+#include "watch.h"
+
+// Low half of a client's sequence number: the event's number in this process
+#define SEQ_MASK 0xffffffffUL
+
+typedef struct
+{
+  unsigned long seq;
+  int op;
+  char *path;
+  int version;
+} watchEvent;
+
+static watchEvent *event_ring = NULL;
+static unsigned long ring_capacity = 0;
+static unsigned long next_seq = 1; // sequence number of the next event
+static unsigned long epoch = 0;    // high half of every number a client sees
+static int stopping = 0;
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watch_cond = PTHREAD_COND_INITIALIZER;
+
+// Function: keep the latest events committed, for subscribers to resume from
+void watchStart(int events)
+{
+  event_ring = (watchEvent *)calloc((size_t)events, sizeof(watchEvent));
+  if (event_ring == NULL)
+  {
+    perror("Fail to allocate the watch events");
+    return;
+  }
+  ring_capacity = (unsigned long)events;
+
+  // Processes started in the same second still differ by pid or nanoseconds.
+  // 31 bits keep every number a positive long for the client to parse.
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  unsigned long stamp = ((unsigned long)now.tv_sec ^ (unsigned long)now.tv_nsec ^ (unsigned long)getpid()) & 0x7fffffffUL;
+  epoch = (stamp == 0 ? 1 : stamp) << 32;
+}
+
+// Function: record a committed WRITE or RM (WATCH_OP_*) and wake the subscribers
+void watchPublish(int op, const char *file_path, int version)
+{
+  if (ring_capacity == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&watch_lock);
+  watchEvent *slot = &event_ring[next_seq % ring_capacity];
+  free(slot->path);
+  slot->seq = next_seq++;
+  slot->op = op;
+  slot->path = strdup(file_path);
+  slot->version = version;
+  pthread_cond_broadcast(&watch_cond);
+  pthread_mutex_unlock(&watch_lock);
+}
+
+// Function: end every subscription, for a draining server
+void watchStop(void)
+{
+  pthread_mutex_lock(&watch_lock);
+  stopping = 1;
+  pthread_cond_broadcast(&watch_cond);
+  pthread_mutex_unlock(&watch_lock);
+}
+
+// Helper function:
+// Whether an event concerns a filter: an exact path, a folder ending in '/'
+// or a prefix ending in '*' ("*" alone matches everything). Removing a
+// folder concerns every filter inside it.
+static int watchMatches(const char *filter, int op, const char *path)
+{
+  size_t filter_len = strlen(filter), path_len = strlen(path);
+  if (op == WATCH_OP_RM && path_len > 0 && filter_len > path_len && strncmp(filter, path, path_len) == 0 &&
+      (filter[path_len] == '/' || path[path_len - 1] == '/'))
+  {
+    return 1;
+  }
+  if (filter_len > 0 && filter[filter_len - 1] == '*')
+  {
+    return strncmp(path, filter, filter_len - 1) == 0;
+  }
+  if (filter_len > 0 && filter[filter_len - 1] == '/')
+  {
+    return strncmp(path, filter, filter_len) == 0;
+  }
+  return strcmp(path, filter) == 0;
+}
+
+// Helper function:
+// Send one batch: the number of events and the sequence number to resume
+// from, then per event its sequence number, WATCH_OP_*, version and path.
+// Sequence numbers go out with the epoch of this process.
+// Events coalesced away have a NULL path and are skipped.
+static int sendBatch(int sockD, const watchEvent *batch, int count, unsigned long next)
+{
+  int live = 0;
+  for (int i = 0; i < count; i++)
+  {
+    live += batch[i].path != NULL;
+  }
+  unsigned long seq = epoch | next;
+  int ok = sendAll(sockD, &live, sizeof(live)) && sendAll(sockD, &seq, sizeof(seq));
+  for (int i = 0; ok && i < count; i++)
+  {
+    if (batch[i].path != NULL)
+    {
+      seq = epoch | batch[i].seq;
+      ok = sendAll(sockD, &seq, sizeof(seq)) && sendAll(sockD, &batch[i].op, sizeof(batch[i].op)) &&
+           sendAll(sockD, &batch[i].version, sizeof(batch[i].version)) && sendText(sockD, batch[i].path);
+    }
+  }
+  return ok;
+}
+
+// Helper function:
+// Keep only the latest event of every path in a batch, in time order;
+// returns the number of events left. The lookup table comes from the arena.
+static int coalesceBatch(watchEvent *batch, int count)
+{
+  size_t slots = 2;
+  while (slots < 2 * (size_t)count)
+  {
+    slots <<= 1;
+  }
+  int *table = (int *)arenaAlloc(slots * sizeof(int));
+  if (table == NULL)
+  {
+    return count; // deliver every event rather than none
+  }
+  memset(table, -1, slots * sizeof(int));
+
+  int live = 0;
+  for (int i = count - 1; i >= 0; i--)
+  {
+    if (batch[i].op == WATCH_OP_RESET)
+    {
+      live++;
+      continue;
+    }
+    size_t slot = hashString(batch[i].path) & (slots - 1);
+    while (table[slot] >= 0 && strcmp(batch[table[slot]].path, batch[i].path) != 0)
+    {
+      slot = (slot + 1) & (slots - 1);
+    }
+    if (table[slot] >= 0)
+    {
+      batch[i].path = NULL; // a later event of the same path follows
+      continue;
+    }
+    table[slot] = i;
+    live++;
+  }
+  return live;
+}
+
+// Function: turn down a WATCH subscription
+void watchRefuse(int sockD, const char *reason)
+{
+  unsigned long none = 0;
+  if (!sendAll(sockD, &none, sizeof(none)) || !sendText(sockD, reason))
+  {
+    perror("Error refusing a watch");
+  }
+}
+
+// Function: serve a WATCH subscription until the client leaves or the server stops
+// from is the first sequence number wanted, 0 for the events committed from now on.
+void watchServe(int sockD, const char *filter, unsigned long from)
+{
+  pthread_mutex_lock(&watch_lock);
+  unsigned long next = next_seq;
+  pthread_mutex_unlock(&watch_lock);
+
+  // A number from another process, or past the end, cannot be resumed from
+  int reset = 0;
+  if (from != 0)
+  {
+    reset = (from & ~SEQ_MASK) != epoch || (from & SEQ_MASK) > next;
+    next = reset ? next : from & SEQ_MASK;
+  }
+  unsigned long seq = epoch | next;
+  if (!sendAll(sockD, &seq, sizeof(seq)))
+  {
+    return;
+  }
+
+  // At most the whole ring plus a RESET goes out at once
+  watchEvent *batch = (watchEvent *)malloc((ring_capacity + 1) * sizeof(watchEvent));
+  if (batch == NULL)
+  {
+    perror("Fail to allocate a watch batch");
+    return;
+  }
+  long coalesce_ns = (long)getTunables()->watch_coalesce_ms * 1000000L;
+  int alive = 1;
+  while (alive)
+  {
+    // Sleep until something is committed, or it is time for a heartbeat
+    pthread_mutex_lock(&watch_lock);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += WATCH_HEARTBEAT_SEC;
+    int idle = 0;
+    while (!stopping && !reset && next == next_seq && !idle)
+    {
+      idle = pthread_cond_timedwait(&watch_cond, &watch_lock, &deadline) == ETIMEDOUT;
+    }
+    if (stopping)
+    {
+      pthread_mutex_unlock(&watch_lock);
+      break;
+    }
+    if (next != next_seq && coalesce_ns > 0)
+    {
+      // Let the rest of the burst land
+      pthread_mutex_unlock(&watch_lock);
+      struct timespec pause = {coalesce_ns / 1000000000L, coalesce_ns % 1000000000L};
+      nanosleep(&pause, NULL);
+      pthread_mutex_lock(&watch_lock);
+    }
+
+    // Copy out the matching events; they are coalesced once the lock is released
+    arenaBegin();
+    int count = 0;
+    unsigned long oldest = next_seq > ring_capacity ? next_seq - ring_capacity : 1;
+    if (reset || next < oldest)
+    {
+      next = next < oldest ? oldest : next;
+      batch[count++] = (watchEvent){next, WATCH_OP_RESET, (char *)filter, 0};
+      reset = 0;
+    }
+    for (; next < next_seq; next++)
+    {
+      const watchEvent *event = &event_ring[next % ring_capacity];
+      if (watchMatches(filter, event->op, event->path))
+      {
+        batch[count] = (watchEvent){event->seq, event->op, arenaStrdup(event->path), event->version};
+        count += batch[count].path != NULL;
+      }
+    }
+    pthread_mutex_unlock(&watch_lock);
+
+    int live = coalesceBatch(batch, count);
+    if (live > 0 || idle)
+    {
+      alive = sendBatch(sockD, batch, count, next);
+    }
+    arenaEnd();
+  }
+  free(batch);
+}
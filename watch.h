@@ -0,0 +1,13 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// Seconds an idle subscription waits before an empty batch checks the client is alive
+#define WATCH_HEARTBEAT_SEC 5
+
+void watchStart(int events);
+void watchPublish(int op, const char *file_path, int version);
+void watchServe(int sockD, const char *filter, unsigned long from);
+void watchRefuse(int sockD, const char *reason);
+void watchStop(void);
+
+#endif